@@ -0,0 +1,574 @@
+#pragma once
+
+// Consolidated archive for large folders: every page goes into one file
+// instead of a .txt/.xml pair per image, with an index that answers word
+// and phrase lookups from a read-only memory map without parsing the file.
+//
+// File: "OCRA" u32 version u64 committedEnd, then segments. A segment is
+// written at the end of a run (and every segmentPages pages):
+//   page records: u32 sourceLen, source bytes, page record (serializePage)
+//   zero padding to 8 bytes, then the index:
+//     ArchivePage[pageCount]        record offset and size, in page order
+//     ArchiveSource[pageCount]      source hash -> page, sorted by hash
+//     ArchiveToken[tokenCount]      token hash -> postings, sorted by hash
+//     ArchivePosting[postingCount]  (page, word), sorted
+//   ArchiveTrailer
+// committedEnd is updated after each trailer; anything behind it is a run
+// that was killed and is cut off when the archive is opened for writing.
+// Readers walk the segments backwards from there: a trailer gives the start
+// of its segment, which is where the previous segment ends.
+//
+// Tokens are the engine's words, trimmed of ASCII punctuation and ASCII
+// lowercased; a phrase is a run of consecutive words of a page (line breaks
+// included). Lookups hash the query the same way and confirm every hit
+// against the stored words.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ocr_types.h"
+#include "result_cache.h"
+#include "serializer.h"
+
+constexpr uint32_t kArchiveVersion = 1;
+constexpr uint32_t kArchiveTrailerMagic = 0x4753434F; // "OCSG"
+constexpr uint64_t kArchiveHeaderSize = 16;
+// Pages per segment; bounds the postings kept in memory while writing
+constexpr size_t kArchiveSegmentPages = 8192;
+
+struct ArchivePage {
+  uint64_t offset;
+  uint64_t sourceHash;
+  uint32_t size;
+  uint32_t wordCount;
+};
+
+struct ArchiveSource {
+  uint64_t hash;
+  uint32_t page;
+  uint32_t reserved;
+};
+
+struct ArchiveToken {
+  uint64_t hash;
+  uint64_t first; // index of the first posting
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct ArchivePosting {
+  uint32_t page; // in the segment
+  uint32_t word; // in the page, counted over all lines
+};
+
+struct ArchiveTrailer {
+  uint64_t segmentStart;
+  uint64_t indexOffset;
+  uint64_t postingCount;
+  uint32_t pageCount;
+  uint32_t tokenCount;
+  uint32_t magic;
+  uint32_t version;
+};
+
+static_assert(sizeof(ArchivePage) == 24 && sizeof(ArchiveSource) == 16 && sizeof(ArchiveToken) == 24 &&
+                  sizeof(ArchivePosting) == 8 && sizeof(ArchiveTrailer) == 40,
+              "archive structs are part of the file format");
+
+namespace archive_detail {
+
+// FNV-1a
+inline uint64_t hashBytes(std::string_view s) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (unsigned char c : s) h = (h ^ c) * 0x100000001B3ull;
+  return h;
+}
+
+inline bool isTrimmed(unsigned char c) { return c < 0x80 && !isalnum(c); }
+
+// Token text of a word: ASCII punctuation trimmed, ASCII lowercased.
+// Empty for words that are only punctuation.
+inline void normalizeToken(std::string_view word, std::string &out) {
+  out.clear();
+  size_t begin = 0, end = word.size();
+  while (begin < end && isTrimmed((unsigned char)word[begin])) begin++;
+  while (end > begin && isTrimmed((unsigned char)word[end - 1])) end--;
+  for (size_t i = begin; i < end; i++) {
+    char c = word[i];
+    out.push_back(c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c);
+  }
+}
+
+inline bool seek(FILE *f, uint64_t pos) {
+#ifdef _WIN32
+  return _fseeki64(f, (int64_t)pos, SEEK_SET) == 0;
+#else
+  return fseeko(f, (off_t)pos, SEEK_SET) == 0;
+#endif
+}
+
+} // namespace archive_detail
+
+// Appends pages to an archive. Not thread safe; pages come from the writer
+// thread.
+class ArchiveWriter {
+public:
+  ~ArchiveWriter() { close(); }
+
+  // Creates the archive or continues an existing one in a new segment
+  bool open(const std::string &path, size_t segmentPages = kArchiveSegmentPages) {
+    segmentPages_ = std::max<size_t>(segmentPages, 1);
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) {
+      FILE *f = fopen(path.c_str(), "rb");
+      char header[kArchiveHeaderSize];
+      bool ok = f && fread(header, 1, sizeof(header), f) == sizeof(header);
+      if (f) fclose(f);
+      uint32_t version = 0;
+      if (ok) {
+        memcpy(&version, header + 4, 4);
+        memcpy(&end_, header + 8, 8);
+      }
+      if (!ok || memcmp(header, "OCRA", 4) != 0 || version != kArchiveVersion || end_ < kArchiveHeaderSize) {
+        fprintf(stderr, "%s is not an OCR archive\n", path.c_str());
+        return false;
+      }
+      if (std::filesystem::file_size(path, ec) > end_) {
+        std::filesystem::resize_file(path, end_, ec); // drop an unfinished segment
+      }
+      file_ = fopen(path.c_str(), "r+b");
+      if (file_ && !archive_detail::seek(file_, end_)) {
+        fclose(file_);
+        file_ = nullptr;
+      }
+    } else {
+      file_ = fopen(path.c_str(), "w+b");
+      end_ = 0;
+      if (file_) {
+        OutputBuffer header;
+        header.append("OCRA");
+        header.appendRaw(kArchiveVersion);
+        header.appendRaw(kArchiveHeaderSize);
+        write(header.data(), header.size());
+        fflush(file_);
+      }
+    }
+    if (!file_) {
+      fprintf(stderr, "Failed to open archive %s\n", path.c_str());
+      return false;
+    }
+    segmentStart_ = end_;
+    return !failed_;
+  }
+
+  // Appends a page; source is the name lookups report it under
+  bool add(const std::string &source, const OcrPage &page) {
+    if (!file_ || failed_) return false;
+    record_.clear();
+    record_.appendSized(source);
+    serializePage(record_, page);
+    uint32_t pageIndex = (uint32_t)pages_.size();
+    uint64_t sourceHash = archive_detail::hashBytes(source);
+    pages_.push_back({end_, sourceHash, (uint32_t)record_.size(), (uint32_t)page.wordCount()});
+    sources_.push_back({sourceHash, pageIndex, 0});
+    names_.push_back(source);
+    for (uint32_t w = 0; w < page.wordCount(); w++) {
+      archive_detail::normalizeToken(page.wordContent(w), token_);
+      if (!token_.empty()) postings_.push_back({archive_detail::hashBytes(token_), {pageIndex, w}});
+    }
+    if (!write(record_.data(), record_.size())) return false;
+    totalPages_++;
+    if (pages_.size() >= segmentPages_) return flushSegment();
+    return true;
+  }
+
+  // Writes the index of the open segment; false if anything failed to write
+  bool close() {
+    if (!file_) return !failed_;
+    flushSegment();
+    fclose(file_);
+    file_ = nullptr;
+    return !failed_;
+  }
+
+  size_t pages() const { return totalPages_; }
+
+  // Called with the source of every page once its segment is committed
+  std::function<void(const std::string &)> onCommit;
+
+private:
+  struct TokenPosting {
+    uint64_t hash;
+    ArchivePosting posting;
+  };
+
+  bool write(const void *data, size_t size) {
+    if (failed_ || fwrite(data, 1, size, file_) != size) {
+      if (!failed_) fprintf(stderr, "Failed to write archive\n");
+      failed_ = true;
+      return false;
+    }
+    end_ += size;
+    return true;
+  }
+
+  template <class T>
+  bool writeArray(const std::vector<T> &v) {
+    return v.empty() || write(v.data(), v.size() * sizeof(T));
+  }
+
+  bool flushSegment() {
+    if (pages_.empty() || failed_) return !failed_;
+    static const char zeros[8] = {};
+    write(zeros, (size_t)((8 - end_ % 8) % 8));
+
+    // Postings come in (page, word) order, so a stable sort by hash keeps
+    // each token's postings sorted
+    std::stable_sort(postings_.begin(), postings_.end(),
+                     [](const TokenPosting &a, const TokenPosting &b) { return a.hash < b.hash; });
+    std::vector<ArchiveToken> tokens;
+    std::vector<ArchivePosting> postings;
+    postings.reserve(postings_.size());
+    for (const TokenPosting &p : postings_) {
+      if (tokens.empty() || tokens.back().hash != p.hash) tokens.push_back({p.hash, postings.size(), 0, 0});
+      tokens.back().count++;
+      postings.push_back(p.posting);
+    }
+    std::sort(sources_.begin(), sources_.end(), [](const ArchiveSource &a, const ArchiveSource &b) {
+      return a.hash != b.hash ? a.hash < b.hash : a.page < b.page;
+    });
+
+    ArchiveTrailer trailer{segmentStart_, end_, postings.size(), (uint32_t)pages_.size(), (uint32_t)tokens.size(),
+                           kArchiveTrailerMagic, kArchiveVersion};
+    writeArray(pages_);
+    writeArray(sources_);
+    writeArray(tokens);
+    writeArray(postings);
+    write(&trailer, sizeof(trailer));
+    fflush(file_);
+    // Commit: readers and the next writer only see segments up to here
+    if (!failed_ && (!archive_detail::seek(file_, 8) || fwrite(&end_, sizeof(end_), 1, file_) != 1 ||
+                     fflush(file_) != 0 || !archive_detail::seek(file_, end_))) {
+      fprintf(stderr, "Failed to write archive\n");
+      failed_ = true;
+    }
+
+    if (!failed_ && onCommit) {
+      for (const std::string &name : names_) onCommit(name);
+    }
+    pages_.clear();
+    sources_.clear();
+    names_.clear();
+    postings_.clear();
+    segmentStart_ = end_;
+    return !failed_;
+  }
+
+  FILE *file_ = nullptr;
+  bool failed_ = false;
+  uint64_t end_ = 0;
+  uint64_t segmentStart_ = 0;
+  size_t segmentPages_ = kArchiveSegmentPages;
+  size_t totalPages_ = 0;
+  // Index of the open segment
+  std::vector<ArchivePage> pages_;
+  std::vector<ArchiveSource> sources_;
+  std::vector<TokenPosting> postings_;
+  std::vector<std::string> names_;
+  OutputBuffer record_;
+  std::string token_;
+};
+
+// Read-only memory map of a whole file
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+      handle_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (handle_) data_ = static_cast<const uint8_t *>(MapViewOfFile(handle_, FILE_MAP_READ, 0, 0, 0));
+      if (data_) size_ = (uint64_t)size.QuadPart;
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        data_ = static_cast<const uint8_t *>(p);
+        size_ = (uint64_t)st.st_size;
+      }
+    }
+    ::close(fd);
+#endif
+    return data_ != nullptr;
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (handle_) CloseHandle(handle_);
+    handle_ = nullptr;
+#else
+    if (data_) munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const uint8_t *data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+  HANDLE handle_ = nullptr;
+#endif
+  const uint8_t *data_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+struct ArchiveHit {
+  std::string_view source; // points into the map
+  uint32_t line = 0;       // line of the first word
+  // Union of the word boxes
+  float x = 0, y = 0, width = 0, height = 0;
+  std::string text; // the words as recognized
+};
+
+// Answers lookups straight from the mapped file; only the pages with a hit
+// are parsed
+class ArchiveReader {
+public:
+  bool open(const std::string &path) {
+    segments_.clear();
+    pageCount_ = 0;
+    if (!file_.open(path)) {
+      fprintf(stderr, "Failed to open archive %s\n", path.c_str());
+      return false;
+    }
+    const uint8_t *data = file_.data();
+    uint32_t version = 0;
+    uint64_t end = 0;
+    if (file_.size() >= kArchiveHeaderSize) {
+      memcpy(&version, data + 4, 4);
+      memcpy(&end, data + 8, 8);
+    }
+    if (file_.size() < kArchiveHeaderSize || memcmp(data, "OCRA", 4) != 0 || version != kArchiveVersion ||
+        end < kArchiveHeaderSize || end > file_.size()) {
+      fprintf(stderr, "%s is not an OCR archive\n", path.c_str());
+      return false;
+    }
+    // Newest segment first
+    while (end > kArchiveHeaderSize) {
+      Segment s;
+      if (end < kArchiveHeaderSize + sizeof(ArchiveTrailer) || !segmentAt(end - sizeof(ArchiveTrailer), s)) {
+        fprintf(stderr, "Archive %s is damaged\n", path.c_str());
+        return false;
+      }
+      segments_.push_back(s);
+      pageCount_ += s.trailer.pageCount;
+      end = s.trailer.segmentStart;
+    }
+    return true;
+  }
+
+  size_t pages() const { return pageCount_; }
+  size_t segments() const { return segments_.size(); }
+
+  // Pages containing the phrase (one or more words), newest segment first.
+  // A source archived again in a later run only reports its latest page.
+  std::vector<ArchiveHit> find(std::string_view phrase, size_t limit) {
+    std::vector<ArchiveHit> hits;
+    std::vector<std::string> words;
+    std::string token;
+    for (size_t pos = 0; pos < phrase.size();) {
+      size_t next = std::min(phrase.find_first_of(" \t\r\n", pos), phrase.size());
+      archive_detail::normalizeToken(phrase.substr(pos, next - pos), token);
+      if (!token.empty()) words.push_back(token);
+      pos = next + 1;
+    }
+    if (words.empty()) return hits;
+
+    std::vector<std::pair<const ArchivePosting *, const ArchivePosting *>> lists(words.size());
+    for (size_t si = 0; si < segments_.size() && hits.size() < limit; si++) {
+      const Segment &s = segments_[si];
+      bool all = true;
+      for (size_t k = 0; k < words.size() && all; k++) {
+        all = postingsOf(s, archive_detail::hashBytes(words[k]), lists[k]);
+      }
+      if (!all) continue;
+      for (const ArchivePosting *p = lists[0].first; p != lists[0].second && hits.size() < limit; p++) {
+        bool phraseMatch = true;
+        for (size_t k = 1; k < words.size() && phraseMatch; k++) {
+          ArchivePosting want{p->page, p->word + (uint32_t)k};
+          phraseMatch = std::binary_search(lists[k].first, lists[k].second, want, postingLess);
+        }
+        if (phraseMatch) confirm(si, *p, words, hits);
+      }
+    }
+    return hits;
+  }
+
+private:
+  struct Segment {
+    ArchiveTrailer trailer;
+    const ArchivePage *pages;
+    const ArchiveSource *sources;
+    const ArchiveToken *tokens;
+    const ArchivePosting *postings;
+  };
+
+  static bool postingLess(const ArchivePosting &a, const ArchivePosting &b) {
+    return a.page != b.page ? a.page < b.page : a.word < b.word;
+  }
+
+  // Checks the trailer at pos and the sizes of the index arrays before it
+  bool segmentAt(uint64_t pos, Segment &s) {
+    memcpy(&s.trailer, file_.data() + pos, sizeof(s.trailer));
+    const ArchiveTrailer &t = s.trailer;
+    if (t.magic != kArchiveTrailerMagic || t.version != kArchiveVersion || t.segmentStart < kArchiveHeaderSize ||
+        t.indexOffset < t.segmentStart || t.indexOffset > pos || t.indexOffset % 8 != 0) {
+      return false;
+    }
+    uint64_t bytes = (uint64_t)t.pageCount * (sizeof(ArchivePage) + sizeof(ArchiveSource)) +
+                     (uint64_t)t.tokenCount * sizeof(ArchiveToken);
+    if (bytes > pos - t.indexOffset || pos - t.indexOffset - bytes != t.postingCount * sizeof(ArchivePosting)) {
+      return false;
+    }
+    const uint8_t *index = file_.data() + t.indexOffset;
+    s.pages = reinterpret_cast<const ArchivePage *>(index);
+    s.sources = reinterpret_cast<const ArchiveSource *>(s.pages + t.pageCount);
+    s.tokens = reinterpret_cast<const ArchiveToken *>(s.sources + t.pageCount);
+    s.postings = reinterpret_cast<const ArchivePosting *>(s.tokens + t.tokenCount);
+    return true;
+  }
+
+  bool postingsOf(const Segment &s, uint64_t hash,
+                  std::pair<const ArchivePosting *, const ArchivePosting *> &list) const {
+    const ArchiveToken *end = s.tokens + s.trailer.tokenCount;
+    const ArchiveToken *t =
+        std::lower_bound(s.tokens, end, hash, [](const ArchiveToken &a, uint64_t h) { return a.hash < h; });
+    if (t == end || t->hash != hash || t->first + t->count > s.trailer.postingCount) return false;
+    list = {s.postings + t->first, s.postings + t->first + t->count};
+    return true;
+  }
+
+  static bool inSegment(const Segment &s, const ArchivePage &page) {
+    return page.offset >= s.trailer.segmentStart && page.offset <= s.trailer.indexOffset &&
+           page.size <= s.trailer.indexOffset - page.offset;
+  }
+
+  // Source name of a page record; empty if the record is damaged
+  std::string_view sourceOf(const Segment &s, const ArchivePage &page) const {
+    if (!inSegment(s, page)) return std::string_view();
+    RecordReader in(reinterpret_cast<const char *>(file_.data() + page.offset), page.size);
+    std::string_view source;
+    return in.readSized(source) ? source : std::string_view();
+  }
+
+  // True if a segment newer than si has a page for source
+  bool shadowed(size_t si, uint64_t hash, std::string_view source) const {
+    for (size_t n = 0; n < si; n++) {
+      const Segment &s = segments_[n];
+      const ArchiveSource *end = s.sources + s.trailer.pageCount;
+      auto it = std::lower_bound(s.sources, end, hash, [](const ArchiveSource &a, uint64_t h) { return a.hash < h; });
+      for (; it != end && it->hash == hash; ++it) {
+        if (it->page < s.trailer.pageCount && sourceOf(s, s.pages[it->page]) == source) return true;
+      }
+    }
+    return false;
+  }
+
+  // Parses the page (once per page) and checks the words, since tokens are
+  // only compared by hash up to here
+  void confirm(size_t si, const ArchivePosting &p, const std::vector<std::string> &words,
+               std::vector<ArchiveHit> &hits) {
+    const Segment &s = segments_[si];
+    if (p.page >= s.trailer.pageCount) return;
+    const ArchivePage &entry = s.pages[p.page];
+    if (si != parsedSegment_ || p.page != parsedPage_) {
+      parsedSegment_ = si;
+      parsedPage_ = p.page;
+      parsedSource_ = std::string_view();
+      if (!inSegment(s, entry)) return;
+      RecordReader in(reinterpret_cast<const char *>(file_.data() + entry.offset), entry.size);
+      std::string_view source;
+      if (!in.readSized(source)) return;
+      size_t header = sizeof(uint32_t) + source.size();
+      if (!parsePage(reinterpret_cast<const char *>(file_.data() + entry.offset + header), entry.size - header,
+                     page_)) {
+        return;
+      }
+      parsedSource_ = shadowed(si, entry.sourceHash, source) ? std::string_view() : source;
+    }
+    if (parsedSource_.empty() || p.word + words.size() > page_.wordCount()) return;
+
+    ArchiveHit hit;
+    hit.source = parsedSource_;
+    float x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    for (size_t k = 0; k < words.size(); k++) {
+      uint32_t w = p.word + (uint32_t)k;
+      archive_detail::normalizeToken(page_.wordContent(w), token_);
+      if (token_ != words[k]) return;
+      const float *box = page_.wordBoxOf(w);
+      x0 = k ? std::min(x0, box[0]) : box[0];
+      y0 = k ? std::min(y0, box[1]) : box[1];
+      x1 = k ? std::max(x1, box[0] + box[2]) : box[0] + box[2];
+      y1 = k ? std::max(y1, box[1] + box[3]) : box[1] + box[3];
+      if (k) hit.text.push_back(' ');
+      hit.text.append(page_.wordContent(w));
+    }
+    hit.line = (uint32_t)(std::upper_bound(page_.wordBegin.begin(), page_.wordBegin.end(), p.word) -
+                          page_.wordBegin.begin() - 1);
+    hit.x = x0;
+    hit.y = y0;
+    hit.width = x1 - x0;
+    hit.height = y1 - y0;
+    hits.push_back(std::move(hit));
+  }
+
+  MappedFile file_;
+  std::vector<Segment> segments_;
+  size_t pageCount_ = 0;
+  // Last page parsed by confirm
+  size_t parsedSegment_ = SIZE_MAX;
+  uint32_t parsedPage_ = 0;
+  std::string_view parsedSource_;
+  OcrPage page_;
+  std::string token_;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+// Atlas batching for small images (UI snippets, speech bubbles, form
+// fields), where the fixed cost of a RunOcrPipeline call outweighs the
+// inference. Several images are packed onto shelves of one white BGRA atlas
+// with a gap between them, recognized in one call, and every line and word
+// is handed back to the image whose cell contains it, in that image's
+// coordinates. A line the engine read across two neighbouring cells is cut
+// into one line per cell along its words.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "ingest.h"
+#include "ocr_types.h"
+
+struct AtlasOptions {
+  // Images per atlas; 0 turns batching off
+  size_t maxImages = 0;
+  // Images with both sides up to this go into atlases
+  int maxItemSide = 512;
+  // Longest atlas side
+  int maxSide = 2048;
+  // White gap around and between the images; keeps lines of neighbours apart
+  int padding = 24;
+
+  bool enabled() const { return maxImages > 1; }
+  bool fits(int width, int height) const {
+    int limit = std::min(maxItemSide, maxSide - 2 * padding);
+    return width > 0 && height > 0 && width <= limit && height <= limit;
+  }
+};
+
+// Where an image went; placed is false when the atlas was full
+struct AtlasCell {
+  int x = 0, y = 0, width = 0, height = 0;
+  bool placed = false;
+};
+
+struct AtlasLayout {
+  int width = 0, height = 0;
+  int padding = 0;
+  std::vector<AtlasCell> cells; // in input order
+};
+
+// Shelf packer: tallest images first, left to right on shelves as high as
+// their first image, a new shelf when a row is full. Images that don't fit
+// below the last shelf are left unplaced for the next atlas.
+inline AtlasLayout packAtlas(const std::vector<std::pair<int, int>> &sizes, const AtlasOptions &options) {
+  AtlasLayout layout;
+  layout.padding = options.padding;
+  layout.cells.resize(sizes.size());
+  std::vector<size_t> order(sizes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a].second > sizes[b].second; });
+
+  const int pad = options.padding;
+  int x = pad, y = pad, shelfHeight = 0;
+  for (size_t i : order) {
+    auto [w, h] = sizes[i];
+    if (x > pad && x + w + pad > options.maxSide) {
+      y += shelfHeight + pad;
+      x = pad;
+      shelfHeight = 0;
+    }
+    if (x + w + pad > options.maxSide || y + h + pad > options.maxSide) continue;
+    layout.cells[i] = {x, y, w, h, true};
+    layout.width = std::max(layout.width, x + w + pad);
+    layout.height = std::max(layout.height, y + h + pad);
+    shelfHeight = std::max(shelfHeight, h);
+    x += w + pad;
+  }
+  return layout;
+}
+
+// Copies BGRA images into their cells of a white atlas in a pooled frame
+inline Img composeAtlas(const AtlasLayout &layout, const std::vector<Img> &images, FramePool &pool,
+                        FramePool::Lease &frame) {
+  size_t stride = ((size_t)layout.width * 4 + kFrameAlignment - 1) / kFrameAlignment * kFrameAlignment;
+  frame = pool.acquire(stride * (size_t)layout.height);
+  uint8_t *data = frame.data();
+  std::memset(data, 0xff, stride * (size_t)layout.height);
+  for (size_t i = 0; i < images.size(); i++) {
+    const AtlasCell &cell = layout.cells[i];
+    if (!cell.placed) continue;
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(images[i].data_ptr);
+    for (int row = 0; row < cell.height; row++) {
+      std::memcpy(data + (size_t)(cell.y + row) * stride + (size_t)cell.x * 4, src + (size_t)row * images[i].step,
+                  (size_t)cell.width * 4);
+    }
+  }
+  return {.t = 3,
+          .col = layout.width,
+          .row = layout.height,
+          ._unk = 0,
+          .step = (int64_t)stride,
+          .data_ptr = (int64_t)data};
+}
+
+namespace atlas_detail {
+
+// Cell whose padded rect holds the box (x y width height), or -1
+inline int cellHolding(const AtlasLayout &layout, float x, float y, float w, float h, float slack) {
+  for (size_t c = 0; c < layout.cells.size(); c++) {
+    const AtlasCell &cell = layout.cells[c];
+    if (!cell.placed) continue;
+    if (x >= cell.x - slack && y >= cell.y - slack && x + w <= cell.x + cell.width + slack &&
+        y + h <= cell.y + cell.height + slack) {
+      return (int)c;
+    }
+  }
+  return -1;
+}
+
+// Cell sharing the most area with the box, or -1
+inline int cellOverlapping(const AtlasLayout &layout, float x, float y, float w, float h) {
+  int best = -1;
+  float bestArea = 0;
+  for (size_t c = 0; c < layout.cells.size(); c++) {
+    const AtlasCell &cell = layout.cells[c];
+    if (!cell.placed) continue;
+    float iw = std::min(x + w, (float)(cell.x + cell.width)) - std::max(x, (float)cell.x);
+    float ih = std::min(y + h, (float)(cell.y + cell.height)) - std::max(y, (float)cell.y);
+    if (iw > 0 && ih > 0 && iw * ih > bestArea) {
+      bestArea = iw * ih;
+      best = (int)c;
+    }
+  }
+  return best;
+}
+
+// Word boxes of a page are x y width height (see extractLine)
+inline void wordBounds(const float *box, float &x0, float &x1, float &y0, float &y1) {
+  x0 = box[0];
+  x1 = box[0] + std::max(box[2], 0.0f);
+  y0 = box[1];
+  y1 = box[1] + std::max(box[3], 0.0f);
+}
+
+inline void addTranslatedWord(OcrPage &to, std::string_view text, const float *box, float dx, float dy) {
+  if (box[0] == 0.0f && box[1] == 0.0f && box[2] == 0.0f && box[3] == 0.0f) {
+    to.addWord(text, box); // no box from the engine
+    return;
+  }
+  const float moved[4] = {box[0] - dx, box[1] - dy, box[2], box[3]};
+  to.addWord(text, moved);
+}
+
+// Copies line `line` of from into to, moved by -dx, -dy
+inline void addTranslatedLine(OcrPage &to, const OcrPage &from, size_t line, float dx, float dy, bool words) {
+  const float box[4] = {from.x[line] - dx, from.y[line] - dy, from.width[line], from.height[line]};
+  float corners[6];
+  const float *src = from.lineCorners(line);
+  for (int p = 0; p < 3; p++) {
+    bool present = src[2 * p] != 0.0f || src[2 * p + 1] != 0.0f;
+    corners[2 * p] = present ? src[2 * p] - dx : 0.0f;
+    corners[2 * p + 1] = present ? src[2 * p + 1] - dy : 0.0f;
+  }
+  to.addLine(from.lineContent(line), box, from.centerX[line] - dx, from.centerY[line] - dy, from.cornerCount[line],
+             corners);
+  if (!words) return;
+  for (uint32_t w = from.wordBegin[line]; w < from.wordBegin[line + 1]; w++) {
+    addTranslatedWord(to, from.wordContent(w), from.wordBoxOf(w), dx, dy);
+  }
+}
+
+// Adds a line with a rectangular box (atlas coordinates), clipped to the
+// cell and its slack, in cell coordinates
+inline void addPiece(OcrPage &to, std::string_view text, const AtlasCell &cell, float slack, float x0, float y0,
+                     float x1, float y1) {
+  x0 = std::max(x0, cell.x - slack) - cell.x;
+  y0 = std::max(y0, cell.y - slack) - cell.y;
+  x1 = std::min(x1, cell.x + cell.width + slack) - cell.x;
+  y1 = std::min(y1, cell.y + cell.height + slack) - cell.y;
+  const float box[4] = {x0, y0, std::max(x1 - x0, 0.0f), std::max(y1 - y0, 0.0f)};
+  const float corners[6] = {x0, y0, x0 + box[2], y0, x0 + box[2], y0 + box[3]};
+  to.addLine(text, box, x0 + box[2] / 2, y0 + box[3] / 2, 3, corners);
+}
+
+} // namespace atlas_detail
+
+// Hands the lines and words of an atlas result to pages[i] for every placed
+// cell i. A line inside one cell moves as a whole; a line crossing cells is
+// cut along its words, each piece spanning its words at the line's height;
+// a line without usable words goes to the cell it overlaps most. Pieces are
+// clipped to their cell. Words are only copied when words is set.
+inline void splitAtlasPage(const OcrPage &atlas, const AtlasLayout &layout, std::vector<OcrPage> &pages, bool words) {
+  using namespace atlas_detail;
+  pages.resize(layout.cells.size());
+  for (size_t c = 0; c < layout.cells.size(); c++) {
+    pages[c].clear();
+    pages[c].imageHeight = layout.cells[c].height;
+  }
+  // Boxes may reach a little into the gap around their cell
+  const float slack = layout.padding / 2.0f;
+  std::vector<int> wordCell;
+  std::string pieceText;
+  for (size_t line = 0; line < atlas.lineCount(); line++) {
+    float lx = atlas.x[line], ly = atlas.y[line], lw = atlas.width[line], lh = atlas.height[line];
+    int cell = cellHolding(layout, lx, ly, lw, lh, slack);
+    if (cell >= 0) {
+      const AtlasCell &c = layout.cells[cell];
+      addTranslatedLine(pages[cell], atlas, line, (float)c.x, (float)c.y, words);
+      continue;
+    }
+
+    // Which cell each word belongs to, by the center of its box
+    uint32_t first = atlas.wordBegin[line], last = atlas.wordBegin[line + 1];
+    wordCell.assign(last - first, -1);
+    bool anyWord = false;
+    for (uint32_t w = first; w < last; w++) {
+      float x0, x1, y0, y1;
+      wordBounds(atlas.wordBoxOf(w), x0, x1, y0, y1);
+      if (x1 <= x0) continue;
+      wordCell[w - first] = cellHolding(layout, (x0 + x1) / 2, ly + lh / 2, 0, 0, slack);
+      anyWord |= wordCell[w - first] >= 0;
+    }
+    if (!anyWord) {
+      cell = cellOverlapping(layout, lx, ly, lw, lh);
+      if (cell < 0) continue;
+      const AtlasCell &c = layout.cells[cell];
+      addPiece(pages[cell], atlas.lineContent(line), c, slack, lx, ly, lx + lw, ly + lh);
+      if (!words) continue;
+      for (uint32_t w = first; w < last; w++) {
+        addTranslatedWord(pages[cell], atlas.wordContent(w), atlas.wordBoxOf(w), (float)c.x, (float)c.y);
+      }
+      continue;
+    }
+
+    // One line per cell, in the order the cells first appear along the line
+    for (uint32_t w = first; w < last; w++) {
+      int target = wordCell[w - first];
+      if (target < 0 || (w > first && std::find(wordCell.begin(), wordCell.begin() + (w - first), target) !=
+                                          wordCell.begin() + (w - first))) {
+        continue;
+      }
+      const AtlasCell &c = layout.cells[target];
+      float dx = (float)c.x, dy = (float)c.y;
+      float x0 = 1e30f, x1 = -1e30f;
+      pieceText.clear();
+      for (uint32_t v = w; v < last; v++) {
+        if (wordCell[v - first] != target) continue;
+        float wx0, wx1, wy0, wy1;
+        wordBounds(atlas.wordBoxOf(v), wx0, wx1, wy0, wy1);
+        x0 = std::min(x0, wx0);
+        x1 = std::max(x1, wx1);
+        if (!pieceText.empty()) pieceText += ' ';
+        pieceText += atlas.wordContent(v);
+      }
+      OcrPage &page = pages[target];
+      addPiece(page, pieceText, c, slack, std::max(x0, lx), ly, std::min(x1, lx + lw), ly + lh);
+      if (!words) continue;
+      for (uint32_t v = w; v < last; v++) {
+        if (wordCell[v - first] == target) addTranslatedWord(page, atlas.wordContent(v), atlas.wordBoxOf(v), dx, dy);
+      }
+    }
+  }
+}
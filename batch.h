@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+struct BatchOptions {
+  // Threads reading and converting images ahead of the OCR workers
+  int decodeThreads = 2;
+  // Decoded images allowed to wait for an OCR worker (memory bound)
+  size_t maxDecoded = 4;
+};
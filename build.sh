@@ -0,0 +1,7 @@
+#!/bin/sh
+# Linux build (oneocr.dll is Windows only, so this always uses the fake backend)
+
+g++ -std=c++20 -O2 ocr.cpp -o ocr $(pkg-config --cflags --libs opencv4) -lrt
+g++ -std=c++20 -O2 -Wall -pthread ocr_server_stub.cpp -o ocr_server_stub -lrt
+g++ -std=c++20 -O2 -Wall -pthread ocr_bench.cpp -o ocr_bench
+g++ -std=c++20 -O2 -Wall -pthread ocr_selftest.cpp -o ocr_selftest
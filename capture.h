@@ -0,0 +1,332 @@
+#pragma once
+
+// Record/replay of raw backend results. Recording wraps a pipeline and
+// writes everything its accessors return for each image (line text, the
+// 8-float line polygon, word text and 4-float word boxes, and which of them
+// were missing) to a capture file. Replaying serves those results through the
+// same interface without oneocr.dll, so extraction, grouping and the
+// writers run on real pages at full speed on any machine, and outputs can
+// be compared byte for byte against the recording run.
+//
+// Results are keyed by the pixels sent to the engine (see hashPixels), so a
+// replay needs the same decoding, scaling, tile and atlas options as the
+// recording. File:
+//   "OCRR" u32 version
+//   per result: u64 pixelHash, i32 width, i32 height, u32 recordLen, then
+//     u32 lineCount, per line: u8 flags, [sized text], [f32 polygon[8]],
+//     u32 wordCount, per word: u8 flags, [sized text], [f32 box[4]]
+// Flags say whether the engine handed out the line or word at all and which
+// of its text and box it returned. Word boxes are the engine's width,
+// height, x, y. A torn last result (killed mid-write) is ignored on load;
+// version 1 files (8 floats per word box) are refused.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ocr_backend.h"
+#include "ocr_types.h"
+#include "result_cache.h"
+#include "serializer.h"
+#include "trace.h"
+
+constexpr uint32_t kCaptureVersion = 2;
+
+namespace capture_detail {
+
+enum : uint8_t { kPresent = 1, kHasText = 2, kHasBox = 4 };
+
+// Floats per box: the line polygon and the word's width, height, x, y
+constexpr int kLineBoxFloats = 8, kWordBoxFloats = 4;
+
+inline void appendItem(OutputBuffer &out, bool present, const char *text, const float *box, int boxFloats) {
+  out.appendRaw((uint8_t)((present ? kPresent : 0) | (text ? kHasText : 0) | (box ? kHasBox : 0)));
+  if (text) out.appendSized(text);
+  if (box) {
+    for (int k = 0; k < boxFloats; k++) out.appendRaw(box[k]);
+  }
+}
+
+} // namespace capture_detail
+
+// Appends results to a capture file; shared by the recording pipelines
+class CaptureWriter {
+public:
+  ~CaptureWriter() { close(); }
+
+  bool open(const std::string &path) {
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) {
+      fprintf(stderr, "Failed to create capture %s\n", path.c_str());
+      return false;
+    }
+    fwrite("OCRR", 1, 4, file_);
+    fwrite(&kCaptureVersion, sizeof(kCaptureVersion), 1, file_);
+    return true;
+  }
+
+  // Writes one result; images already recorded are skipped
+  void append(const Img &img, uint64_t pixelHash, const OutputBuffer &record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_ || !seen_.insert(pixelHash).second) return;
+    OutputBuffer header;
+    header.appendRaw(pixelHash);
+    header.appendRaw(img.col);
+    header.appendRaw(img.row);
+    header.appendRaw((uint32_t)record.size());
+    fwrite(header.data(), 1, header.size(), file_);
+    fwrite(record.data(), 1, record.size(), file_);
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (file_) fclose(file_);
+    file_ = nullptr;
+  }
+
+  size_t results() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return seen_.size();
+  }
+
+private:
+  mutable std::mutex mutex_;
+  FILE *file_ = nullptr;
+  std::unordered_set<uint64_t> seen_;
+};
+
+// Passes everything through to inner and records each result it returns
+class RecordingBackend : public OcrBackend {
+public:
+  RecordingBackend(std::unique_ptr<OcrBackend> inner, CaptureWriter &writer)
+      : inner_(std::move(inner)), writer_(writer) {}
+
+  int64_t run(const Img &img) override {
+    int64_t instance = inner_->run(img);
+    if (!instance) return 0;
+    trace::Span span("record");
+    record_.clear();
+    int64_t lc = inner_->lineCount(instance);
+    record_.appendRaw((uint32_t)lc);
+    for (int64_t i = 0; i < lc; i++) {
+      int64_t line = inner_->line(instance, i);
+      if (!line) {
+        capture_detail::appendItem(record_, false, nullptr, nullptr, 0);
+        record_.appendRaw((uint32_t)0);
+        continue;
+      }
+      capture_detail::appendItem(record_, true, inner_->lineContent(line), inner_->lineBoundingBox(line),
+                                 capture_detail::kLineBoxFloats);
+      int64_t wc = inner_->wordCount(line);
+      record_.appendRaw((uint32_t)wc);
+      for (int64_t j = 0; j < wc; j++) {
+        int64_t word = inner_->word(line, j);
+        capture_detail::appendItem(record_, word != 0, word ? inner_->wordContent(word) : nullptr,
+                                   word ? inner_->wordBoundingBox(word) : nullptr, capture_detail::kWordBoxFloats);
+      }
+    }
+    writer_.append(img, hashPixels(img), record_);
+    return instance;
+  }
+  void releaseResult(int64_t instance) override { inner_->releaseResult(instance); }
+
+  int64_t lineCount(int64_t instance) override { return inner_->lineCount(instance); }
+  int64_t line(int64_t instance, int64_t index) override { return inner_->line(instance, index); }
+  const char *lineContent(int64_t line) override { return inner_->lineContent(line); }
+  const float *lineBoundingBox(int64_t line) override { return inner_->lineBoundingBox(line); }
+
+  int64_t wordCount(int64_t line) override { return inner_->wordCount(line); }
+  int64_t word(int64_t line, int64_t index) override { return inner_->word(line, index); }
+  const char *wordContent(int64_t word) override { return inner_->wordContent(word); }
+  const float *wordBoundingBox(int64_t word) override { return inner_->wordBoundingBox(word); }
+  bool concurrentReads() const override { return inner_->concurrentReads(); }
+
+private:
+  std::unique_ptr<OcrBackend> inner_;
+  CaptureWriter &writer_;
+  OutputBuffer record_;
+};
+
+// A loaded capture: all text in one arena (NUL-terminated, so the
+// accessors can return it as is) and all boxes in one array
+class Capture {
+public:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  struct Line {
+    uint32_t text = kNone, box = kNone; // arena offset, index of the first float
+    uint32_t firstWord = 0, wordCount = 0;
+    bool present = false;
+  };
+  struct Word {
+    uint32_t text = kNone, box = kNone;
+    bool present = false;
+  };
+  struct Result {
+    uint64_t pixelHash = 0;
+    int32_t width = 0, height = 0;
+    uint32_t firstLine = 0, lineCount = 0;
+  };
+
+  bool load(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+      fprintf(stderr, "Failed to open capture %s\n", path.c_str());
+      return false;
+    }
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.append(chunk, n);
+    fclose(f);
+
+    uint32_t version = 0;
+    if (data.size() >= 8) memcpy(&version, data.data() + 4, 4);
+    if (data.size() < 8 || data.compare(0, 4, "OCRR") != 0 || version != kCaptureVersion) {
+      fprintf(stderr, "Not a capture file: %s\n", path.c_str());
+      return false;
+    }
+    size_t pos = 8;
+    const size_t headerSize = 8 + 4 + 4 + 4;
+    while (data.size() - pos >= headerSize) {
+      Result result;
+      uint32_t len = 0;
+      RecordReader header(data.data() + pos, headerSize);
+      header.read(result.pixelHash);
+      header.read(result.width);
+      header.read(result.height);
+      header.read(len);
+      if (data.size() - pos - headerSize < len || !parse(data.data() + pos + headerSize, len, result)) break;
+      pos += headerSize + len;
+      byPixels_.emplace(result.pixelHash, results_.size());
+      results_.push_back(result);
+    }
+    return true;
+  }
+
+  const std::vector<Result> &results() const { return results_; }
+  const Result *find(uint64_t pixelHash) const {
+    auto it = byPixels_.find(pixelHash);
+    return it == byPixels_.end() ? nullptr : &results_[it->second];
+  }
+  const Line &line(uint32_t index) const { return lines_[index]; }
+  const Word &word(uint32_t index) const { return words_[index]; }
+  const char *text(uint32_t offset) const { return offset == kNone ? nullptr : arena_.data() + offset; }
+  const float *box(uint32_t index) const { return index == kNone ? nullptr : boxes_.data() + index; }
+
+  // Images a replay found no result for
+  size_t misses() const { return misses_; }
+  void countMiss() const { misses_++; }
+
+private:
+  // Item flags, text and a box of boxFloats; false if the record ends early
+  bool parseItem(RecordReader &in, bool &present, uint32_t &text, uint32_t &box, int boxFloats) {
+    uint8_t flags = 0;
+    if (!in.read(flags)) return false;
+    present = flags & capture_detail::kPresent;
+    if (flags & capture_detail::kHasText) {
+      std::string_view s;
+      if (!in.readSized(s)) return false;
+      text = (uint32_t)arena_.size();
+      arena_.append(s);
+      arena_.push_back('\0');
+    }
+    if (flags & capture_detail::kHasBox) {
+      float b[capture_detail::kLineBoxFloats];
+      if (!in.readArray(b, boxFloats)) return false;
+      box = (uint32_t)boxes_.size();
+      boxes_.insert(boxes_.end(), b, b + boxFloats);
+    }
+    return true;
+  }
+
+  bool parse(const char *data, size_t size, Result &result) {
+    RecordReader in(data, size);
+    uint32_t lineCount = 0;
+    if (!in.read(lineCount) || lineCount > size) return false;
+    result.firstLine = (uint32_t)lines_.size();
+    result.lineCount = lineCount;
+    for (uint32_t i = 0; i < lineCount; i++) {
+      Line line;
+      if (!parseItem(in, line.present, line.text, line.box, capture_detail::kLineBoxFloats) ||
+          !in.read(line.wordCount) || line.wordCount > size) {
+        return false;
+      }
+      line.firstWord = (uint32_t)words_.size();
+      for (uint32_t j = 0; j < line.wordCount; j++) {
+        Word word;
+        if (!parseItem(in, word.present, word.text, word.box, capture_detail::kWordBoxFloats)) return false;
+        words_.push_back(word);
+      }
+      lines_.push_back(line);
+    }
+    return true;
+  }
+
+  std::string arena_;
+  std::vector<float> boxes_;
+  std::vector<Line> lines_;
+  std::vector<Word> words_;
+  std::vector<Result> results_;
+  std::unordered_map<uint64_t, size_t> byPixels_;
+  mutable std::atomic<size_t> misses_{0};
+};
+
+// Serves recorded results by the pixels of the image; images missing from
+// the capture fail like an engine error. Handles point into the capture.
+class ReplayBackend : public OcrBackend {
+public:
+  explicit ReplayBackend(const Capture &capture) : capture_(capture) {}
+
+  int64_t run(const Img &img) override {
+    const Capture::Result *result = capture_.find(hashPixels(img));
+    if (!result || result->width != img.col || result->height != img.row) {
+      capture_.countMiss();
+      return 0;
+    }
+    return reinterpret_cast<int64_t>(result);
+  }
+  void releaseResult(int64_t) override {}
+
+  int64_t lineCount(int64_t instance) override {
+    return reinterpret_cast<const Capture::Result *>(instance)->lineCount;
+  }
+  int64_t line(int64_t instance, int64_t index) override {
+    const Capture::Result *result = reinterpret_cast<const Capture::Result *>(instance);
+    if (index < 0 || index >= (int64_t)result->lineCount) return 0;
+    const Capture::Line &line = capture_.line(result->firstLine + (uint32_t)index);
+    return line.present ? reinterpret_cast<int64_t>(&line) : 0;
+  }
+  const char *lineContent(int64_t line) override {
+    return capture_.text(reinterpret_cast<const Capture::Line *>(line)->text);
+  }
+  const float *lineBoundingBox(int64_t line) override {
+    return capture_.box(reinterpret_cast<const Capture::Line *>(line)->box);
+  }
+
+  int64_t wordCount(int64_t line) override { return reinterpret_cast<const Capture::Line *>(line)->wordCount; }
+  int64_t word(int64_t line, int64_t index) override {
+    const Capture::Line *ln = reinterpret_cast<const Capture::Line *>(line);
+    if (index < 0 || index >= (int64_t)ln->wordCount) return 0;
+    const Capture::Word &word = capture_.word(ln->firstWord + (uint32_t)index);
+    return word.present ? reinterpret_cast<int64_t>(&word) : 0;
+  }
+  const char *wordContent(int64_t word) override {
+    return word ? capture_.text(reinterpret_cast<const Capture::Word *>(word)->text) : nullptr;
+  }
+  const float *wordBoundingBox(int64_t word) override {
+    return word ? capture_.box(reinterpret_cast<const Capture::Word *>(word)->box) : nullptr;
+  }
+  bool concurrentReads() const override { return true; }
+
+private:
+  const Capture &capture_;
+};
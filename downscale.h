@@ -0,0 +1,121 @@
+#pragma once
+
+// Optional downscaling of oversized inputs before OCR. The scale comes from
+// a longest-side limit and/or a target text height: the median line height
+// of the pages already recognized predicts the next one (scans from one
+// source share their DPI), so no extra inference pass is needed. The image
+// is decoded at 1/2, 1/4 or 1/8 size where the codec can do it cheaply, then
+// resampled to the exact size; afterwards every box is scaled back so the
+// outputs use original-image coordinates.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ocr_types.h"
+
+struct ScaleOptions {
+  // Longest side after scaling; 0 = no limit
+  int maxSide = 0;
+  // Median line height to aim for, in pixels; 0 = off
+  float targetTextHeight = 0;
+
+  bool enabled() const { return maxSide > 0 || targetTextHeight > 0; }
+};
+
+// Width and height from a PNG, JPEG or BMP header, without decoding
+inline bool probeImageSize(const uint8_t *data, size_t size, int &width, int &height) {
+  auto be16 = [&](size_t i) { return (data[i] << 8) | data[i + 1]; };
+  auto be32 = [&](size_t i) { return (int)(((uint32_t)be16(i) << 16) | (uint32_t)be16(i + 2)); };
+  if (size >= 24 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G') {
+    width = be32(16);
+    height = be32(20);
+    return width > 0 && height > 0;
+  }
+  if (size >= 26 && data[0] == 'B' && data[1] == 'M') {
+    int32_t w, h;
+    std::copy(data + 18, data + 22, reinterpret_cast<uint8_t *>(&w));
+    std::copy(data + 22, data + 26, reinterpret_cast<uint8_t *>(&h));
+    width = w;
+    height = h < 0 ? -h : h;
+    return width > 0 && height > 0;
+  }
+  if (size >= 4 && data[0] == 0xFF && data[1] == 0xD8) {
+    // Walk the segments up to the first start-of-frame
+    size_t i = 2;
+    while (i + 9 < size) {
+      if (data[i] != 0xFF) return false;
+      uint8_t marker = data[i + 1];
+      if (marker == 0xFF) {
+        i++;
+        continue;
+      }
+      bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+      if (sof) {
+        height = be16(i + 5);
+        width = be16(i + 7);
+        return width > 0 && height > 0;
+      }
+      i += 2 + be16(i + 2);
+    }
+  }
+  return false;
+}
+
+// Median line height of recognized pages, in original pixels
+class TextHeightEstimate {
+public:
+  float get() const { return median_.load(std::memory_order_relaxed); }
+
+  // Pages with only a few lines say little about the text size
+  void observe(const OcrPage &page) {
+    if (page.lineCount() < 5) return;
+    std::vector<float> heights;
+    heights.reserve(page.lineCount());
+    for (float h : page.height) {
+      if (h > 0) heights.push_back(h);
+    }
+    if (heights.size() < 5) return;
+    std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+    median_.store(heights[heights.size() / 2], std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<float> median_{0};
+};
+
+// Scale factor (<= 1) for an image; below 10% reduction it isn't worth it
+inline double chooseScale(int width, int height, const ScaleOptions &options, float textHeight) {
+  double scale = 1;
+  if (options.maxSide > 0) scale = std::min(scale, (double)options.maxSide / std::max(width, height));
+  if (options.targetTextHeight > 0 && textHeight > 0) {
+    scale = std::min(scale, (double)options.targetTextHeight / textHeight);
+  }
+  scale = std::max(scale, 1.0 / 16);
+  return scale > 0.9 ? 1 : scale;
+}
+
+// Largest power-of-two decode reduction (1, 2, 4, 8) that stays at or above scale
+inline int decodeReduction(double scale) {
+  int reduction = 1;
+  while (reduction < 8 && 1.0 / (reduction * 2) >= scale) reduction *= 2;
+  return reduction;
+}
+
+// Maps boxes of a page recognized on a scaled image back to the original;
+// sx and sy are original size / scaled size
+inline void scalePage(OcrPage &page, float sx, float sy, int originalHeight) {
+  page.imageHeight = originalHeight;
+  for (auto *v : {&page.x, &page.width, &page.centerX}) {
+    for (float &f : *v) f *= sx;
+  }
+  for (auto *v : {&page.y, &page.height, &page.centerY}) {
+    for (float &f : *v) f *= sy;
+  }
+  // Corners and word boxes alternate x and y
+  for (size_t k = 0; k < page.corners.size(); k++) page.corners[k] *= k % 2 ? sy : sx;
+  for (size_t k = 0; k < page.wordBox.size(); k++) page.wordBox[k] *= k % 2 ? sy : sx;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ocr_backend.h"
+
+// Deterministic stand-in for oneocr.dll. Lays out blocks of synthetic lines
+// and words sized to the image, seeded by its dimensions and a sample of its
+// pixels, so extraction, grouping and the writers run without the engine.
+// latency makes run() sleep to stand in for inference time in load tests.
+class FakeOcrBackend : public OcrBackend {
+public:
+  explicit FakeOcrBackend(int64_t maxLines = 1000, std::chrono::microseconds latency = {})
+      : maxLines_(maxLines), latency_(latency) {}
+
+  int64_t run(const Img &img) override {
+    if (img.col <= 0 || img.row <= 0) return 0;
+    if (latency_.count() > 0) std::this_thread::sleep_for(latency_);
+    Result *result = new Result;
+    layout(img, *result);
+    return reinterpret_cast<int64_t>(result);
+  }
+  void releaseResult(int64_t instance) override {
+    delete reinterpret_cast<Result *>(instance);
+  }
+
+  int64_t lineCount(int64_t instance) override {
+    return (int64_t)reinterpret_cast<Result *>(instance)->lines.size();
+  }
+  int64_t line(int64_t instance, int64_t index) override {
+    Result *result = reinterpret_cast<Result *>(instance);
+    if (index < 0 || index >= (int64_t)result->lines.size()) return 0;
+    return reinterpret_cast<int64_t>(&result->lines[index]);
+  }
+  const char *lineContent(int64_t line) override {
+    return reinterpret_cast<Line *>(line)->text.c_str();
+  }
+  const float *lineBoundingBox(int64_t line) override {
+    return reinterpret_cast<Line *>(line)->box;
+  }
+
+  int64_t wordCount(int64_t line) override {
+    return (int64_t)reinterpret_cast<Line *>(line)->words.size();
+  }
+  int64_t word(int64_t line, int64_t index) override {
+    Line *ln = reinterpret_cast<Line *>(line);
+    if (index < 0 || index >= (int64_t)ln->words.size()) return 0;
+    return reinterpret_cast<int64_t>(&ln->words[index]);
+  }
+  const char *wordContent(int64_t word) override {
+    return word ? reinterpret_cast<Word *>(word)->text.c_str() : nullptr;
+  }
+  const float *wordBoundingBox(int64_t word) override {
+    return word ? reinterpret_cast<Word *>(word)->box : nullptr;
+  }
+  bool concurrentReads() const override { return true; }
+
+private:
+  struct Word {
+    std::string text;
+    float box[4]; // width, height, x, y like the engine
+  };
+  struct Line {
+    std::string text;
+    float box[8];
+    std::vector<Word> words;
+  };
+  struct Result {
+    std::vector<Line> lines;
+  };
+
+  static uint64_t next(uint64_t &state) {
+    // splitmix64
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  static void setBox(float *box, float x, float y, float w, float h) {
+    float corners[8] = {x, y, x + w, y, x + w, y + h, x, y + h};
+    std::copy(corners, corners + 8, box);
+  }
+  static void setWordBox(float *box, float x, float y, float w, float h) {
+    const float wbox[4] = {w, h, x, y};
+    std::copy(wbox, wbox + 4, box);
+  }
+
+  static uint64_t seedOf(const Img &img) {
+    uint64_t seed = ((uint64_t)img.col << 32) ^ (uint64_t)img.row;
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(img.data_ptr);
+    if (data && img.step > 0) {
+      // A few pixels along the diagonal are enough to tell images apart
+      for (int i = 0; i < 16; i++) {
+        int64_t r = (int64_t)img.row * i / 16, c = (int64_t)img.col * i / 16;
+        seed = seed * 1099511628211ull ^ data[r * img.step + c * 4];
+      }
+    }
+    return seed;
+  }
+
+  void layout(const Img &img, Result &result) const {
+    static const char *vocab[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+                                  "OCR", "page", "line", "word", "text", "&", "<tag>", "\"quoted\"",
+                                  "manga", "bubble", "scan", "2024", "it's", "a", "of", "and"};
+    const int vocabSize = (int)(sizeof(vocab) / sizeof(vocab[0]));
+
+    uint64_t state = seedOf(img);
+    float width = (float)img.col, height = (float)img.row;
+    float lineHeight = std::clamp(height / 80.0f, 10.0f, 48.0f);
+    float charWidth = lineHeight * 0.5f;
+    float margin = std::max(width, height) * 0.03f;
+    int columns = std::max(1, (int)(width / 900.0f));
+    float columnWidth = (width - margin * (columns + 1)) / columns;
+    if (columnWidth < charWidth * 4) return;
+
+    for (int column = 0; column < columns; column++) {
+      float left = margin + column * (columnWidth + margin);
+      float y = margin;
+      while ((int64_t)result.lines.size() < maxLines_) {
+        int blockLines = 2 + (int)(next(state) % 5);
+        if (y + blockLines * lineHeight * 1.5f > height - margin) break;
+        for (int l = 0; l < blockLines && (int64_t)result.lines.size() < maxLines_; l++) {
+          Line &line = result.lines.emplace_back();
+          float x = left;
+          int words = 2 + (int)(next(state) % 8);
+          for (int w = 0; w < words; w++) {
+            const char *text = vocab[next(state) % vocabSize];
+            float wordWidth = charWidth * (float)std::char_traits<char>::length(text);
+            if (x + wordWidth > left + columnWidth) break;
+            Word &word = line.words.emplace_back();
+            word.text = text;
+            setWordBox(word.box, x, y, wordWidth, lineHeight);
+            if (!line.text.empty()) line.text += ' ';
+            line.text += text;
+            x += wordWidth + charWidth;
+          }
+          setBox(line.box, left, y, std::max(x - charWidth - left, 0.0f), lineHeight);
+          y += lineHeight * 1.5f;
+        }
+        // Gap between blocks, every third one wider than the grouping distance
+        if (next(state) % 3 == 0) {
+          y += std::max(height * 0.12f, 120.0f);
+        } else {
+          y += lineHeight * (2.0f + (float)(next(state) % 4));
+        }
+      }
+    }
+  }
+
+  int64_t maxLines_;
+  std::chrono::microseconds latency_;
+};
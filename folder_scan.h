@@ -0,0 +1,252 @@
+#pragma once
+
+// Folder enumeration and the manifest behind --incremental.
+//
+// The manifest (.ocrmanifest in the input folder) has one line per image
+// whose outputs were written:
+//   size \t mtime \t state \t relative path
+// state is the output options the files were written with. Completed images
+// are appended to .ocrmanifest.journal as they finish; at the end of a run
+// the journal is folded into a new snapshot that replaces the old one by
+// rename. An interrupted run leaves the journal behind and the next run
+// replays it, so finished work is never redone.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct ScanOptions {
+  bool recursive = false;
+  // Lowercase, with the dot
+  std::vector<std::string> extensions = {".png", ".jpg"};
+};
+
+// Parses "png,jpg,.webp" into ScanOptions::extensions
+inline bool parseExtensions(const std::string &list, std::vector<std::string> &extensions) {
+  extensions.clear();
+  std::stringstream in(list);
+  std::string ext;
+  while (std::getline(in, ext, ',')) {
+    if (ext.empty()) continue;
+    if (ext[0] != '.') ext.insert(ext.begin(), '.');
+    for (char &c : ext) c = (char)std::tolower((unsigned char)c);
+    extensions.push_back(ext);
+  }
+  return !extensions.empty();
+}
+
+struct ScannedFile {
+  std::string path;
+  std::string relative;
+  uint64_t size = 0;
+  int64_t mtime = 0;
+};
+
+struct ScanResult {
+  std::vector<ScannedFile> images;
+  // .txt files seen on the way, to check outputs without another stat each
+  std::unordered_set<std::string> outputs;
+};
+
+// One pass over the tree; size and mtime come from the directory entries,
+// which Windows fills from the directory listing itself. Sorted by path.
+// onFirstImage runs once, as soon as the first image is found.
+inline ScanResult scanImages(const std::string &root, const ScanOptions &options,
+                             const std::function<void()> &onFirstImage = {}) {
+  namespace fs = std::filesystem;
+  ScanResult result;
+  const size_t rootLength = fs::path(root).string().size();
+  std::string ext;
+  auto visit = [&](const fs::directory_entry &entry) {
+    std::error_code ec;
+    if (!entry.is_regular_file(ec)) return;
+    const fs::path &path = entry.path();
+    ext = path.extension().string();
+    for (char &c : ext) c = (char)std::tolower((unsigned char)c);
+    if (ext == ".txt") {
+      result.outputs.insert(path.string());
+      return;
+    }
+    if (std::find(options.extensions.begin(), options.extensions.end(), ext) == options.extensions.end()) return;
+    ScannedFile file;
+    file.path = path.string();
+    size_t skip = std::min(rootLength, file.path.size());
+    while (skip < file.path.size() && (file.path[skip] == '/' || file.path[skip] == '\\')) skip++;
+    file.relative = file.path.substr(skip);
+    file.size = entry.file_size(ec);
+    file.mtime = (int64_t)entry.last_write_time(ec).time_since_epoch().count();
+    result.images.push_back(std::move(file));
+    if (result.images.size() == 1 && onFirstImage) onFirstImage();
+  };
+
+  std::error_code ec;
+  if (options.recursive) {
+    for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+         !ec && it != end; it.increment(ec)) {
+      visit(*it);
+    }
+  } else {
+    for (fs::directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+      visit(*it);
+    }
+  }
+  if (ec) {
+    fprintf(stderr, "Error while scanning %s: %s\n", root.c_str(), ec.message().c_str());
+  }
+  std::sort(result.images.begin(), result.images.end(),
+            [](const ScannedFile &a, const ScannedFile &b) { return a.path < b.path; });
+  return result;
+}
+
+// Output file written for an image
+inline std::string outputFileFor(const std::string &image) {
+  return std::filesystem::path(image).replace_extension(".txt").string();
+}
+
+class Manifest {
+public:
+  ~Manifest() {
+    if (journal_) fclose(journal_);
+  }
+
+  // Loads the snapshot and any journal left by an interrupted run. state
+  // identifies the current output options.
+  bool open(const std::string &root, uint32_t state) {
+    namespace fs = std::filesystem;
+    state_ = state;
+    snapshotPath_ = (fs::path(root) / ".ocrmanifest").string();
+    journalPath_ = snapshotPath_ + ".journal";
+    load(snapshotPath_);
+    bool torn = !load(journalPath_);
+    journal_ = fopen(journalPath_.c_str(), "ab");
+    if (!journal_) {
+      fprintf(stderr, "Failed to open manifest journal %s\n", journalPath_.c_str());
+      return false;
+    }
+    // Terminate a line cut off by a crash so the next one parses
+    if (torn) fputc('\n', journal_);
+    return true;
+  }
+
+  // True if the image is unchanged since its outputs were written with the
+  // same options and the .txt is still there (unless checkTxt is false: the
+  // page went into an archive); such images are carried over
+  bool upToDate(const ScannedFile &file, const ScanResult &scan, bool checkTxt = true) {
+    auto it = previous_.find(file.relative);
+    if (it == previous_.end() || it->second.size != file.size || it->second.mtime != file.mtime ||
+        it->second.state != state_ || (checkTxt && !scan.outputs.count(outputFileFor(file.path)))) {
+      return false;
+    }
+    current_[file.relative] = it->second;
+    return true;
+  }
+
+  // Image that is about to be processed; markDone records it
+  void plan(const ScannedFile &file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[outputFileFor(file.path)].push_back(file);
+  }
+
+  // Called once all outputs for output_file were written
+  void markDone(const std::string &output_file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(output_file);
+    if (it == pending_.end()) return;
+    for (const ScannedFile &file : it->second) {
+      // Paths with line breaks can't be stored; they are just redone
+      if (file.relative.find_first_of("\r\n") != std::string::npos) continue;
+      Entry entry{file.size, file.mtime, state_};
+      current_[file.relative] = entry;
+      if (journal_) {
+        writeLine(journal_, file.relative, entry);
+        fflush(journal_);
+      }
+    }
+    pending_.erase(it);
+  }
+
+  // Writes the new snapshot (carried over + completed images) and drops the journal
+  bool commit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string tmp = snapshotPath_ + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+      fprintf(stderr, "Failed to write manifest %s\n", tmp.c_str());
+      return false;
+    }
+    std::vector<const std::pair<const std::string, Entry> *> sorted;
+    for (const auto &kv : current_) sorted.push_back(&kv);
+    std::sort(sorted.begin(), sorted.end(), [](auto *a, auto *b) { return a->first < b->first; });
+    for (auto *kv : sorted) writeLine(f, kv->first, kv->second);
+    bool ok = fflush(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmp, snapshotPath_, ec);
+    if (!ok || ec) {
+      fprintf(stderr, "Failed to replace manifest %s\n", snapshotPath_.c_str());
+      return false;
+    }
+    if (journal_) {
+      fclose(journal_);
+      journal_ = nullptr;
+    }
+    std::filesystem::remove(journalPath_, ec);
+    return true;
+  }
+
+private:
+  struct Entry {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint32_t state = 0;
+  };
+
+  static void writeLine(FILE *f, const std::string &relative, const Entry &e) {
+    fprintf(f, "%llu\t%lld\t%u\t%s\n", (unsigned long long)e.size, (long long)e.mtime, e.state, relative.c_str());
+  }
+
+  // Later lines win; a torn last line (no newline) is ignored and false returned
+  bool load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return true;
+    std::stringstream all;
+    all << in.rdbuf();
+    const std::string data = all.str();
+    size_t pos = 0;
+    while (pos < data.size()) {
+      size_t end = data.find('\n', pos);
+      if (end == std::string::npos) return false;
+      // Three numeric fields, then the path (which may contain tabs)
+      const char *p = data.c_str() + pos;
+      char *next = nullptr;
+      Entry e;
+      e.size = strtoull(p, &next, 10);
+      bool ok = *next == '\t';
+      if (ok) e.mtime = strtoll(next + 1, &next, 10), ok = *next == '\t';
+      if (ok) e.state = (uint32_t)strtoul(next + 1, &next, 10), ok = *next == '\t';
+      if (ok && next + 1 < data.c_str() + end) {
+        previous_[data.substr(next + 1 - data.c_str(), data.c_str() + end - (next + 1))] = e;
+      }
+      pos = end + 1;
+    }
+    return true;
+  }
+
+  uint32_t state_ = 0;
+  std::string snapshotPath_, journalPath_;
+  std::unordered_map<std::string, Entry> previous_, current_;
+  std::unordered_map<std::string, std::vector<ScannedFile>> pending_;
+  std::mutex mutex_;
+  FILE *journal_ = nullptr;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+// Incremental OCR for a sequence of screen captures. Each frame is compared
+// with the previous one in square blocks (SSE2 / NEON compare); only the
+// regions around changed blocks go through the engine, and lines from the
+// unchanged parts of the screen are carried over. Cost per frame follows
+// the amount of change instead of the screen size.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "ingest.h"
+#include "ocr_backend.h"
+#include "ocr_types.h"
+#include "tiling.h"
+#include "trace.h"
+
+struct FrameOptions {
+  // Block edge in pixels for the frame compare
+  int blockSize = 32;
+  // Above this share of changed area the whole frame is recognized
+  float fullFrameRatio = 0.6f;
+  // Line boxes are always kept, they drive the region growing
+  ExtractProfile profile = kExtractWords;
+};
+
+struct FrameStats {
+  size_t frames = 0;
+  size_t unchanged = 0;  // no engine call at all
+  size_t fullFrames = 0; // first frame, size change or too much change
+  size_t regions = 0;    // partial engine calls
+  double changedArea = 0; // sum over frames of the recognized area share
+};
+
+namespace frame_diff_detail {
+
+// True if any byte of the rows x bytes block differs
+inline bool blockDiffers(const uint8_t *a, size_t strideA, const uint8_t *b, size_t strideB, size_t bytes,
+                         int rows) {
+  for (int y = 0; y < rows; y++, a += strideA, b += strideB) {
+    size_t i = 0;
+#if INGEST_X86
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) {
+      __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+      __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+      acc = _mm_or_si128(acc, _mm_xor_si128(va, vb));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) return true;
+#elif INGEST_NEON
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (; i + 16 <= bytes; i += 16) acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    if (vmaxvq_u8(acc) != 0) return true;
+#endif
+    if (i < bytes && memcmp(a + i, b + i, bytes - i) != 0) return true;
+  }
+  return false;
+}
+
+inline bool intersects(const tiling_detail::Box &b, const TileRect &r) {
+  return b.x1 > r.x && b.x0 < r.x + r.width && b.y1 > r.y && b.y0 < r.y + r.height;
+}
+
+inline bool overlaps(const TileRect &a, const TileRect &b) {
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+inline TileRect unite(const TileRect &a, const TileRect &b) {
+  int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+  int x1 = std::max(a.x + a.width, b.x + b.width), y1 = std::max(a.y + a.height, b.y + b.height);
+  return {x0, y0, x1 - x0, y1 - y0};
+}
+
+} // namespace frame_diff_detail
+
+class FrameSequenceOcr {
+public:
+  explicit FrameSequenceOcr(OcrBackend &backend, FrameOptions options = {})
+      : backend_(backend), options_(options) {
+    options_.blockSize = std::max(options_.blockSize, 8);
+  }
+
+  // Recognizes a BGRA frame, reusing what it can from the previous one
+  bool recognize(const Img &img, OcrPage &page) {
+    stats_.frames++;
+    std::vector<TileRect> regions;
+    bool full = !comparable(img);
+    if (!full) {
+      trace::Span span("frame.diff");
+      regions = changedRegions(img);
+      int64_t area = 0;
+      for (const TileRect &r : regions) area += (int64_t)r.width * r.height;
+      full = area > options_.fullFrameRatio * img.col * img.row;
+      if (!full) stats_.changedArea += (double)area / ((double)img.col * img.row);
+    }
+
+    if (full) {
+      TileResult result;
+      result.rect = {0, 0, img.col, img.row};
+      if (!captureTile(backend_, img, result, "frame.full", words())) return false;
+      lines_ = std::move(result.lines);
+      stats_.fullFrames++;
+      stats_.changedArea += 1;
+    } else if (regions.empty()) {
+      stats_.unchanged++;
+    } else if (!update(img, regions)) {
+      return false;
+    }
+
+    // Outside the regions the stored frame already matches
+    if (full) {
+      remember(img, {{0, 0, img.col, img.row}});
+    } else {
+      remember(img, regions);
+    }
+    extractPage(reader_, reinterpret_cast<int64_t>(&lines_), page, std::max(options_.profile, kExtractLines));
+    page.imageHeight = img.row;
+    return true;
+  }
+
+  const FrameStats &stats() const { return stats_; }
+
+private:
+  bool words() const { return options_.profile >= kExtractWords; }
+
+  bool comparable(const Img &img) const {
+    return previous_ && img.col == width_ && img.row == height_;
+  }
+
+  // Changed blocks, grown by one block, merged, and widened until no
+  // previous line is cut by a region edge
+  std::vector<TileRect> changedRegions(const Img &img) {
+    using namespace frame_diff_detail;
+    const int bs = options_.blockSize;
+    const int blocksX = (img.col + bs - 1) / bs, blocksY = (img.row + bs - 1) / bs;
+    const uint8_t *cur = reinterpret_cast<const uint8_t *>(img.data_ptr);
+
+    std::vector<TileRect> regions;
+    for (int by = 0; by < blocksY; by++) {
+      int y = by * bs, rows = std::min(bs, img.row - y);
+      // Runs of changed blocks in this block row become one rectangle
+      int runStart = -1;
+      for (int bx = 0; bx <= blocksX; bx++) {
+        bool changed = false;
+        if (bx < blocksX) {
+          int x = bx * bs, cols = std::min(bs, img.col - x);
+          changed = blockDiffers(cur + (size_t)y * img.step + (size_t)x * 4, (size_t)img.step,
+                                 previous_->data + (size_t)y * stride_ + (size_t)x * 4, stride_, (size_t)cols * 4,
+                                 rows);
+        }
+        if (changed && runStart < 0) runStart = bx;
+        if (!changed && runStart >= 0) {
+          regions.push_back({runStart * bs, y, (bx - runStart) * bs, bs});
+          runStart = -1;
+        }
+      }
+    }
+    if (regions.empty()) return regions;
+
+    for (TileRect &r : regions) r = clampRect({r.x - bs, r.y - bs, r.width + 2 * bs, r.height + 2 * bs}, img);
+
+    std::vector<tiling_detail::Box> boxes;
+    for (const TileLine &line : lines_) {
+      if (line.hasBox) boxes.push_back(tiling_detail::boundsOf(line.box));
+    }
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (TileRect &r : regions) {
+        for (const auto &b : boxes) {
+          if (!intersects(b, r)) continue;
+          TileRect grown = clampRect(unite(r, {(int)std::floor(b.x0), (int)std::floor(b.y0),
+                                               (int)std::ceil(b.x1 - std::floor(b.x0)) + 1,
+                                               (int)std::ceil(b.y1 - std::floor(b.y0)) + 1}),
+                                     img);
+          if (grown.x != r.x || grown.y != r.y || grown.width != r.width || grown.height != r.height) {
+            r = grown;
+            changed = true;
+          }
+        }
+      }
+      for (size_t i = 0; i < regions.size(); i++) {
+        for (size_t j = i + 1; j < regions.size(); j++) {
+          if (!overlaps(regions[i], regions[j])) continue;
+          regions[i] = unite(regions[i], regions[j]);
+          regions.erase(regions.begin() + j);
+          j = i;
+          changed = true;
+        }
+      }
+    }
+    return regions;
+  }
+
+  static TileRect clampRect(TileRect r, const Img &img) {
+    int x0 = std::max(r.x, 0), y0 = std::max(r.y, 0);
+    int x1 = std::min(r.x + r.width, img.col), y1 = std::min(r.y + r.height, img.row);
+    return {x0, y0, x1 - x0, y1 - y0};
+  }
+
+  // Drops lines inside the regions and recognizes the regions. Lines keep
+  // the engine order of the frame they were read in: the lines of a region
+  // take the place of the first line they replace, and a region that
+  // replaces none goes before the first line starting below it, so a
+  // partial update orders lines the way a full frame would.
+  bool update(const Img &img, const std::vector<TileRect> &regions) {
+    using namespace frame_diff_detail;
+    std::vector<std::vector<TileLine>> fresh(regions.size());
+    for (size_t i = 0; i < regions.size(); i++) {
+      const TileRect &r = regions[i];
+      TileResult result;
+      result.rect = r;
+      if (!captureTile(backend_, img, result, "frame.region", words())) return false;
+      stats_.regions++;
+      for (TileLine &line : result.lines) {
+        if (line.hasBox) tiling_detail::translate(line.box, (float)r.x, (float)r.y);
+        for (TileWord &word : line.words) {
+          if (word.hasBox) tiling_detail::translateWord(word.box, (float)r.x, (float)r.y);
+        }
+      }
+      fresh[i] = std::move(result.lines);
+    }
+
+    // Region each previous line falls in (regions never cut a line), or -1
+    std::vector<int> regionOf(lines_.size(), -1);
+    std::vector<char> replaces(regions.size(), 0), placed(regions.size(), 0);
+    for (size_t l = 0; l < lines_.size(); l++) {
+      if (!lines_[l].hasBox) continue;
+      tiling_detail::Box b = tiling_detail::boundsOf(lines_[l].box);
+      for (size_t i = 0; i < regions.size() && regionOf[l] < 0; i++) {
+        if (intersects(b, regions[i])) regionOf[l] = (int)i;
+      }
+      if (regionOf[l] >= 0) replaces[regionOf[l]] = 1;
+    }
+    std::vector<TileLine> lines;
+    auto place = [&](size_t i) {
+      for (TileLine &line : fresh[i]) lines.push_back(std::move(line));
+      placed[i] = 1;
+    };
+    for (size_t l = 0; l < lines_.size(); l++) {
+      TileLine &line = lines_[l];
+      if (!line.hasBox) continue; // nowhere to put it; only kept while nothing changes
+      if (regionOf[l] >= 0) {
+        if (!placed[regionOf[l]]) place(regionOf[l]);
+        continue;
+      }
+      tiling_detail::Box b = tiling_detail::boundsOf(line.box);
+      for (size_t i = 0; i < regions.size(); i++) {
+        const TileRect &r = regions[i];
+        if (!placed[i] && !replaces[i] && (r.y < b.y0 || (r.y == b.y0 && r.x <= b.x0))) place(i);
+      }
+      lines.push_back(std::move(line));
+    }
+    for (size_t i = 0; i < regions.size(); i++) {
+      if (!placed[i]) place(i);
+    }
+    lines_ = std::move(lines);
+    return true;
+  }
+
+  // Copies rects of the frame into the one kept for the next compare
+  void remember(const Img &img, const std::vector<TileRect> &rects) {
+    if (rects.empty()) return;
+    trace::Span span("frame.copy");
+    if (!comparable(img)) {
+      stride_ = ((size_t)img.col * 4 + kFrameAlignment - 1) / kFrameAlignment * kFrameAlignment;
+      size_t bytes = stride_ * img.row;
+      if (!previous_ || previous_->capacity < bytes) previous_ = std::make_unique<FrameBuffer>(bytes);
+      width_ = img.col;
+      height_ = img.row;
+    }
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(img.data_ptr);
+    for (const TileRect &r : rects) {
+      for (int y = r.y; y < r.y + r.height; y++) {
+        memcpy(previous_->data + y * stride_ + (size_t)r.x * 4, src + (size_t)y * img.step + (size_t)r.x * 4,
+               (size_t)r.width * 4);
+      }
+    }
+  }
+
+  OcrBackend &backend_;
+  FrameOptions options_;
+  FrameStats stats_;
+  std::unique_ptr<FrameBuffer> previous_;
+  size_t stride_ = 0;
+  int width_ = 0, height_ = 0;
+  // Result of the previous frame, page coordinates
+  std::vector<TileLine> lines_;
+  TileLinesReader reader_;
+};
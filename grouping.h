@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <vector>
+
+#include "ocr_types.h"
+#include "trace.h"
+
+// Groups of lines as index spans into the input line array: group g covers
+// order[offsets[g] .. offsets[g + 1]), its lines sorted top to bottom.
+struct LineGroups {
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> offsets;
+
+  size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  std::span<const uint32_t> operator[](size_t g) const {
+    return {order.data() + offsets[g], offsets[g + 1] - offsets[g]};
+  }
+  void clear() {
+    order.clear();
+    offsets.clear();
+  }
+};
+
+// Function to calculate distance between two lines
+inline double calculateDistance(const OcrPage& page, size_t line1, size_t line2) {
+  return std::sqrt(std::pow(page.centerX[line1] - page.centerX[line2], 2) +
+                   std::pow(page.centerY[line1] - page.centerY[line2], 2));
+}
+
+// Clusters line centers with the speech bubble heuristic: a line joins a group
+// when it is within maxDistance of any member, and vertically offset
+// candidates get an extra half of the group's vertical span on top of that.
+//
+// The heuristic only ever adds lines and its limit only grows with the group,
+// so each group is the smallest closed set around its seed (the lowest unused
+// line index) and can be built in any order:
+//  1. lines within maxDistance of each other always share a group, so a
+//     union-find pass over a uniform grid yields atomic clusters;
+//  2. per seed, whole clusters are absorbed by querying the grid with the
+//     compensated radius, re-querying only when the group's span grew.
+// Assigned lines are removed from the grid as they are met, so dense pages
+// stay close to linear. Buffers are kept between calls.
+class LineClusterer {
+public:
+  void group(const float *cx, const float *cy, size_t n, double maxDistance, LineGroups &out) {
+    out.clear();
+    out.offsets.push_back(0);
+    if (n == 0) return;
+    cx_ = cx;
+    cy_ = cy;
+    base_ = (float)maxDistance;
+
+    buildGrid(n, maxDistance);
+    buildClusters(n);
+    growGroups(n, out);
+    sortGroups(out);
+  }
+
+private:
+  uint32_t find(uint32_t i) {
+    while (parent_[i] != i) {
+      parent_[i] = parent_[parent_[i]];
+      i = parent_[i];
+    }
+    return i;
+  }
+
+  void unite(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) return;
+    if (a > b) std::swap(a, b);
+    parent_[b] = a;
+  }
+
+  int cellX(float x) const { return std::clamp((int)std::floor((x - originX_) / cell_), 0, cols_ - 1); }
+  int cellY(float y) const { return std::clamp((int)std::floor((y - originY_) / cell_), 0, rows_ - 1); }
+
+  void buildGrid(size_t n, double maxDistance) {
+    float minX = cx_[0], maxX = cx_[0], minY = cy_[0], maxY = cy_[0];
+    for (size_t i = 1; i < n; i++) {
+      minX = std::min(minX, cx_[i]);
+      maxX = std::max(maxX, cx_[i]);
+      minY = std::min(minY, cy_[i]);
+      maxY = std::max(maxY, cy_[i]);
+    }
+    originX_ = minX;
+    originY_ = minY;
+    // Cells a bit wider than maxDistance, so atomic neighbours are in the
+    // 3x3 block even after rounding. Widen them when the layout is sparse to
+    // keep the grid O(n).
+    cell_ = std::max((float)maxDistance, 1.0f) * 1.001f;
+    const double maxCells = 4.0 * n + 64;
+    for (;;) {
+      cols_ = (int)((maxX - minX) / cell_) + 1;
+      rows_ = (int)((maxY - minY) / cell_) + 1;
+      if ((double)cols_ * rows_ <= maxCells) break;
+      cell_ *= 2;
+    }
+
+    size_t cells = (size_t)cols_ * rows_;
+    cellStart_.assign(cells + 1, 0);
+    cellOf_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      cellOf_[i] = (uint32_t)(cellY(cy_[i]) * cols_ + cellX(cx_[i]));
+      cellStart_[cellOf_[i] + 1]++;
+    }
+    for (size_t c = 0; c < cells; c++) cellStart_[c + 1] += cellStart_[c];
+    cellLen_.assign(cells, 0);
+    cellItems_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t c = cellOf_[i];
+      cellItems_[cellStart_[c] + cellLen_[c]++] = (uint32_t)i;
+    }
+  }
+
+  void buildClusters(size_t n) {
+    parent_.resize(n);
+    for (size_t i = 0; i < n; i++) parent_[i] = (uint32_t)i;
+
+    for (size_t i = 0; i < n; i++) {
+      int gx = (int)(cellOf_[i] % cols_), gy = (int)(cellOf_[i] / cols_);
+      for (int y = std::max(gy - 1, 0); y <= std::min(gy + 1, rows_ - 1); y++) {
+        for (int x = std::max(gx - 1, 0); x <= std::min(gx + 1, cols_ - 1); x++) {
+          size_t c = (size_t)y * cols_ + x;
+          for (uint32_t k = cellStart_[c]; k < cellStart_[c] + cellLen_[c]; k++) {
+            uint32_t j = cellItems_[k];
+            if (j <= i || find((uint32_t)i) == find(j)) continue;
+            if (distance((uint32_t)i, j) <= base_) unite((uint32_t)i, j);
+          }
+        }
+      }
+    }
+
+    // Members of each cluster, by root, in line index order
+    clusterStart_.assign(n + 1, 0);
+    root_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      root_[i] = find((uint32_t)i);
+      clusterStart_[root_[i] + 1]++;
+    }
+    for (size_t i = 0; i < n; i++) clusterStart_[i + 1] += clusterStart_[i];
+    fill_.assign(n, 0);
+    clusterItems_.resize(n);
+    clusterMinY_.assign(n, 0);
+    clusterMaxY_.assign(n, 0);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t r = root_[i];
+      if (fill_[r] == 0) {
+        clusterMinY_[r] = clusterMaxY_[r] = cy_[i];
+      } else {
+        clusterMinY_[r] = std::min(clusterMinY_[r], cy_[i]);
+        clusterMaxY_[r] = std::max(clusterMaxY_[r], cy_[i]);
+      }
+      clusterItems_[clusterStart_[r] + fill_[r]++] = (uint32_t)i;
+    }
+  }
+
+  float distance(uint32_t a, uint32_t b) const {
+    float dx = cx_[a] - cx_[b];
+    float dy = cy_[a] - cy_[b];
+    return std::sqrt(dx * dx + dy * dy);
+  }
+
+  void absorb(uint32_t root) {
+    assigned_[root] = 1;
+    for (uint32_t k = clusterStart_[root]; k < clusterStart_[root + 1]; k++) {
+      members_.push_back(clusterItems_[k]);
+    }
+    groupMinY_ = std::min(groupMinY_, clusterMinY_[root]);
+    groupMaxY_ = std::max(groupMaxY_, clusterMaxY_[root]);
+  }
+
+  // Absorbs every free cluster with a line within the compensated distance of
+  // member m. Entries of assigned lines are swapped out of their cells.
+  void queryMember(uint32_t m) {
+    float compensation = 0.5f * (groupMaxY_ - groupMinY_);
+    // Padded so rounding at cell borders can't hide a candidate
+    float radius = (base_ + compensation) * 1.001f + 1.0f;
+    int x0 = cellX(cx_[m] - radius), x1 = cellX(cx_[m] + radius);
+    int y0 = cellY(cy_[m] - radius), y1 = cellY(cy_[m] + radius);
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        size_t c = (size_t)y * cols_ + x;
+        uint32_t *items = &cellItems_[cellStart_[c]];
+        uint32_t k = 0;
+        while (k < cellLen_[c]) {
+          uint32_t j = items[k];
+          if (!assigned_[root_[j]]) {
+            float dy = cy_[j] - cy_[m];
+            // Same rule as the greedy scan: only offset candidates get the
+            // span compensation; the limit is re-read as the group grows.
+            float limit = base_;
+            if (std::fabs(dy) > 0) limit += 0.5f * (groupMaxY_ - groupMinY_);
+            if (distance(j, m) > limit) {
+              k++;
+              continue;
+            }
+            absorb(root_[j]);
+          }
+          items[k] = items[--cellLen_[c]];
+        }
+      }
+    }
+  }
+
+  void growGroups(size_t n, LineGroups &out) {
+    assigned_.assign(n, 0);
+    groupTop_.clear();
+    for (size_t seed = 0; seed < n; seed++) {
+      if (assigned_[root_[seed]]) continue;
+      members_.clear();
+      groupMinY_ = groupMaxY_ = cy_[seed];
+      absorb(root_[seed]);
+
+      // Without any vertical span only atomic neighbours qualify, and those
+      // are already in. Otherwise query until a full pass ran at the final
+      // span.
+      for (;;) {
+        float span = groupMaxY_ - groupMinY_;
+        if (span <= 0) break;
+        for (size_t m = 0; m < members_.size(); m++) queryMember(members_[m]);
+        if (groupMaxY_ - groupMinY_ == span) break;
+      }
+
+      // Sort lines in the group by vertical position (top to bottom)
+      std::sort(members_.begin(), members_.end(), [this](uint32_t a, uint32_t b) {
+        return cy_[a] < cy_[b] || (cy_[a] == cy_[b] && a < b);
+      });
+      out.order.insert(out.order.end(), members_.begin(), members_.end());
+      out.offsets.push_back((uint32_t)out.order.size());
+    }
+  }
+
+  // Sort groups by their topmost line's position (left to right, then top to bottom)
+  void sortGroups(LineGroups &out) {
+    size_t groups = out.size();
+    groupTop_.resize(groups);
+    for (size_t g = 0; g < groups; g++) groupTop_[g] = (uint32_t)g;
+    std::stable_sort(groupTop_.begin(), groupTop_.end(), [&](uint32_t a, uint32_t b) {
+      uint32_t la = out.order[out.offsets[a]], lb = out.order[out.offsets[b]];
+      if (std::abs(cy_[la] - cy_[lb]) < 50) { // Same row
+        return cx_[la] < cx_[lb]; // Left to right
+      }
+      return cy_[la] < cy_[lb]; // Top to bottom
+    });
+
+    sortedOrder_.clear();
+    sortedOffsets_.assign(1, 0);
+    for (uint32_t g : groupTop_) {
+      sortedOrder_.insert(sortedOrder_.end(), out.order.begin() + out.offsets[g],
+                          out.order.begin() + out.offsets[g + 1]);
+      sortedOffsets_.push_back((uint32_t)sortedOrder_.size());
+    }
+    out.order.swap(sortedOrder_);
+    out.offsets.swap(sortedOffsets_);
+  }
+
+  const float *cx_ = nullptr;
+  const float *cy_ = nullptr;
+  float base_ = 0;
+
+  float originX_ = 0, originY_ = 0, cell_ = 1;
+  int cols_ = 1, rows_ = 1;
+  std::vector<uint32_t> cellOf_, cellStart_, cellLen_, cellItems_;
+
+  std::vector<uint32_t> parent_, root_, fill_;
+  std::vector<uint32_t> clusterStart_, clusterItems_;
+  std::vector<float> clusterMinY_, clusterMaxY_;
+
+  std::vector<uint8_t> assigned_;
+  std::vector<uint32_t> members_;
+  float groupMinY_ = 0, groupMaxY_ = 0;
+
+  std::vector<uint32_t> groupTop_, sortedOrder_, sortedOffsets_;
+};
+
+// Function to group lines by proximity (for speech bubbles)
+inline LineGroups groupLinesByProximity(const OcrPage& page, double maxDistancePercent = 0.1, double maxDistanceAbsoluteMinimum = 100) {
+  double maxDistance = std::max(page.imageHeight * maxDistancePercent, maxDistanceAbsoluteMinimum);
+  size_t n = page.lineCount();
+
+  trace::Span span("group", (int64_t)n);
+  trace::log("\n=== Grouping %zu lines with maxDistance=%.2f (%.1f%% of image height %d) ===\n",
+             n, maxDistance, maxDistancePercent * 100, page.imageHeight);
+
+  // The centers are already contiguous in the page
+  thread_local LineClusterer clusterer;
+  LineGroups groups;
+  clusterer.group(page.centerX.data(), page.centerY.data(), n, maxDistance, groups);
+
+  trace::log("\n=== Created %zu groups total ===\n", groups.size());
+
+  return groups;
+}
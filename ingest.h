@@ -0,0 +1,332 @@
+#pragma once
+
+// Pixel ingest: turns 1/3/4-channel 8-bit images into the BGRA layout
+// RunOcrPipeline expects. BGRA input is passed through as a view; everything
+// else is converted with SIMD kernels into aligned buffers from a FramePool,
+// which recycles them across images.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "ocr_types.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define INGEST_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define INGEST_TARGET(isa)
+#else
+#define INGEST_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define INGEST_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Rows of pooled frames start on this boundary
+constexpr size_t kFrameAlignment = 64;
+
+// Aligned, reusable pixel storage
+struct FrameBuffer {
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+
+  explicit FrameBuffer(size_t bytes) : capacity(bytes) {
+    data = static_cast<uint8_t *>(::operator new(bytes, std::align_val_t(kFrameAlignment)));
+  }
+  ~FrameBuffer() { ::operator delete(data, std::align_val_t(kFrameAlignment)); }
+  FrameBuffer(const FrameBuffer &) = delete;
+  FrameBuffer &operator=(const FrameBuffer &) = delete;
+};
+
+// Thread-safe free list of FrameBuffers. acquire() hands out the smallest
+// idle buffer that fits and only allocates when none does, so a batch of
+// similar pages stops allocating after the first few images.
+class FramePool {
+public:
+  explicit FramePool(size_t maxIdle = 16) : maxIdle_(maxIdle) {}
+  ~FramePool() {
+    for (FrameBuffer *buffer : idle_) delete buffer;
+  }
+  FramePool(const FramePool &) = delete;
+  FramePool &operator=(const FramePool &) = delete;
+
+  // Returns its buffer to the pool when destroyed
+  class Lease {
+  public:
+    Lease() = default;
+    Lease(FramePool *pool, FrameBuffer *buffer) : pool_(pool), buffer_(buffer) {}
+    Lease(Lease &&other) noexcept
+        : pool_(std::exchange(other.pool_, nullptr)), buffer_(std::exchange(other.buffer_, nullptr)) {}
+    Lease &operator=(Lease &&other) noexcept {
+      if (this != &other) {
+        reset();
+        pool_ = std::exchange(other.pool_, nullptr);
+        buffer_ = std::exchange(other.buffer_, nullptr);
+      }
+      return *this;
+    }
+    ~Lease() { reset(); }
+
+    void reset() {
+      if (buffer_) pool_->release(buffer_);
+      pool_ = nullptr;
+      buffer_ = nullptr;
+    }
+    uint8_t *data() const { return buffer_ ? buffer_->data : nullptr; }
+    explicit operator bool() const { return buffer_ != nullptr; }
+
+  private:
+    FramePool *pool_ = nullptr;
+    FrameBuffer *buffer_ = nullptr;
+  };
+
+  Lease acquire(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto best = idle_.end();
+      for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+        if ((*it)->capacity >= bytes && (best == idle_.end() || (*it)->capacity < (*best)->capacity)) best = it;
+      }
+      if (best != idle_.end()) {
+        FrameBuffer *buffer = *best;
+        idle_.erase(best);
+        return Lease(this, buffer);
+      }
+      allocations_++;
+    }
+    return Lease(this, new FrameBuffer(bytes));
+  }
+
+  // Buffers allocated so far; flat in steady state
+  size_t allocations() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allocations_;
+  }
+
+private:
+  void release(FrameBuffer *buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < maxIdle_) {
+      idle_.push_back(buffer);
+      return;
+    }
+    // Keep the larger buffers, they fit more future frames
+    auto smallest = std::min_element(idle_.begin(), idle_.end(),
+                                     [](FrameBuffer *a, FrameBuffer *b) { return a->capacity < b->capacity; });
+    if (smallest != idle_.end() && (*smallest)->capacity < buffer->capacity) std::swap(*smallest, buffer);
+    delete buffer;
+  }
+
+  const size_t maxIdle_;
+  mutable std::mutex mutex_;
+  std::vector<FrameBuffer *> idle_;
+  size_t allocations_ = 0;
+};
+
+namespace ingest_detail {
+
+inline void grayRowScalar(const uint8_t *src, uint8_t *dst, int x, int width) {
+  for (; x < width; x++) {
+    uint8_t g = src[x];
+    dst[x * 4 + 0] = g;
+    dst[x * 4 + 1] = g;
+    dst[x * 4 + 2] = g;
+    dst[x * 4 + 3] = 255;
+  }
+}
+
+inline void bgrRowScalar(const uint8_t *src, uint8_t *dst, int x, int width) {
+  for (; x < width; x++) {
+    dst[x * 4 + 0] = src[x * 3 + 0];
+    dst[x * 4 + 1] = src[x * 3 + 1];
+    dst[x * 4 + 2] = src[x * 3 + 2];
+    dst[x * 4 + 3] = 255;
+  }
+}
+
+inline void grayRowPlain(const uint8_t *src, uint8_t *dst, int width) { grayRowScalar(src, dst, 0, width); }
+inline void bgrRowPlain(const uint8_t *src, uint8_t *dst, int width) { bgrRowScalar(src, dst, 0, width); }
+
+#if INGEST_X86
+inline bool cpuHasAvx2() {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  bool osxsave = (regs[2] & (1 << 27)) != 0, avx = (regs[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline bool cpuHasSsse3() {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  return (regs[2] & (1 << 9)) != 0;
+#else
+  return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+// 16 pixels per step: g -> (g, g) and (g, 255), then interleave to g g g 255
+inline void grayRowSse2(const uint8_t *src, uint8_t *dst, int width) {
+  const __m128i alpha = _mm_set1_epi8((char)0xFF);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+    __m128i gg_lo = _mm_unpacklo_epi8(g, g), gg_hi = _mm_unpackhi_epi8(g, g);
+    __m128i ga_lo = _mm_unpacklo_epi8(g, alpha), ga_hi = _mm_unpackhi_epi8(g, alpha);
+    __m128i *out = reinterpret_cast<__m128i *>(dst + x * 4);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+  }
+  grayRowScalar(src, dst, x, width);
+}
+
+// 4 pixels per step; loads 16 bytes, so stop while 16 bytes remain
+INGEST_TARGET("ssse3")
+inline void bgrRowSsse3(const uint8_t *src, uint8_t *dst, int width) {
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+  int x = 0;
+  for (; (width - x) * 3 >= 16; x += 4) {
+    __m128i bgr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 3));
+    __m128i bgra = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), bgra);
+  }
+  bgrRowScalar(src, dst, x, width);
+}
+
+// 8 pixels per step: spread 24 bytes over both lanes, then shuffle per lane.
+// Loads 32 bytes, so stop while 32 bytes remain.
+INGEST_TARGET("avx2")
+inline void bgrRowAvx2(const uint8_t *src, uint8_t *dst, int width) {
+  const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+  const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                           0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+  int x = 0;
+  for (; (width - x) * 3 >= 32; x += 8) {
+    __m256i bgr = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 3));
+    bgr = _mm256_permutevar8x32_epi32(bgr, spread);
+    __m256i bgra = _mm256_or_si256(_mm256_shuffle_epi8(bgr, shuffle), alpha);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x * 4), bgra);
+  }
+  bgrRowScalar(src, dst, x, width);
+}
+#endif
+
+#if INGEST_NEON
+inline void grayRowNeon(const uint8_t *src, uint8_t *dst, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t g = vld1q_u8(src + x);
+    uint8x16x4_t bgra = {{g, g, g, vdupq_n_u8(255)}};
+    vst4q_u8(dst + x * 4, bgra);
+  }
+  grayRowScalar(src, dst, x, width);
+}
+
+inline void bgrRowNeon(const uint8_t *src, uint8_t *dst, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t bgr = vld3q_u8(src + x * 3);
+    uint8x16x4_t bgra = {{bgr.val[0], bgr.val[1], bgr.val[2], vdupq_n_u8(255)}};
+    vst4q_u8(dst + x * 4, bgra);
+  }
+  bgrRowScalar(src, dst, x, width);
+}
+#endif
+
+typedef void (*RowKernel)(const uint8_t *, uint8_t *, int);
+
+inline RowKernel grayKernel() {
+#if INGEST_X86
+  return grayRowSse2;
+#elif INGEST_NEON
+  return grayRowNeon;
+#else
+  return grayRowPlain;
+#endif
+}
+
+inline RowKernel bgrKernel() {
+#if INGEST_X86
+  static const RowKernel kernel = cpuHasAvx2() ? bgrRowAvx2 : cpuHasSsse3() ? bgrRowSsse3 : bgrRowPlain;
+  return kernel;
+#elif INGEST_NEON
+  return bgrRowNeon;
+#else
+  return bgrRowPlain;
+#endif
+}
+
+} // namespace ingest_detail
+
+// Converts width x height pixels of 1 (gray), 3 (BGR) or 4 (BGRA) channels
+// into BGRA at dst. Returns false for other channel counts.
+inline bool convertToBgra(const uint8_t *src, size_t srcStride, int channels, int width, int height,
+                          uint8_t *dst, size_t dstStride) {
+  ingest_detail::RowKernel kernel = nullptr;
+  if (channels == 1) {
+    kernel = ingest_detail::grayKernel();
+  } else if (channels == 3) {
+    kernel = ingest_detail::bgrKernel();
+  } else if (channels != 4) {
+    return false;
+  }
+  for (int y = 0; y < height; y++) {
+    const uint8_t *s = src + (size_t)y * srcStride;
+    uint8_t *d = dst + (size_t)y * dstStride;
+    if (kernel) {
+      kernel(s, d, width);
+    } else {
+      memcpy(d, s, (size_t)width * 4);
+    }
+  }
+  return true;
+}
+
+// BGRA image ready for RunOcrPipeline. img either points into the caller's
+// pixels (BGRA input) or into frame, which goes back to the pool with it.
+struct IngestedImage {
+  Img img{};
+  FramePool::Lease frame;
+};
+
+// Builds out.img over 8-bit pixels with 1, 3 or 4 channels. BGRA is a
+// zero-copy view, so src must outlive out in that case.
+inline bool ingestPixels(const uint8_t *src, size_t srcStride, int channels, int width, int height,
+                         FramePool &pool, IngestedImage &out) {
+  if (channels != 1 && channels != 3 && channels != 4) return false;
+  out.frame.reset();
+  const uint8_t *pixels = src;
+  size_t stride = srcStride;
+  if (channels != 4) {
+    stride = ((size_t)width * 4 + kFrameAlignment - 1) / kFrameAlignment * kFrameAlignment;
+    out.frame = pool.acquire(stride * (size_t)height);
+    convertToBgra(src, srcStride, channels, width, height, out.frame.data(), stride);
+    pixels = out.frame.data();
+  }
+  out.img = {.t = 3,
+             .col = width,
+             .row = height,
+             ._unk = 0,
+             .step = (int64_t)stride,
+             .data_ptr = (int64_t)pixels};
+  return true;
+}
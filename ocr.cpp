@@ -1,521 +1,651 @@
 #include <cassert>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
 #include <vector>
 #include <filesystem>
 #include <algorithm>
 #include <cmath>
 
-#include <Windows.h>
+#ifdef _WIN32
+#include "oneocr_backend.h"
+#endif
 #include <opencv2/opencv.hpp>
 #include <stdio.h>
+
+#include "archive.h"
+#include "batch.h"
+#include "capture.h"
+#include "downscale.h"
+#include "fake_backend.h"
+#include "folder_scan.h"
+#include "frame_diff.h"
+#include "grouping.h"
+#include "ingest.h"
+#include "ocr_backend.h"
+#include "ocr_engine.h"
+#include "ocr_output.h"
+#include "ocr_server.h"
+#include "ocr_types.h"
+#include "result_cache.h"
+#include "shm_ring.h"
+#include "tiling.h"
+#include "trace.h"
+#include "worker_pool.h"
+
 using namespace cv;
 using namespace std;
 
-typedef struct {
-  __int32 t;
-  __int32 col;
-  __int32 row;
-  __int32 _unk;
-  __int64 step;
-  __int64 data_ptr;
-} Img;
-
-// Structure to hold OCR line data with bounding box
-typedef struct {
-  string content;
-  float x, y, width, height;
-  float center_x, center_y;
-  // Store up to three corner coordinates (if provided by the OCR API)
-  int cornerCount;
-  float x1, y1;
-  float x2, y2;
-  float x3, y3;
-} OcrLineData;
-
-// Structure to hold OCR word data with bounding box
-typedef struct {
-  string content;
-  float x, y, width, height;
-  float center_x, center_y;
-} OcrWordData;
-
-// Simple XML escape helper
-static string escapeXml(const string &s) {
-  string out;
-  out.reserve(s.size());
-  for (char c : s) {
-    switch (c) {
-      case '&': out += "&amp;"; break;
-      case '<': out += "&lt;"; break;
-      case '>': out += "&gt;"; break;
-      case '"': out += "&quot;"; break;
-      case '\'': out += "&apos;"; break;
-      default: out.push_back(c);
-    }
-  }
-  return out;
-}
-
-typedef __int64(__cdecl *CreateOcrInitOptions_t)(__int64 *);
-typedef __int64(__cdecl *GetOcrLineCount_t)(__int64, __int64 *);
-typedef __int64(__cdecl *GetOcrLine_t)(__int64, __int64, __int64 *);
-typedef __int64(__cdecl *GetOcrLineContent_t)(__int64, __int64 *);
-typedef __int64(__cdecl *GetOcrLineBoundingBox_t)(__int64, __int64 *);
-typedef __int64(__cdecl *GetOcrLineWordCount_t)(__int64, __int64 *);
-typedef __int64(__cdecl *GetOcrWord_t)(__int64, __int64, __int64 *);
-typedef __int64(__cdecl *GetOcrWordContent_t)(__int64, __int64 *);
-typedef __int64(__cdecl *GetOcrWordBoundingBox_t)(__int64, __int64 *);
-typedef __int64(__cdecl *OcrProcessOptionsSetMaxRecognitionLineCount_t)(
-    __int64, __int64);
-typedef __int64(__cdecl *RunOcrPipeline_t)(__int64, Img *, __int64, __int64 *);
-typedef __int64(__cdecl *CreateOcrProcessOptions_t)(__int64 *);
-typedef __int64(__cdecl *OcrInitOptionsSetUseModelDelayLoad_t)(__int64, char);
-typedef __int64(__cdecl *CreateOcrPipeline_t)(__int64, __int64, __int64,
-                                              __int64 *);
-
-// Function to calculate distance between two lines
-double calculateDistance(const OcrLineData& line1, const OcrLineData& line2) {
-  double dist = sqrt(pow(line1.center_x - line2.center_x, 2) + pow(line1.center_y - line2.center_y, 2));
-#ifdef LOG
-  printf("Distance between '%s' (%.1f,%.1f) and '%s' (%.1f,%.1f): %.2f\n", 
-         line1.content.substr(0, 20).c_str(), line1.center_x, line1.center_y,
-         line2.content.substr(0, 20).c_str(), line2.center_x, line2.center_y, dist);
-#endif
-  return dist;
+// Image decoded and converted to BGRA, ready for RunOcrPipeline. img points
+// into source (BGRA files, zero-copy) or into a pooled frame.
+struct DecodedImage {
+  string image_file;
+  string output_file;
+  Mat source;
+  FramePool::Lease frame;
+  Img img;
+  // Original size / decoded size, when the image was downscaled
+  float scaleX = 1, scaleY = 1;
+  int originalHeight = 0;
+};
+
+// BGRA frames recycled across images and decode threads
+static FramePool g_framePool;
+
+// Records finished images for --incremental; null otherwise
+static Manifest *g_manifest = nullptr;
+
+// Pages go here instead of per-image files with --archive; null otherwise
+static ArchiveWriter *g_archive = nullptr;
+
+// What is read from each result; set from the enabled outputs
+static ExtractProfile g_profile = kExtractWords;
+
+// --max-side / --text-height; the estimate learns from recognized pages
+static ScaleOptions g_scaleOptions;
+static TextHeightEstimate g_textHeight;
+
+bool read_file(const string &file_name, vector<uchar> &bytes) {
+  ifstream in(file_name, ios::binary | ios::ate);
+  if (!in.is_open()) return false;
+  streamsize size = in.tellg();
+  if (size <= 0) return false;
+  in.seekg(0);
+  bytes.resize((size_t)size);
+  return (bool)in.read(reinterpret_cast<char *>(bytes.data()), size);
 }
 
-// Function to group lines by proximity (for speech bubbles)
-vector<vector<OcrLineData>> groupLinesByProximity(vector<OcrLineData>& lines, int imageHeight, double maxDistancePercent = 0.1, double maxDistanceAbsoluteMinimum = 100) {
-  double maxDistance = max(imageHeight * maxDistancePercent, maxDistanceAbsoluteMinimum);
-  vector<vector<OcrLineData>> groups;
-  vector<bool> used(lines.size(), false);
-  
-  #ifdef LOG
-  printf("\n=== Grouping %zu lines with maxDistance=%.2f (%.1f%% of image height %d) ===\n", 
-         lines.size(), maxDistance, maxDistancePercent * 100, imageHeight);
-  #endif
-  
-  for (size_t i = 0; i < lines.size(); i++) {
-    if (used[i]) continue;
-
-    vector<OcrLineData> currentGroup;
-    currentGroup.push_back(lines[i]);
-    used[i] = true;
-
-    #ifdef LOG
-    printf("\nStarting new group %zu with line: '%s' at (%.1f,%.1f)\n",
-           groups.size() + 1, lines[i].content.substr(0, 30).c_str(),
-           lines[i].center_x, lines[i].center_y);
-    #endif
-
-    // Find all lines close to the current group
-    bool foundNew = true;
-    while (foundNew) {
-      foundNew = false;
-      for (size_t j = 0; j < lines.size(); j++) {
-        if (used[j]) continue;
-
-        // Calculate the vertical span of the current group (distance between highest and lowest line)
-        float minY = currentGroup[0].center_y;
-        float maxY = currentGroup[0].center_y;
-        for (const auto& groupLine : currentGroup) {
-          minY = min(minY, groupLine.center_y);
-          maxY = max(maxY, groupLine.center_y);
-        }
-        float verticalSpan = maxY - minY;
-        float verticalCompensation = 0.5f * verticalSpan;
-
-        // Check if this line is close to any line in the current group
-        for (const auto& groupLine : currentGroup) {
-          float dx = lines[j].center_x - groupLine.center_x;
-          float dy = lines[j].center_y - groupLine.center_y;
-          float dist = sqrt(dx * dx + dy * dy);
-          float compensatedMaxDistance = maxDistance;
-          // If the candidate is vertically offset, allow more distance
-          if (fabs(dy) > 0) {
-            compensatedMaxDistance += verticalCompensation;
-          }
-          #ifdef LOG
-          printf("    Checking '%s' vs group line '%s': dist=%.2f, compensatedMax=%.2f (dy=%.2f, verticalComp=%.2f, span=%.2f)\n",
-                 lines[j].content.substr(0, 20).c_str(), groupLine.content.substr(0, 20).c_str(),
-                 dist, compensatedMaxDistance, dy, verticalCompensation, verticalSpan);
-          #endif
-          if (dist <= compensatedMaxDistance) {
-            #ifdef LOG
-            printf("  -> Adding '%s' to group (distance: %.2f <= %.2f)\n",
-                   lines[j].content.substr(0, 30).c_str(), dist, compensatedMaxDistance);
-            #endif
-            currentGroup.push_back(lines[j]);
-            used[j] = true;
-            foundNew = true;
-            break;
-          }
-        }
-        if (foundNew) break;
-      }
+bool decode_image(const string &file_name, DecodedImage &decoded) {
+  // The encoded bytes and the decode target are reused by this thread, so a
+  // run over same-sized pages stops allocating. BGRA images keep their decode
+  // buffer instead (img points into it) and the next one gets a fresh one.
+  thread_local vector<uchar> encoded;
+  thread_local Mat img;
+  int width = 0, height = 0;
+  double scale = 1;
+  {
+    trace::Span span("decode");
+    if (!read_file(file_name, encoded)) {
+      cout << "Can't read image: " << file_name << endl;
+      return false;
+    }
+    span.setArg((int64_t)encoded.size());
+    if (g_scaleOptions.enabled() && probeImageSize(encoded.data(), encoded.size(), width, height)) {
+      scale = chooseScale(width, height, g_scaleOptions, g_textHeight.get());
+    }
+    // The codec shrinks JPEGs while decoding; orientation stays as stored,
+    // like IMREAD_UNCHANGED
+    switch (scale < 1 ? decodeReduction(scale) : 1) {
+      case 2: imdecode(encoded, IMREAD_REDUCED_COLOR_2 | IMREAD_IGNORE_ORIENTATION, &img); break;
+      case 4: imdecode(encoded, IMREAD_REDUCED_COLOR_4 | IMREAD_IGNORE_ORIENTATION, &img); break;
+      case 8: imdecode(encoded, IMREAD_REDUCED_COLOR_8 | IMREAD_IGNORE_ORIENTATION, &img); break;
+      default: imdecode(encoded, IMREAD_UNCHANGED, &img); break;
     }
+  }
+  if (img.empty()) {
+    cout << "Can't read image: " << file_name << endl;
+    return false;
+  }
+  if (g_scaleOptions.enabled() && width == 0) {
+    // No header probe for this format: decoded at full size, resize only
+    width = img.cols;
+    height = img.rows;
+    scale = chooseScale(width, height, g_scaleOptions, g_textHeight.get());
+  }
+  if (scale < 1) {
+    // Exact size with an area filter (fast, and no aliasing on text edges)
+    Size target(max((int)lround(width * scale), 1), max((int)lround(height * scale), 1));
+    if (img.cols > target.width || img.rows > target.height) {
+      trace::Span span("resize");
+      thread_local Mat resized;
+      resize(img, resized, target, 0, 0, INTER_AREA);
+      swap(img, resized);
+    }
+    decoded.scaleX = (float)width / img.cols;
+    decoded.scaleY = (float)height / img.rows;
+    decoded.originalHeight = height;
+  }
 
-    #ifdef LOG
-    printf("  Group %zu completed with %zu lines\n", groups.size() + 1, currentGroup.size());
-    #endif
-
-    // Sort lines in the group by vertical position (top to bottom)
-    sort(currentGroup.begin(), currentGroup.end(),
-         [](const OcrLineData& a, const OcrLineData& b) {
-           return a.center_y < b.center_y;
-         });
-
-    groups.push_back(currentGroup);
-  }
-  
-  #ifdef LOG
-  printf("\n=== Created %zu groups total ===\n", groups.size());
-  #endif
-  
-  // Sort groups by their topmost line's position (left to right, then top to bottom)
-  sort(groups.begin(), groups.end(), 
-       [](const vector<OcrLineData>& a, const vector<OcrLineData>& b) {
-         if (abs(a[0].center_y - b[0].center_y) < 50) { // Same row
-           return a[0].center_x < b[0].center_x; // Left to right
-         }
-         return a[0].center_y < b[0].center_y; // Top to bottom
-       });
-  
-  return groups;
-}
+  int channels = img.channels();
+  if (img.depth() != CV_8U || (channels != 1 && channels != 3 && channels != 4)) {
+    cout << "Image type not supported: " << file_name << endl;
+    return false;
+  }
 
-void ocr(Img img, const string &output_file, __int64 pipeline, __int64 opt, bool verboseXml) {
-  HINSTANCE hDLL = LoadLibraryA("oneocr.dll");
-  if (hDLL == NULL) {
-    std::cerr << "Failed to load DLL: " << GetLastError() << std::endl;
-    return;
+  IngestedImage ingested;
+  {
+    trace::Span span("convert");
+    ingestPixels(img.data, img.step, channels, img.cols, img.rows, g_framePool, ingested);
+  }
+  if (channels == 4) {
+    decoded.source = std::move(img);
+    img = Mat();
   }
-  
-  // Store image height for maxDistance calculation
-  int imageHeight = img.row;
-  // Get function pointers
-  CreateOcrInitOptions_t CreateOcrInitOptions =
-      (CreateOcrInitOptions_t)GetProcAddress(hDLL, "CreateOcrInitOptions");
-  GetOcrLineCount_t GetOcrLineCount =
-      (GetOcrLineCount_t)GetProcAddress(hDLL, "GetOcrLineCount");
-  CreateOcrProcessOptions_t CreateOcrProcessOptions =
-      (CreateOcrProcessOptions_t)GetProcAddress(hDLL,
-                                                "CreateOcrProcessOptions");
-  CreateOcrPipeline_t CreateOcrPipeline =
-      (CreateOcrPipeline_t)GetProcAddress(hDLL, "CreateOcrPipeline");
-  OcrInitOptionsSetUseModelDelayLoad_t OcrInitOptionsSetUseModelDelayLoad =
-      (OcrInitOptionsSetUseModelDelayLoad_t)GetProcAddress(
-          hDLL, "OcrInitOptionsSetUseModelDelayLoad");
-  OcrProcessOptionsSetMaxRecognitionLineCount_t
-      OcrProcessOptionsSetMaxRecognitionLineCount =
-          (OcrProcessOptionsSetMaxRecognitionLineCount_t)GetProcAddress(
-              hDLL, "OcrProcessOptionsSetMaxRecognitionLineCount");
-  RunOcrPipeline_t RunOcrPipeline =
-      (RunOcrPipeline_t)GetProcAddress(hDLL, "RunOcrPipeline");
-  GetOcrLine_t GetOcrLine = (GetOcrLine_t)GetProcAddress(hDLL, "GetOcrLine");
-  GetOcrLineContent_t GetOcrLineContent =
-      (GetOcrLineContent_t)GetProcAddress(hDLL, "GetOcrLineContent");
-  GetOcrLineBoundingBox_t GetOcrLineBoundingBox =
-      (GetOcrLineBoundingBox_t)GetProcAddress(hDLL, "GetOcrLineBoundingBox");
-  GetOcrLineWordCount_t GetOcrLineWordCount =
-      (GetOcrLineWordCount_t)GetProcAddress(hDLL, "GetOcrLineWordCount");
-  GetOcrWord_t GetOcrWord = (GetOcrWord_t)GetProcAddress(hDLL, "GetOcrWord");
-  GetOcrWordContent_t GetOcrWordContent =
-      (GetOcrWordContent_t)GetProcAddress(hDLL, "GetOcrWordContent");
-  GetOcrWordBoundingBox_t GetOcrWordBoundingBox =
-      (GetOcrWordBoundingBox_t)GetProcAddress(hDLL, "GetOcrWordBoundingBox");
-  __int64 ctx = 0;
-  __int64 instance = 0;
-  __int64 res = 0;
+  decoded.img = ingested.img;
+  decoded.frame = std::move(ingested.frame);
+  decoded.image_file = file_name;
+  decoded.output_file = outputFileFor(file_name);
+  return true;
+}
+
+bool recognize_pixels(const Img &img, OcrBackend &backend, OcrPage &page) {
 #ifdef DEBUG
-  __int16 *ibs = reinterpret_cast<__int16 *>(&img);
+  const int16_t *ibs = reinterpret_cast<const int16_t *>(&img);
   for (int i = 0; i < 8; i++) {
     printf("%02x ", ibs[i]);
   }
   printf("\n");
 #endif
-  assert(sizeof(img) == 0x20);
-  res = RunOcrPipeline(pipeline, &img, opt, &instance);
-  assert(res == 0);
-#ifdef LOG
-  printf("Running ocr pipeline...\n");
-  printf("\t ctx: 0x%llx, pipeline: 0x%llx, opt: 0x%llx, instance: "
-         "0x%llx\n",
-         ctx, pipeline, opt, instance);
-#endif
-  __int64 lc;
-  res = GetOcrLineCount(instance, &lc);
-  assert(res == 0);
-  #ifdef LOG
-  printf("Recognize %lld lines\n", lc);
-  #endif
-
-  // Collect all line data first
-  vector<OcrLineData> allLines;
-  // For XML export: keep words per line
-  vector<vector<OcrWordData>> allWordsPerLine;
-
-  ofstream out(output_file);
-  if (!out.is_open()) {
-    cerr << "Failed to open output file: " << output_file << endl;
-    return;
+  return recognizePage(backend, img, page, g_profile);
+}
+
+// Recognizes a decoded image; boxes come back in original-image coordinates
+bool recognize(const DecodedImage &decoded, OcrBackend &backend, OcrPage &page) {
+  if (!recognize_pixels(decoded.img, backend, page)) {
+    return false;
+  }
+  if (decoded.originalHeight > 0) {
+    scalePage(page, decoded.scaleX, decoded.scaleY, decoded.originalHeight);
+  }
+  if (g_scaleOptions.targetTextHeight > 0) {
+    g_textHeight.observe(page);
   }
+  return true;
+}
 
-  for (__int64 lci = 0; lci < lc; lci++) {
-    __int64 line = 0;
-    __int64 v106 = 0;
-    GetOcrLine(instance, lci, &line);
-    if (!line) {
-      continue;
-    }
-    __int64 line_content = 0;
-    GetOcrLineContent(line, &line_content);
-    char *lcs = reinterpret_cast<char *>(line_content);
-    
-    // Get bounding box for this line
-    __int64 bbox_ptr = 0;
-    GetOcrLineBoundingBox(line, &bbox_ptr);
-    
-    OcrLineData lineData;
-    lineData.content = string(lcs);
-    
-    if (bbox_ptr) {
-      // Assuming bounding box is stored as an array of floats containing
-      // coordinates for the polygon corners. Common layouts are either
-      // [TLx, TLy, TRx, TRy, BLx, BLy, BRx, BRy] or a subset like
-      // [TLx, TLy, TRx, TRy, BLx, BLy]. We'll read up to 8 values if
-      // available and compute the axis-aligned bounding box.
-      float* bbox = reinterpret_cast<float*>(bbox_ptr);
-
-      // Read coordinates safely. We don't have a count, so assume at
-      // least 6 floats (3 points) but allow up to 8.
-      float coords[8] = {0,0,0,0,0,0,0,0};
-      // copy up to 8 floats from bbox into coords
-      for (int k = 0; k < 8; k++) {
-        // Try/catch isn't available for raw pointer reads; assume pointer
-        // is valid for at least 6 floats as returned by the API.
-        coords[k] = bbox[k];
-      }
+void write_results(const string &image_file, const string &output_file, const OcrPage &page,
+                   const LineGroups &groups, const OutputOptions &output) {
+  if (g_archive) {
+    // The manifest hears about it once the segment is committed
+    trace::Span span("write.archive");
+    g_archive->add(image_file, page);
+    return;
+  }
+  if (writeOutputs(output_file, page, groups, output) && g_manifest) {
+    g_manifest->markDone(output_file);
+  }
+}
 
-      // Determine min/max X/Y across available points
-      float minX = coords[0];
-      float minY = coords[1];
-      float maxX = coords[0];
-      float maxY = coords[1];
-      for (int p = 0; p < 4; p++) {
-        float px = coords[p*2];
-        float py = coords[p*2 + 1];
-        // If both values are zero and p >= 3 (unused slots), break
-        if (p >= 3 && px == 0.0f && py == 0.0f) break;
-        if (px < minX) minX = px;
-        if (py < minY) minY = py;
-        if (px > maxX) maxX = px;
-        if (py > maxY) maxY = py;
-      }
+// Hands a decoded image to the engine; the view keeps the decode alive
+// until the engine is done with it
+future<PageResult> submit(OcrEngine &engine, unique_ptr<DecodedImage> decoded) {
+  ImageView view;
+  view.pixels = reinterpret_cast<const uint8_t *>(decoded->img.data_ptr);
+  view.width = decoded->img.col;
+  view.height = decoded->img.row;
+  view.stride = (size_t)decoded->img.step;
+  view.channels = 4;
+  SubmitOptions options;
+  options.scaleX = decoded->scaleX;
+  options.scaleY = decoded->scaleY;
+  options.originalHeight = decoded->originalHeight;
+  view.owner = shared_ptr<DecodedImage>(std::move(decoded));
+  return engine.submit(std::move(view), std::move(options));
+}
 
-      // Store up to three corner coordinates (use first 3 points)
-      lineData.cornerCount = 0;
-      lineData.x1 = lineData.y1 = lineData.x2 = lineData.y2 = lineData.x3 = lineData.y3 = 0.0f;
-      // Count how many non-zero points we have (consider a point present if either coord != 0)
-      for (int cp = 0; cp < 3; cp++) {
-        float px = coords[cp*2];
-        float py = coords[cp*2 + 1];
-        if (px != 0.0f || py != 0.0f) {
-          lineData.cornerCount++;
-          if (cp == 0) { lineData.x1 = px; lineData.y1 = py; }
-          if (cp == 1) { lineData.x2 = px; lineData.y2 = py; }
-          if (cp == 2) { lineData.x3 = px; lineData.y3 = py; }
-        }
-      }
+struct PendingPage {
+  string image_file;
+  string output_file;
+  future<PageResult> result;
+};
+
+bool finish(PendingPage &pending, const OutputOptions &output) {
+  PageResult result = pending.result.get();
+  if (!result.ok()) {
+    // Cancelled means the pipelines failed to load, which was reported
+    if (result.status != kPageCancelled) {
+      cerr << "OCR failed for " << pending.output_file << ": " << result.error << endl;
+    }
+    return false;
+  }
+  if (g_scaleOptions.targetTextHeight > 0) {
+    g_textHeight.observe(result.page);
+  }
+  write_results(pending.image_file, pending.output_file, result.page, result.groups, output);
+  return true;
+}
 
-      // Fill lineData with axis-aligned bounding box
-      lineData.x = minX;
-      lineData.y = minY;
-      lineData.width = maxX - minX;
-      lineData.height = maxY - minY;
-      // Guard against negative sizes
-      if (lineData.width < 0) lineData.width = 0;
-      if (lineData.height < 0) lineData.height = 0;
-
-      lineData.center_x = lineData.x + lineData.width / 2.0f;
-      lineData.center_y = lineData.y + lineData.height / 2.0f;
-#ifdef LOG
-      printf("Line %lld: Got bounding box from API: x=%.1f, y=%.1f, w=%.1f, h=%.1f\n", 
-             lci, lineData.x, lineData.y, lineData.width, lineData.height);
-#endif
-    } else {
-      // Fallback: use line index as approximate position
-      lineData.x = 0;
-      lineData.y = (int)lci * 20; // Approximate line height
-      lineData.width = 100;
-      lineData.height = 20;
-      lineData.center_x = 50;
-      lineData.center_y = lineData.y + 10;
-      lineData.cornerCount = 0;
-      lineData.x1 = lineData.y1 = lineData.x2 = lineData.y2 = lineData.x3 = lineData.y3 = 0.0f;
-      #ifdef LOG
-      printf("Line %lld: No bounding box available, using fallback: x=%.1f, y=%.1f, w=%.1f, h=%.1f\n", 
-             lci, lineData.x, lineData.y, lineData.width, lineData.height);
-      #endif
+// Decodes on worker threads and submits to the engine, which has at most
+// maxInFlight images queued or running; results are written on this thread
+// in input order, so the OCR workers never wait for the disk or the codecs.
+// Decode threads stay within maxInFlight images of the next one to write,
+// so results finished behind a slow image are bounded as well, and every
+// page is written (and marked done for --incremental) soon after it is
+// recognized.
+// pipelines is how many the engine will have once loaded. Returns when the
+// first result was written.
+chrono::steady_clock::time_point process_images(const vector<string> &image_files, OcrEngine &engine,
+                                                const OutputOptions &output, const BatchOptions &options,
+                                                int pipelines) {
+  auto start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point firstResult;
+  size_t processed = 0;
+  auto commit = [&](PendingPage &pending) {
+    if (!finish(pending, output)) return;
+    if (processed++ == 0) firstResult = chrono::steady_clock::now();
+  };
+  auto decodeAndSubmit = [&](size_t i) -> optional<PendingPage> {
+    auto decoded = make_unique<DecodedImage>();
+    if (!decode_image(image_files[i], *decoded)) return nullopt;
+    PendingPage pending{decoded->image_file, decoded->output_file, {}};
+    pending.result = submit(engine, std::move(decoded));
+    return pending;
+  };
+  if (options.decodeThreads <= 0 || image_files.size() == 1) {
+    for (size_t i = 0; i < image_files.size(); i++) {
+      optional<PendingPage> pending = decodeAndSubmit(i);
+      if (pending) commit(*pending);
     }
-    
-    allLines.push_back(lineData);
-  // Prepare container for this line's words
-  vector<OcrWordData> wordsThisLine;
-    
-    __int64 lr = 0;
-    GetOcrLineWordCount(line, &lr);
-    for (__int64 j = 0; j < lr; j++) {
-      __int64 v105 = 0;
-      __int64 v107 = 0;
-      __int64 lpMultiByteStr = 0;
-      GetOcrWord(line, j, &v105);
-      GetOcrWordContent(v105, &lpMultiByteStr);
-      GetOcrWordBoundingBox(v105, &v107);
-      if (lpMultiByteStr) {
-        char *wcs = reinterpret_cast<char *>(lpMultiByteStr);
-        OcrWordData wd;
-        wd.content = string(wcs);
-        if (v107) {
-          float* wb = reinterpret_cast<float*>(v107);
-          wd.width = wb[0];
-          wd.height = wb[1];
-          wd.x = wb[2];
-          wd.y = wb[3];
-          wd.center_x = wd.x + wd.width / 2;
-          wd.center_y = wd.y + wd.height / 2;
-        } else {
-          wd.x = 0; wd.y = 0; wd.width = 0; wd.height = 0; wd.center_x = 0; wd.center_y = 0;
-        }
-        wordsThisLine.push_back(wd);
-      }
+  } else {
+    int threads = max(options.decodeThreads, pipelines);
+    runWorkerPool<PendingPage>(
+        image_files.size(), threads, [&](int, size_t i) { return decodeAndSubmit(i); },
+        [&](size_t, PendingPage &pending) { commit(pending); }, engine.options().maxInFlight);
+  }
+  if (image_files.size() < 2) return firstResult;
+
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  double busy = engine.stats().busyMicros / 1e6;
+  size_t workers = max<size_t>(engine.workers(), 1);
+  printf("Processed %zu/%zu images in %.2fs with %zu worker(s), OCR busy %.1f%%\n", processed, image_files.size(),
+         seconds, engine.workers(), seconds > 0 ? 100.0 * busy / (seconds * workers) : 0.0);
+  return firstResult;
+}
+
+// Frame sequence mode: the images (in name order) are consecutive captures
+// of one screen, so each is only re-recognized where it differs from the
+// previous one
+void process_frames(const vector<string> &image_files, OcrBackend &backend, const OutputOptions &output) {
+  FrameOptions options;
+  options.profile = g_profile;
+  FrameSequenceOcr frames(backend, options);
+  auto start = chrono::steady_clock::now();
+  size_t processed = 0;
+  for (const auto &file_name : image_files) {
+    DecodedImage decoded;
+    if (!decode_image(file_name, decoded)) {
+      continue;
     }
-    allWordsPerLine.push_back(wordsThisLine);
-  }
-
-  // Log all recognized lines with their bounding boxes before grouping
-  #ifdef LOG
-  printf("\n=== All recognized text lines with bounding boxes ===\n");
-  for (size_t i = 0; i < allLines.size(); i++) {
-    printf("Line %zu: '%s'\n", i, allLines[i].content.c_str());
-    printf("  Bounding box: x=%.1f, y=%.1f, w=%.1f, h=%.1f\n", 
-           allLines[i].x, allLines[i].y, allLines[i].width, allLines[i].height);
-    printf("  Center: (%.1f, %.1f)\n", allLines[i].center_x, allLines[i].center_y);
-    printf("\n");
-  }
-  #endif
-
-  // Group lines by proximity
-  vector<vector<OcrLineData>> groupedLines = groupLinesByProximity(allLines, imageHeight);
-  
-  // Write grouped results to output file: lines in a group on one line, groups separated by newlines, all lowercase
-  for (size_t groupIdx = 0; groupIdx < groupedLines.size(); groupIdx++) {
-    if (groupIdx > 0) {
-      out << "\n\n"; // Newline between groups (speech bubbles)
+    OcrPage page;
+    if (!frames.recognize(decoded.img, page)) {
+      cerr << "OCR failed for " << decoded.output_file << endl;
+      continue;
     }
-    for (size_t lineIdx = 0; lineIdx < groupedLines[groupIdx].size(); lineIdx++) {
-      string lineContent = groupedLines[groupIdx][lineIdx].content;
-      // Convert to lowercase
-      // transform(lineContent.begin(), lineContent.end(), lineContent.begin(), ::tolower);
-      out << lineContent;
-      // Add space between lines in a group, except after the last line
-      if (lineIdx < groupedLines[groupIdx].size() - 1) {
-        out << " ";
-      }
+    if (decoded.originalHeight > 0) {
+      scalePage(page, decoded.scaleX, decoded.scaleY, decoded.originalHeight);
     }
+    write_results(decoded.image_file, decoded.output_file, page, groupLinesByProximity(page), output);
+    processed++;
   }
-  out.close();
-  printf("OCR results saved to %s\n", output_file.c_str());
-
-  // Write XML export next to the .txt file
-  try {
-    string xml_file = filesystem::path(output_file).replace_extension(".xml").string();
-    ofstream xout(xml_file);
-    if (xout.is_open()) {
-      xout << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
-      xout << "<ocrExport source=\"" << escapeXml(output_file) << "\">\n";
-
-      // Write lines with bounding boxes and their words (words only when verboseXml is true)
-      for (size_t i = 0; i < allLines.size(); i++) {
-        const auto &ln = allLines[i];
-  xout << "  <line id=\"" << i << "\" x=\"" << ln.x << "\" y=\"" << ln.y << "\" width=\"" << ln.width << "\" height=\"" << ln.height << "\"";
-  xout << " cornerCount=\"" << ln.cornerCount << "\"";
-  xout << " x1=\"" << ln.x1 << "\" y1=\"" << ln.y1 << "\"";
-  xout << " x2=\"" << ln.x2 << "\" y2=\"" << ln.y2 << "\"";
-  xout << " x3=\"" << ln.x3 << "\" y3=\"" << ln.y3 << "\"";
-  xout << ">\n";
-        xout << "    <text>" << escapeXml(ln.content) << "</text>\n";
-        if (verboseXml) {
-          // words (if available)
-          if (i < allWordsPerLine.size()) {
-            const auto &words = allWordsPerLine[i];
-            for (size_t w = 0; w < words.size(); w++) {
-              const auto &wd = words[w];
-              xout << "    <word id=\"" << w << "\" x=\"" << wd.x << "\" y=\"" << wd.y << "\" width=\"" << wd.width << "\" height=\"" << wd.height << "\">";
-              xout << escapeXml(wd.content) << "</word>\n";
-            }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  const FrameStats &stats = frames.stats();
+  printf("Processed %zu/%zu frames in %.2fs: %zu unchanged, %zu full, %zu region(s), %.1f%% of pixels recognized\n",
+         processed, image_files.size(), seconds, stats.unchanged, stats.fullFrames, stats.regions,
+         stats.frames ? 100.0 * stats.changedArea / stats.frames : 0.0);
+}
+
+// Measures decode + OCR throughput (no output files) for 1, 2, 4, ...
+// workers up to the pool size, to pick --workers for this machine
+void scale_report(const vector<string> &image_files, vector<unique_ptr<OcrBackend>> &backends) {
+  // Nothing is written; boxes only feed the text height estimate
+  g_profile = g_scaleOptions.targetTextHeight > 0 ? kExtractLines : kExtractText;
+  vector<size_t> counts;
+  for (size_t n = 1; n < backends.size(); n *= 2) counts.push_back(n);
+  counts.push_back(backends.size());
+
+  printf("%8s %10s %12s %8s\n", "workers", "seconds", "images/s", "speedup");
+  double baseline = 0;
+  for (size_t n : counts) {
+    PoolStats stats = runWorkerPool<size_t>(
+        image_files.size(), (int)n,
+        [&](int worker, size_t i) -> optional<size_t> {
+          DecodedImage decoded;
+          OcrPage page;
+          if (!decode_image(image_files[i], decoded) || !recognize(decoded, *backends[worker], page)) {
+            return nullopt;
           }
-        }
-        xout << "  </line>\n";
-      }
+          return page.lineCount();
+        },
+        [](size_t, size_t &) {});
+    double rate = stats.wallSeconds > 0 ? stats.processed / stats.wallSeconds : 0;
+    if (n == 1) baseline = rate;
+    printf("%8zu %10.2f %12.2f %7.2fx\n", n, stats.wallSeconds, rate, baseline > 0 ? rate / baseline : 0);
+  }
+}
 
-      xout << "</ocrExport>\n";
-      xout.close();
-      printf("XML export saved to %s\n", xml_file.c_str());
-    } else {
-      printf("Failed to open XML output: %s\n", xml_file.c_str());
+struct BackendOptions {
+  bool fake = false;
+  chrono::microseconds fakeLatency{0};
+  // Sleep per fake pipeline, standing in for the model load
+  chrono::milliseconds fakeLoad{0};
+  int64_t maxLines = 1000;
+  // Let oneocr load model parts on first use instead of in CreateOcrPipeline
+  bool delayLoad = false;
+  // --record: every result is also written here
+  CaptureWriter *record = nullptr;
+  // --replay: results come from here instead of an engine
+  const Capture *replay = nullptr;
+};
+
+// Creates one engine pipeline; the oneocr entry points are resolved once
+// and shared by every backend
+unique_ptr<OcrBackend> make_pipeline(const BackendOptions &options) {
+  if (options.fake) {
+    this_thread::sleep_for(options.fakeLoad);
+    return make_unique<FakeOcrBackend>(options.maxLines, options.fakeLatency);
+  }
+#ifdef _WIN32
+  static OneOcrApi api;
+  static bool loaded = api.load("oneocr.dll");
+  if (!loaded) {
+    return nullptr;
+  }
+  auto oneocr = make_unique<OneOcrBackend>(api);
+  if (!oneocr->init("oneocr.onemodel", options.delayLoad, options.maxLines)) {
+    return nullptr;
+  }
+  return oneocr;
+#else
+  return nullptr;
+#endif
+}
+
+// One pipeline, replayed or recorded as asked
+unique_ptr<OcrBackend> make_backend(const BackendOptions &options) {
+  unique_ptr<OcrBackend> backend =
+      options.replay ? make_unique<ReplayBackend>(*options.replay) : make_pipeline(options);
+  if (backend && options.record) {
+    backend = make_unique<RecordingBackend>(std::move(backend), *options.record);
+  }
+  return backend;
+}
+
+// One pipeline per worker; empty if any of them fails to load. With tiles
+// the pipelines are combined into one backend that runs the tiles of an
+// image on all of them.
+vector<unique_ptr<OcrBackend>> make_backends(const BackendOptions &options, int count, const TileOptions *tiles) {
+  vector<unique_ptr<OcrBackend>> backends;
+  for (int w = 0; w < count; w++) {
+    unique_ptr<OcrBackend> backend = make_backend(options);
+    if (!backend) {
+      return {};
     }
-  } catch (const std::exception &e) {
-    printf("Exception while writing XML: %s\n", e.what());
+    backends.push_back(std::move(backend));
+  }
+  if (tiles) {
+    unique_ptr<OcrBackend> tiled = make_unique<TiledBackend>(std::move(backends), *tiles);
+    backends.clear();
+    backends.push_back(std::move(tiled));
   }
+  return backends;
 }
 
-void process_image(const string &file_name, __int64 pipeline, __int64 opt, bool verboseXml) {
-  Mat img = imread(file_name, IMREAD_UNCHANGED);
-  if (img.empty()) {
-    cout << "Can't read image: " << file_name << endl;
-    return;
+// Creates the pipelines on a background thread and hands each to the engine
+// as soon as it is up, so enumeration and the first decodes overlap the
+// model load. Nothing is loaded before start(); limit() lowers the count
+// for pipelines not started yet. With tiles, the engine gets one tiled
+// backend once all of them are up.
+class ModelLoader {
+public:
+  ModelLoader(const BackendOptions &options, const TileOptions *tiles, OcrEngine &engine)
+      : options_(options), tiles_(tiles), engine_(engine) {}
+  ~ModelLoader() { finish(); }
+
+  void start(int count) {
+    if (thread_.joinable()) return;
+    total_ = count;
+    wanted_ = count;
+    thread_ = thread([this] { run(); });
   }
+  void limit(int count) { wanted_ = min(wanted_.load(), count); }
 
-  Mat img_rgba;
-  if (img.channels() == 3) {
-    cvtColor(img, img_rgba, COLOR_BGR2BGRA);
-  } else if (img.channels() == 4) {
-    img_rgba = img;
-  } else {
-    cout << "Image type not supported: " << file_name << endl;
-    return;
+  // Waits for the pipeline being loaded, if any; false if one failed
+  bool finish() {
+    limit(0);
+    if (thread_.joinable()) thread_.join();
+    return !failed_;
+  }
+  // When the first pipeline was up
+  chrono::steady_clock::time_point ready() const { return ready_; }
+
+private:
+  void run() {
+    trace::Span span("model.load");
+    vector<unique_ptr<OcrBackend>> pipelines;
+    // Tiles need all of them
+    for (int w = 0; w < (tiles_ ? total_ : wanted_.load()); w++) {
+      unique_ptr<OcrBackend> backend = make_backend(options_);
+      if (!backend) {
+        failed_ = true;
+        // Queued and later jobs come back cancelled
+        engine_.shutdown();
+        return;
+      }
+      if (w == 0) ready_ = chrono::steady_clock::now();
+      if (tiles_) {
+        pipelines.push_back(std::move(backend));
+      } else {
+        engine_.addBackend(std::move(backend));
+      }
+    }
+    if (tiles_) {
+      engine_.addBackend(make_unique<TiledBackend>(std::move(pipelines), *tiles_));
+    }
   }
 
-  int rows = img_rgba.rows;
-  int cols = img_rgba.cols;
-  size_t step = img_rgba.step;
+  BackendOptions options_;
+  const TileOptions *tiles_;
+  OcrEngine &engine_;
+  thread thread_;
+  int total_ = 0;
+  atomic<int> wanted_{0};
+  atomic<bool> failed_{false};
+  chrono::steady_clock::time_point ready_;
+};
+
+// Keeps the pipelines loaded and answers jobs from local clients until killed
+int serve(const string &socket_path, vector<unique_ptr<OcrBackend>> backends) {
+  FileDecoder decoder = [](const string &path, Img &img, string &error) -> shared_ptr<void> {
+    auto decoded = make_shared<DecodedImage>();
+    if (!decode_image(path, *decoded)) {
+      error = "can't decode image: " + path;
+      return nullptr;
+    }
+    img = decoded->img;
+    return decoded;
+  };
+  // Jobs get boxes in the pixels they sent, so no downscaling here
+  g_scaleOptions = ScaleOptions();
+  size_t workers = backends.size();
+  OcrServer server(std::move(backends), decoder);
+  if (!server.listen(socket_path)) {
+    return -1;
+  }
+  printf("Serving on %s with %zu worker(s)\n", socket_path.c_str(), workers);
+  server.serve();
+  return 0;
+}
 
-  Img ig = {.t = 3,
-            .col = cols,
-            .row = rows,
-            ._unk = 0,
-            .step = (__int64)step,
-            .data_ptr = (__int64)reinterpret_cast<char *>(img_rgba.data)};
+// Answers frames from a capture process's shared-memory ring until it closes it
+int serve_shm(const string &name, vector<unique_ptr<OcrBackend>> backends) {
+  ShmConsumer consumer;
+  printf("Waiting for shared memory ring %s...\n", name.c_str());
+  if (!consumer.waitFor(name, chrono::minutes(10))) {
+    printf("No producer created %s\n", name.c_str());
+    return -1;
+  }
+  printf("Attached to %s (%u slots) with %zu worker(s)\n", name.c_str(), consumer.slots(), backends.size());
+  consumer.run(backends);
+  if (consumer.producerLost()) printf("Producer of %s exited without closing it\n", name.c_str());
+  printf("Ring closed: %llu frame(s), %llu failed\n", (unsigned long long)consumer.stats().frames,
+         (unsigned long long)consumer.stats().failed);
+  return 0;
+}
+
+// Looks a word or phrase up in an archive written with --archive
+int query(const string &archive_path, const string &phrase, size_t limit) {
+  auto start = chrono::steady_clock::now();
+  ArchiveReader reader;
+  if (!reader.open(archive_path)) {
+    return -1;
+  }
+  vector<ArchiveHit> hits = reader.find(phrase, limit);
+  double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  for (const ArchiveHit &hit : hits) {
+    printf("%.*s\tline %u\t%g,%g %gx%g\t%s\n", (int)hit.source.size(), hit.source.data(), hit.line, hit.x, hit.y,
+           hit.width, hit.height, hit.text.c_str());
+  }
+  printf("%zu hit(s) in %.2f ms (%zu page(s), %zu segment(s))\n", hits.size(), ms, reader.pages(),
+         reader.segments());
+  return 0;
+}
 
-  string output_file = filesystem::path(file_name).replace_extension(".txt").string();
-  ocr(ig, output_file, pipeline, opt, verboseXml);
+void print_usage() {
+  printf("Usage: ocr.exe <image_path_or_folder> [--verbose-xml] [--format xml,jsonl,bin] [--fake-backend]\n"
+         "       [--decode-threads N (0 = serial)] [--max-decoded N]\n"
+         "       [--workers N] [--scale-report] [--fake-latency-ms N] [--cache] [--cache-near N]\n"
+         "       [--recursive] [--ext png,jpg,...] [--incremental] [--trace trace.json] [--log]\n"
+         "       [--tile] [--tile-size N] [--tile-overlap N] [--max-side N] [--text-height N] [--frames]\n"
+         "       [--archive <file>] [--atlas] [--atlas-max-side N] [--delay-load] [--fake-load-ms N]\n"
+         "       [--record <capture>] [--replay <capture>]\n"
+         "       ocr.exe --serve <socket_path> [--workers N] [--fake-backend]\n"
+         "       ocr.exe --shm <ring_name> [--workers N] [--fake-backend]\n"
+         "       ocr.exe --query <archive> <word_or_phrase> [--limit N]\n");
 }
 
 int main(int argc, char *argv[]) {
+  auto launch = chrono::steady_clock::now();
   if (argc < 2) {
-    printf("Usage: ocr.exe <image_path_or_folder> [--verbos-xml]\n");
+    print_usage();
     return 0;
   }
 
   string input_path;
-  bool verboseXml = false;
-  // Parse arguments: accept one path and optional --verbos-xml flag
+  OutputOptions output;
+  BatchOptions batchOptions;
+  batchOptions.decodeThreads = (int)clamp(thread::hardware_concurrency() / 2, 1u, 4u);
+  int workers = 1;
+  bool scaleReport = false;
+  string socket_path;
+  string shm_name;
+  string archive_path;
+  string query_path;
+  string record_path;
+  string replay_path;
+  size_t queryLimit = 100;
+  bool useCache = false;
+  bool incremental = false;
+  string trace_file;
+  bool tiled = false;
+  bool frames = false;
+  TileOptions tileOptions;
+  AtlasOptions atlasOptions;
+  ScanOptions scanOptions;
+  int cacheNearDistance = -1;
+  BackendOptions backendOptions;
+#ifndef _WIN32
+  backendOptions.fake = true; // oneocr.dll is Windows only
+#endif
+  // Parse arguments: accept one path and optional flags
   for (int i = 1; i < argc; ++i) {
     string a = argv[i];
     if (a == "--verbose-xml") {
-      verboseXml = true;
+      output.verboseXml = true;
+    } else if (a == "--format" && i + 1 < argc) {
+      if (!parseOutputFormats(argv[++i], output.formats)) {
+        print_usage();
+        return -1;
+      }
+    } else if (a == "--fake-backend") {
+      backendOptions.fake = true;
+    } else if (a == "--fake-load-ms" && i + 1 < argc) {
+      backendOptions.fakeLoad = chrono::milliseconds(atoi(argv[++i]));
+    } else if (a == "--delay-load") {
+      backendOptions.delayLoad = true;
+    } else if (a == "--record" && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (a == "--replay" && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (a == "--fake-latency-ms" && i + 1 < argc) {
+      backendOptions.fakeLatency = chrono::milliseconds(atoi(argv[++i]));
+    } else if (a == "--workers" && i + 1 < argc) {
+      workers = max(atoi(argv[++i]), 1);
+    } else if (a == "--serve" && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (a == "--shm" && i + 1 < argc) {
+      shm_name = argv[++i];
+    } else if (a == "--archive" && i + 1 < argc) {
+      archive_path = argv[++i];
+    } else if (a == "--query" && i + 1 < argc) {
+      query_path = argv[++i];
+    } else if (a == "--limit" && i + 1 < argc) {
+      queryLimit = (size_t)max(atoi(argv[++i]), 1);
+    } else if (a == "--trace" && i + 1 < argc) {
+      trace_file = argv[++i];
+      trace::g_enabled = true;
+    } else if (a == "--tile") {
+      tiled = true;
+    } else if (a == "--tile-size" && i + 1 < argc) {
+      tiled = true;
+      tileOptions.tileSize = max(atoi(argv[++i]), 256);
+    } else if (a == "--tile-overlap" && i + 1 < argc) {
+      tileOptions.overlap = max(atoi(argv[++i]), 0);
+    } else if (a == "--max-side" && i + 1 < argc) {
+      g_scaleOptions.maxSide = max(atoi(argv[++i]), 0);
+    } else if (a == "--text-height" && i + 1 < argc) {
+      g_scaleOptions.targetTextHeight = (float)max(atof(argv[++i]), 0.0);
+    } else if (a == "--atlas") {
+      atlasOptions.maxImages = 32;
+    } else if (a == "--atlas-max-side" && i + 1 < argc) {
+      atlasOptions.maxImages = 32;
+      atlasOptions.maxItemSide = clamp(atoi(argv[++i]), 16, 1024);
+    } else if (a == "--frames") {
+      frames = true;
+    } else if (a == "--log") {
+      trace::g_log = true;
+    } else if (a == "--recursive" || a == "-r") {
+      scanOptions.recursive = true;
+    } else if (a == "--ext" && i + 1 < argc) {
+      if (!parseExtensions(argv[++i], scanOptions.extensions)) {
+        print_usage();
+        return -1;
+      }
+    } else if (a == "--incremental") {
+      incremental = true;
+    } else if (a == "--cache") {
+      useCache = true;
+    } else if (a == "--cache-near" && i + 1 < argc) {
+      useCache = true;
+      cacheNearDistance = clamp(atoi(argv[++i]), 0, 64);
+    } else if (a == "--scale-report") {
+      scaleReport = true;
+    } else if (a == "--decode-threads" && i + 1 < argc) {
+      batchOptions.decodeThreads = atoi(argv[++i]);
+    } else if (a == "--max-decoded" && i + 1 < argc) {
+      batchOptions.maxDecoded = (size_t)max(atoi(argv[++i]), 1);
     } else if (input_path.empty()) {
       input_path = a;
     } else {
@@ -523,62 +653,208 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (!query_path.empty()) {
+    if (input_path.empty()) {
+      print_usage();
+      return -1;
+    }
+    return query(query_path, input_path, queryLimit);
+  }
+
+  // Declared before any backend, which may point into them
+  CaptureWriter capture;
+  Capture replay;
+  if (!replay_path.empty()) {
+    if (!replay.load(replay_path)) {
+      return -1;
+    }
+    backendOptions.replay = &replay;
+    printf("Replaying %zu result(s) from %s\n", replay.results().size(), replay_path.c_str());
+  }
+  if (!record_path.empty()) {
+    if (!capture.open(record_path)) {
+      return -1;
+    }
+    backendOptions.record = &capture;
+  }
+  if (!socket_path.empty()) {
+    vector<unique_ptr<OcrBackend>> backends = make_backends(backendOptions, workers, tiled ? &tileOptions : nullptr);
+    if (backends.empty()) {
+      return -1;
+    }
+    return serve(socket_path, std::move(backends));
+  }
+  if (!shm_name.empty()) {
+    vector<unique_ptr<OcrBackend>> backends = make_backends(backendOptions, workers, tiled ? &tileOptions : nullptr);
+    if (backends.empty()) {
+      return -1;
+    }
+    return serve_shm(shm_name, std::move(backends));
+  }
+
   if (input_path.empty()) {
-    printf("Usage: ocr.exe <image_path_or_folder> [--verbos-xml]\n");
+    print_usage();
     return 0;
   }
 
+  // Words are only read for the word-level outputs; cached pages keep them
+  // for later runs that may need them
+  g_profile = (output.verboseXml && output.formats != 0) || useCache || !archive_path.empty() ? kExtractWords
+                                                                                             : kExtractLines;
+  tileOptions.words = g_profile == kExtractWords;
+  if (backendOptions.fake && !backendOptions.replay) {
+    printf("Using fake OCR backend\n");
+  }
+
+  // Images and folders go through the engine. Its pipelines load in the
+  // background from the first image found, while the rest of the folder is
+  // scanned and the first images decoded; with --incremental only once some
+  // image needs work. Frames and the scale report load up front.
+  bool engineMode = !scaleReport && !frames;
+  ResultCache cache;
+  EngineOptions engineOptions;
+  engineOptions.maxInFlight = (tiled ? 1 : workers) + batchOptions.maxDecoded;
+  engineOptions.profile = g_profile;
+  engineOptions.text = false;
+  if (atlasOptions.enabled()) {
+    // Room for a full atlas to queue up behind the one being recognized
+    engineOptions.atlas = atlasOptions;
+    engineOptions.maxInFlight += (tiled ? 1 : workers) * atlasOptions.maxImages;
+  }
+  if (engineMode && useCache) {
+    // The index lives next to the outputs
+    filesystem::path dir = filesystem::is_directory(input_path) ? filesystem::path(input_path)
+                                                                 : filesystem::path(input_path).parent_path();
+    string cache_file = (dir / ".ocrcache").string();
+    // Pages from one backend are never served for another
+    const char *backendName = backendOptions.replay ? "replay" : backendOptions.fake ? "fake" : "oneocr";
+    if (cache.open(cache_file, cacheNearDistance, backendName)) {
+      engineOptions.cache = &cache;
+      printf("Result cache %s (%zu entries)\n", cache_file.c_str(), cache.size());
+    }
+  }
+  OcrEngine engine({}, engineOptions);
+  ModelLoader loader(backendOptions, tiled ? &tileOptions : nullptr, engine);
+  auto startLoading = [&] {
+    if (engineMode) loader.start(workers);
+  };
+
   vector<string> image_files;
 
+  Manifest manifest;
+
   if (filesystem::is_directory(input_path)) {
-    for (const auto &entry : filesystem::directory_iterator(input_path)) {
-      if (entry.is_regular_file() && 
-          (entry.path().extension() == ".png" || entry.path().extension() == ".jpg")) {
-        image_files.push_back(entry.path().string());
+    auto scan_start = chrono::steady_clock::now();
+    ScanResult scan = scanImages(input_path, scanOptions, incremental ? function<void()>() : startLoading);
+    double scan_seconds = chrono::duration<double>(chrono::steady_clock::now() - scan_start).count();
+    uint32_t state = archive_path.empty() ? output.formats | (output.verboseXml ? 0x100u : 0u) : 0x200u;
+    if (incremental && manifest.open(input_path, state)) {
+      size_t upToDate = 0;
+      for (const ScannedFile &file : scan.images) {
+        if (manifest.upToDate(file, scan, archive_path.empty())) {
+          upToDate++;
+        } else {
+          manifest.plan(file);
+          image_files.push_back(file.path);
+        }
       }
+      g_manifest = &manifest;
+      printf("Found %zu image(s) in %.2fs, %zu up to date\n", scan.images.size(), scan_seconds, upToDate);
+    } else {
+      for (const ScannedFile &file : scan.images) image_files.push_back(file.path);
     }
   } else if (filesystem::is_regular_file(input_path)) {
+    startLoading();
     image_files.push_back(input_path);
   } else {
     cout << "Invalid path: " << input_path << endl;
     return -1;
   }
+  if (image_files.empty()) {
+    // Nothing to recognize, so the model is never loaded
+    printf("No images to process\n");
+    if (g_manifest) {
+      g_manifest->commit();
+      g_manifest = nullptr;
+    }
+    return 0;
+  }
 
-  HINSTANCE hDLL = LoadLibraryA("oneocr.dll");
-  if (hDLL == NULL) {
-    cerr << "Failed to load DLL: " << GetLastError() << endl;
-    return -1;
+  // Only as many pipelines as there are images to keep busy (tiles of one image can use them all);
+  // frames depend on their predecessor, so they run on one
+  if (frames) {
+    workers = 1;
+    tiled = false;
+  } else if (!scaleReport && !tiled) {
+    workers = (int)min<size_t>(workers, image_files.size());
   }
+  loader.limit(workers);
+  startLoading();
 
-  CreateOcrInitOptions_t CreateOcrInitOptions =
-      (CreateOcrInitOptions_t)GetProcAddress(hDLL, "CreateOcrInitOptions");
-  CreateOcrPipeline_t CreateOcrPipeline =
-      (CreateOcrPipeline_t)GetProcAddress(hDLL, "CreateOcrPipeline");
-  CreateOcrProcessOptions_t CreateOcrProcessOptions =
-      (CreateOcrProcessOptions_t)GetProcAddress(hDLL, "CreateOcrProcessOptions");
-  OcrInitOptionsSetUseModelDelayLoad_t OcrInitOptionsSetUseModelDelayLoad =
-      (OcrInitOptionsSetUseModelDelayLoad_t)GetProcAddress(hDLL, "OcrInitOptionsSetUseModelDelayLoad");
-  OcrProcessOptionsSetMaxRecognitionLineCount_t OcrProcessOptionsSetMaxRecognitionLineCount =
-      (OcrProcessOptionsSetMaxRecognitionLineCount_t)GetProcAddress(hDLL, "OcrProcessOptionsSetMaxRecognitionLineCount");
-
-  __int64 ctx = 0, pipeline = 0, opt = 0;
-  __int64 res = CreateOcrInitOptions(&ctx);
-  assert(res == 0);
-  res = OcrInitOptionsSetUseModelDelayLoad(ctx, 0);
-  assert(res == 0);
-
-  const char *key = {"kj)TGtrK>f]b[Piow.gU+nC@s\"\"\"\"\"\"4"};
-  res = CreateOcrPipeline((__int64)"oneocr.onemodel", (__int64)key, ctx, &pipeline);
-  assert(res == 0);
-  printf("OCR model loaded...\n");
-
-  res = CreateOcrProcessOptions(&opt);
-  assert(res == 0);
-  res = OcrProcessOptionsSetMaxRecognitionLineCount(opt, 1000);
-  assert(res == 0);
+  ArchiveWriter archive;
+  if (!archive_path.empty()) {
+    if (!archive.open(archive_path)) {
+      return -1;
+    }
+    archive.onCommit = [](const string &source) {
+      if (g_manifest) g_manifest->markDone(outputFileFor(source));
+    };
+    g_archive = &archive;
+  }
 
-  for (const auto &file_name : image_files) {
-    process_image(file_name, pipeline, opt, verboseXml);
+  if (engineMode) {
+    chrono::steady_clock::time_point firstResult =
+        process_images(image_files, engine, output, batchOptions, tiled ? 1 : workers);
+    if (!loader.finish()) {
+      return -1;
+    }
+    engine.shutdown();
+    if (firstResult != chrono::steady_clock::time_point()) {
+      auto ms = [&](chrono::steady_clock::time_point t) {
+        return chrono::duration<double, milli>(t - launch).count();
+      };
+      printf("Cold start: model ready after %.0f ms, first result after %.0f ms\n", ms(loader.ready()),
+             ms(firstResult));
+    }
+    if (engineOptions.cache) {
+      printf("Cache: %zu hit(s), %zu near hit(s), %zu miss(es)\n", cache.hits(), cache.nearHits(), cache.misses());
+    }
+  } else {
+    vector<unique_ptr<OcrBackend>> backends =
+        make_backends(backendOptions, workers, tiled ? &tileOptions : nullptr);
+    if (backends.empty()) {
+      return -1;
+    }
+    if (scaleReport) {
+      scale_report(image_files, backends);
+    } else {
+      process_frames(image_files, *backends[0], output);
+    }
+  }
+
+  if (backendOptions.record) {
+    printf("Recorded %zu result(s) to %s\n", capture.results(), record_path.c_str());
+  }
+  if (replay.misses()) {
+    printf("Replay: %zu image(s) not in the capture\n", replay.misses());
+  }
+  if (g_archive) {
+    if (archive.close()) {
+      printf("Archived %zu page(s) to %s\n", archive.pages(), archive_path.c_str());
+    }
+    g_archive = nullptr;
+  }
+  if (g_manifest) {
+    g_manifest->commit();
+    g_manifest = nullptr;
+  }
+  if (!trace_file.empty()) {
+    trace::printSummary();
+    if (trace::writeChromeTrace(trace_file)) {
+      printf("Trace saved to %s\n", trace_file.c_str());
+    } else {
+      printf("Failed to write trace: %s\n", trace_file.c_str());
+    }
   }
 
   return 0;
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ocr_types.h"
+#include "trace.h"
+
+// Typed view of the oneocr API. One instance owns one pipeline and its
+// process options; the entry points behind it are resolved once at startup.
+// Handles are opaque and only valid until releaseResult() on their result.
+class OcrBackend {
+public:
+  virtual ~OcrBackend() = default;
+
+  // Runs recognition on a BGRA image, returns the result handle or 0
+  virtual int64_t run(const Img &img) = 0;
+  virtual void releaseResult(int64_t instance) = 0;
+
+  virtual int64_t lineCount(int64_t instance) = 0;
+  virtual int64_t line(int64_t instance, int64_t index) = 0;
+  virtual const char *lineContent(int64_t line) = 0;
+  // Polygon [x1, y1, x2, y2, x3, y3, x4, y4] or nullptr
+  virtual const float *lineBoundingBox(int64_t line) = 0;
+
+  virtual int64_t wordCount(int64_t line) = 0;
+  virtual int64_t word(int64_t line, int64_t index) = 0;
+  virtual const char *wordContent(int64_t word) = 0;
+  // Axis-aligned [width, height, x, y] (4 floats, unlike the line polygon)
+  // or nullptr
+  virtual const float *wordBoundingBox(int64_t word) = 0;
+
+  // True if the line and word accessors may be called from several threads
+  // at once for the same result, which lets extractPage split large pages
+  virtual bool concurrentReads() const { return false; }
+};
+
+// How much of a result extractPage reads; the smallest one covering the
+// enabled outputs is used. Each level adds backend calls to the one before.
+enum ExtractProfile : int {
+  kExtractText = 0,  // line text only; boxes and centers stay zero
+  kExtractLines = 1, // + line boxes, centers and corners (grouping, line outputs)
+  kExtractWords = 2, // + every word and its box
+};
+
+// Pages with this many lines are extracted on several threads, one run of
+// lines per thread, if the backend allows concurrent reads. The extra
+// threads only use cores no pipeline worker holds (see CoreReservation).
+constexpr int64_t kParallelExtractLines = 512;
+constexpr int64_t kExtractLinesPerThread = 256;
+
+namespace extract_detail {
+
+// Cores of the machine not held by pipeline workers or extraction helpers;
+// negative when there are more workers than cores
+inline std::atomic<int64_t> &freeCores() {
+  static std::atomic<int64_t> cores{(int64_t)std::thread::hardware_concurrency()};
+  return cores;
+}
+
+// Takes up to want free cores; returns how many it got
+inline int64_t takeCores(int64_t want) {
+  std::atomic<int64_t> &cores = freeCores();
+  int64_t free = cores.load(std::memory_order_relaxed), take;
+  do {
+    take = std::min(want, free);
+    if (take <= 0) return 0;
+  } while (!cores.compare_exchange_weak(free, free - take, std::memory_order_relaxed));
+  return take;
+}
+
+inline void extractLine(OcrBackend &backend, int64_t line, int64_t lci, ExtractProfile profile, OcrPage &page) {
+  const char *lcs = backend.lineContent(line);
+
+  float box[4] = {0, 0, 0, 0}; // x, y, width, height
+  float corners[6] = {0, 0, 0, 0, 0, 0};
+  int32_t cornerCount = 0;
+  float centerX = 0, centerY = 0;
+
+  // Get bounding box for this line
+  const float *bbox = profile >= kExtractLines ? backend.lineBoundingBox(line) : nullptr;
+  if (bbox) {
+    // Polygon corners as [TLx, TLy, TRx, TRy, BRx, BRy, BLx, BLy]; the
+    // API gives no count, so read 8 values and treat a (0,0) fourth
+    // point as unused.
+    float coords[8];
+    for (int k = 0; k < 8; k++) {
+      coords[k] = bbox[k];
+    }
+
+    // Determine min/max X/Y across available points
+    float minX = coords[0];
+    float minY = coords[1];
+    float maxX = coords[0];
+    float maxY = coords[1];
+    for (int p = 0; p < 4; p++) {
+      float px = coords[p*2];
+      float py = coords[p*2 + 1];
+      // If both values are zero and p >= 3 (unused slots), break
+      if (p >= 3 && px == 0.0f && py == 0.0f) break;
+      if (px < minX) minX = px;
+      if (py < minY) minY = py;
+      if (px > maxX) maxX = px;
+      if (py > maxY) maxY = py;
+    }
+
+    // Keep the first three points that are present (either coord != 0)
+    for (int cp = 0; cp < 3; cp++) {
+      float px = coords[cp*2];
+      float py = coords[cp*2 + 1];
+      if (px != 0.0f || py != 0.0f) {
+        cornerCount++;
+        corners[cp*2] = px;
+        corners[cp*2 + 1] = py;
+      }
+    }
+
+    // Axis-aligned bounding box, guarded against negative sizes
+    box[0] = minX;
+    box[1] = minY;
+    box[2] = std::max(maxX - minX, 0.0f);
+    box[3] = std::max(maxY - minY, 0.0f);
+    centerX = box[0] + box[2] / 2.0f;
+    centerY = box[1] + box[3] / 2.0f;
+    trace::log("Line %lld: Got bounding box from API: x=%.1f, y=%.1f, w=%.1f, h=%.1f\n",
+               (long long)lci, box[0], box[1], box[2], box[3]);
+  } else if (profile >= kExtractLines) {
+    // Fallback: use line index as approximate position
+    box[0] = 0;
+    box[1] = (float)((int)lci * 20); // Approximate line height
+    box[2] = 100;
+    box[3] = 20;
+    centerX = 50;
+    centerY = box[1] + 10;
+    trace::log("Line %lld: No bounding box available, using fallback: x=%.1f, y=%.1f, w=%.1f, h=%.1f\n",
+               (long long)lci, box[0], box[1], box[2], box[3]);
+  }
+
+  page.addLine(lcs ? std::string_view(lcs) : std::string_view(), box, centerX, centerY, cornerCount, corners);
+
+  if (profile < kExtractWords) {
+    return;
+  }
+  int64_t lr = backend.wordCount(line);
+  for (int64_t j = 0; j < lr; j++) {
+    int64_t word = backend.word(line, j);
+    const char *wcs = backend.wordContent(word);
+    const float *wb = backend.wordBoundingBox(word);
+    if (wcs) {
+      // The word box is reported as width, height, x, y
+      const float wbox[4] = {wb ? wb[2] : 0, wb ? wb[3] : 0, wb ? wb[0] : 0, wb ? wb[1] : 0};
+      page.addWord(wcs, wbox);
+    }
+  }
+}
+
+inline void extractLines(OcrBackend &backend, int64_t instance, int64_t first, int64_t last, ExtractProfile profile,
+                         OcrPage &page) {
+  for (int64_t lci = first; lci < last; lci++) {
+    int64_t line = backend.line(instance, lci);
+    if (line) {
+      extractLine(backend, line, lci, profile, page);
+    }
+  }
+}
+
+} // namespace extract_detail
+
+// Holds cores for pipeline worker threads while alive, so extractPage only
+// adds threads on the cores left over. Each pool of workers (engine, socket
+// server, ring consumer) reserves one per pipeline.
+class CoreReservation {
+public:
+  explicit CoreReservation(int64_t cores = 0) { add(cores); }
+  ~CoreReservation() { extract_detail::freeCores().fetch_add(held_, std::memory_order_relaxed); }
+  CoreReservation(const CoreReservation &) = delete;
+  CoreReservation &operator=(const CoreReservation &) = delete;
+
+  void add(int64_t cores) {
+    extract_detail::freeCores().fetch_sub(cores, std::memory_order_relaxed);
+    held_ += cores;
+  }
+
+private:
+  int64_t held_ = 0;
+};
+
+// Reads lines, boxes and words of a result into page, as far as profile asks
+inline void extractPage(OcrBackend &backend, int64_t instance, OcrPage &page,
+                        ExtractProfile profile = kExtractWords) {
+  static const char *const spanNames[] = {"extract.text", "extract.lines", "extract.words"};
+  trace::Span span(spanNames[profile]);
+  int64_t lc = backend.lineCount(instance);
+  span.setArg(lc);
+  trace::log("Recognize %lld lines\n", (long long)lc);
+
+  page.clear();
+  page.reserve(lc);
+
+  int64_t helpers = 0;
+  if (lc >= kParallelExtractLines && backend.concurrentReads() && !trace::logging()) {
+    helpers = extract_detail::takeCores(lc / kExtractLinesPerThread - 1);
+  }
+  int64_t threads = helpers + 1;
+  if (helpers == 0) {
+    extract_detail::extractLines(backend, instance, 0, lc, profile, page);
+  } else {
+    // Every thread fills its own part, appended in line order; the parts
+    // are kept by this thread so their buffers are reused
+    thread_local std::vector<OcrPage> cached;
+    std::vector<OcrPage> &parts = cached; // not the workers' own thread_local
+    parts.resize((size_t)threads);
+    auto work = [&](int64_t t) {
+      parts[t].clear();
+      parts[t].reserve(lc / threads + 1);
+      extract_detail::extractLines(backend, instance, lc * t / threads, lc * (t + 1) / threads, profile, parts[t]);
+    };
+    std::vector<std::thread> pool;
+    for (int64_t t = 1; t < threads; t++) pool.emplace_back(work, t);
+    work(0);
+    for (auto &t : pool) t.join();
+    extract_detail::freeCores().fetch_add(helpers, std::memory_order_relaxed);
+    for (const OcrPage &part : parts) page.append(part);
+  }
+
+  // Log all recognized lines with their bounding boxes before grouping
+  if (!trace::logging()) {
+    return;
+  }
+  printf("\n=== All recognized text lines with bounding boxes ===\n");
+  for (size_t i = 0; i < page.lineCount(); i++) {
+    std::string_view content = page.lineContent(i);
+    printf("Line %zu: '%.*s'\n", i, (int)content.size(), content.data());
+    printf("  Bounding box: x=%.1f, y=%.1f, w=%.1f, h=%.1f\n",
+           page.x[i], page.y[i], page.width[i], page.height[i]);
+    printf("  Center: (%.1f, %.1f)\n", page.centerX[i], page.centerY[i]);
+    printf("\n");
+  }
+}
+
+// Runs the backend on img and extracts the result into page
+inline bool recognizePage(OcrBackend &backend, const Img &img, OcrPage &page,
+                          ExtractProfile profile = kExtractWords) {
+  // Store image height for maxDistance calculation
+  page.imageHeight = img.row;
+  int64_t instance;
+  {
+    trace::Span span("ocr");
+    instance = backend.run(img);
+  }
+  if (!instance) {
+    return false;
+  }
+  extractPage(backend, instance, page, profile);
+  backend.releaseResult(instance);
+  return true;
+}
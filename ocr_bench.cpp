@@ -0,0 +1,369 @@
+// Benchmarks for the CPU side of the pipeline: box extraction, grouping,
+// escaping and the serializers, on synthetic pages. Needs neither OpenCV nor
+// oneocr.dll. Results go to stdout as a table or, with --json, one JSON
+// object per benchmark (diff two runs to spot regressions). With --replay the
+// pages of a capture recorded by `ocr --record` are used instead, and a
+// digest of their outputs is printed for byte-identical checks.
+//
+//   ./ocr_bench [--json] [--filter name] [--min-time-ms N] [--replay capture]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "grouping.h"
+#include "ocr_backend.h"
+#include "ocr_output.h"
+#include "ocr_types.h"
+#include "serializer.h"
+
+using namespace std;
+
+// Every allocation in the process goes through here, so a benchmark can
+// report what one iteration allocates. Kept out of line so GCC does not see
+// malloc/free through the inlined calls and flag them as mismatched.
+static atomic<uint64_t> g_allocBytes{0}, g_allocCount{0};
+
+[[gnu::noinline]] void *operator new(size_t size) {
+  g_allocBytes.fetch_add(size, memory_order_relaxed);
+  g_allocCount.fetch_add(1, memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept { free(p); }
+
+// Serves a prepared page through the backend interface, so extraction is
+// measured without generating the layout each time
+class SyntheticBackend : public OcrBackend {
+public:
+  struct Word {
+    string text;
+    float box[4]; // width, height, x, y like the engine
+  };
+  struct Line {
+    string text;
+    float box[8];
+    vector<Word> words;
+  };
+  vector<Line> lines;
+  int imageHeight = 0;
+
+  int64_t run(const Img &) override { return 1; }
+  void releaseResult(int64_t) override {}
+  int64_t lineCount(int64_t) override { return (int64_t)lines.size(); }
+  int64_t line(int64_t, int64_t index) override { return reinterpret_cast<int64_t>(&lines[index]); }
+  const char *lineContent(int64_t line) override { return reinterpret_cast<Line *>(line)->text.c_str(); }
+  const float *lineBoundingBox(int64_t line) override { return reinterpret_cast<Line *>(line)->box; }
+  int64_t wordCount(int64_t line) override { return (int64_t)reinterpret_cast<Line *>(line)->words.size(); }
+  int64_t word(int64_t line, int64_t index) override {
+    return reinterpret_cast<int64_t>(&reinterpret_cast<Line *>(line)->words[index]);
+  }
+  const char *wordContent(int64_t word) override { return reinterpret_cast<Word *>(word)->text.c_str(); }
+  const float *wordBoundingBox(int64_t word) override { return reinterpret_cast<Word *>(word)->box; }
+  bool concurrentReads() const override { return true; }
+};
+
+// Rotated rectangle as the engine reports it: TL, TR, BR, BL
+static void setBox(float *box, float x, float y, float w, float h, float angle) {
+  float c = cos(angle), s = sin(angle);
+  float cx = x + w / 2, cy = y + h / 2;
+  const float local[8] = {-w / 2, -h / 2, w / 2, -h / 2, w / 2, h / 2, -w / 2, h / 2};
+  for (int k = 0; k < 4; k++) {
+    box[2 * k] = cx + local[2 * k] * c - local[2 * k + 1] * s;
+    box[2 * k + 1] = cy + local[2 * k] * s + local[2 * k + 1] * c;
+  }
+}
+
+// Word box as the engine reports it: the axis-aligned bounds of the rotated
+// rectangle as width, height, x, y
+static void setWordBox(float *box, float x, float y, float w, float h, float angle) {
+  float corners[8];
+  setBox(corners, x, y, w, h, angle);
+  float x0 = corners[0], x1 = corners[0], y0 = corners[1], y1 = corners[1];
+  for (int k = 1; k < 4; k++) {
+    x0 = min(x0, corners[2 * k]);
+    x1 = max(x1, corners[2 * k]);
+    y0 = min(y0, corners[2 * k + 1]);
+    y1 = max(y1, corners[2 * k + 1]);
+  }
+  const float wbox[4] = {x1 - x0, y1 - y0, x0, y0};
+  copy(wbox, wbox + 4, box);
+}
+
+// Random words of 1-10 letters, with the occasional character that needs escaping
+static string randomWord(mt19937_64 &rng) {
+  static const char special[] = "&<>\"'";
+  string word;
+  int length = 1 + (int)(rng() % 10);
+  for (int i = 0; i < length; i++) word += (char)('a' + rng() % 26);
+  if (rng() % 40 == 0) word += special[rng() % 5];
+  return word;
+}
+
+static void addLine(SyntheticBackend &page, mt19937_64 &rng, float x, float y, float charWidth, float lineHeight,
+                    int words, float angle) {
+  SyntheticBackend::Line &line = page.lines.emplace_back();
+  float cursor = x;
+  for (int w = 0; w < words; w++) {
+    SyntheticBackend::Word &word = line.words.emplace_back();
+    word.text = randomWord(rng);
+    float width = charWidth * (float)word.text.size();
+    setWordBox(word.box, cursor, y, width, lineHeight, angle);
+    if (w) line.text += ' ';
+    line.text += word.text;
+    cursor += width + charWidth;
+  }
+  setBox(line.box, x, y, cursor - charWidth - x, lineHeight, angle);
+}
+
+// Manga page: a dozen bubbles of 2-5 short, slightly tilted lines
+static SyntheticBackend comicPage() {
+  SyntheticBackend page;
+  page.imageHeight = 2400;
+  mt19937_64 rng(1);
+  for (int bubble = 0; bubble < 12; bubble++) {
+    float bx = 100.0f + (bubble % 3) * 520 + rng() % 120, by = 100.0f + (bubble / 3) * 560 + rng() % 120;
+    float angle = ((int)(rng() % 7) - 3) * 0.01f;
+    int lines = 2 + (int)(rng() % 4);
+    for (int l = 0; l < lines; l++) addLine(page, rng, bx, by + l * 40, 14, 32, 1 + (int)(rng() % 3), angle);
+  }
+  return page;
+}
+
+// Book page: one column of 48 full lines
+static SyntheticBackend bookPage() {
+  SyntheticBackend page;
+  page.imageHeight = 2400;
+  mt19937_64 rng(2);
+  for (int l = 0; l < 48; l++) addLine(page, rng, 150, 150.0f + l * 44, 12, 30, 10 + (int)(rng() % 5), 0);
+  return page;
+}
+
+// Form: 1000 label/value lines in four columns at A4 / 300 dpi
+static SyntheticBackend formPage() {
+  SyntheticBackend page;
+  page.imageHeight = 3508;
+  mt19937_64 rng(3);
+  for (int l = 0; l < 1000; l++) {
+    addLine(page, rng, 80.0f + (l / 250) * 600, 60.0f + (l % 250) * 13.5f, 6, 11, 1 + (int)(rng() % 4), 0);
+  }
+  return page;
+}
+
+struct Result {
+  string layout, bench;
+  size_t lines = 0, words = 0;
+  uint64_t iterations = 0;
+  double nsPerIteration = 0, bytesPerIteration = 0, allocsPerIteration = 0;
+};
+
+// Runs body in batches until minTime has passed and keeps the fastest batch
+// average; allocations are counted over all iterations
+static Result measure(const string &layout, const string &bench, size_t lines, size_t words,
+                      chrono::milliseconds minTime, const function<void()> &body) {
+  using clock = chrono::steady_clock;
+  body(); // warm up buffers and caches
+  uint64_t batch = 1;
+  for (;;) {
+    auto start = clock::now();
+    for (uint64_t i = 0; i < batch; i++) body();
+    if (clock::now() - start > chrono::milliseconds(10) || batch >= (1u << 24)) break;
+    batch *= 2;
+  }
+  Result result{layout, bench, lines, words};
+  double best = 1e300;
+  uint64_t bytes0 = g_allocBytes, allocs0 = g_allocCount;
+  auto end = clock::now() + minTime;
+  do {
+    auto start = clock::now();
+    for (uint64_t i = 0; i < batch; i++) body();
+    best = min(best, chrono::duration<double, nano>(clock::now() - start).count() / batch);
+    result.iterations += batch;
+  } while (clock::now() < end);
+  result.nsPerIteration = best;
+  result.bytesPerIteration = (double)(g_allocBytes - bytes0) / result.iterations;
+  result.allocsPerIteration = (double)(g_allocCount - allocs0) / result.iterations;
+  return result;
+}
+
+static void printResult(const Result &r, bool json) {
+  double nsPerLine = r.lines ? r.nsPerIteration / r.lines : 0;
+  if (json) {
+    printf("{\"layout\":\"%s\",\"bench\":\"%s\",\"lines\":%zu,\"words\":%zu,\"iterations\":%llu,"
+           "\"ns_per_iter\":%.1f,\"ns_per_line\":%.2f,\"bytes_per_iter\":%.1f,\"allocs_per_iter\":%.2f}\n",
+           r.layout.c_str(), r.bench.c_str(), r.lines, r.words, (unsigned long long)r.iterations, r.nsPerIteration,
+           nsPerLine, r.bytesPerIteration, r.allocsPerIteration);
+  } else {
+    printf("%-6s %-13s %6zu %12.0f %10.2f %12.0f %8.1f\n", r.layout.c_str(), r.bench.c_str(), r.lines,
+           r.nsPerIteration, nsPerLine, r.bytesPerIteration, r.allocsPerIteration);
+  }
+  fflush(stdout);
+}
+
+// FNV-1a over the output bytes
+static uint64_t digest(uint64_t h, const OutputBuffer &out) {
+  for (size_t i = 0; i < out.size(); i++) h = (h ^ (uint8_t)out.data()[i]) * 1099511628211ull;
+  return h;
+}
+
+// Every page of the capture through extraction, grouping and the writers;
+// one iteration is the whole capture
+static int replayBench(const string &path, const string &filter, chrono::milliseconds minTime, bool json) {
+  Capture capture;
+  if (!capture.load(path)) return -1;
+  ReplayBackend backend(capture);
+  const vector<Capture::Result> &results = capture.results();
+  vector<OcrPage> pages(results.size());
+  vector<LineGroups> groups(results.size());
+  size_t lines = 0, words = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    extractPage(backend, reinterpret_cast<int64_t>(&results[i]), pages[i]);
+    pages[i].imageHeight = results[i].height;
+    groups[i] = groupLinesByProximity(pages[i]);
+    lines += pages[i].lineCount();
+    words += pages[i].wordCount();
+  }
+
+  // The same bytes the writers produce for these pages, whatever the machine
+  OutputBuffer out;
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < pages.size(); i++) {
+    out.clear();
+    serializeTxt(out, pages[i], groups[i]);
+    serializeXml(out, "page.txt", pages[i], true);
+    serializeJsonl(out, pages[i], groups[i], true);
+    h = digest(h, out);
+  }
+  if (json) {
+    printf("{\"capture\":\"%s\",\"pages\":%zu,\"lines\":%zu,\"words\":%zu,\"digest\":\"%016llx\"}\n",
+           path.c_str(), pages.size(), lines, words, (unsigned long long)h);
+  } else {
+    printf("%s: %zu page(s), %zu lines, %zu words, output digest %016llx\n", path.c_str(), pages.size(), lines,
+           words, (unsigned long long)h);
+    printf("%-6s %-13s %6s %12s %10s %12s %8s\n", "layout", "bench", "lines", "ns/iter", "ns/line", "bytes/iter",
+           "allocs");
+  }
+
+  OcrPage scratch;
+  auto eachPage = [&](auto &&body) {
+    for (size_t i = 0; i < pages.size(); i++) body(i);
+  };
+  vector<pair<const char *, function<void()>>> benches = {
+      {"extract",
+       [&] { eachPage([&](size_t i) { extractPage(backend, reinterpret_cast<int64_t>(&results[i]), scratch); }); }},
+      {"extract.lines",
+       [&] {
+         eachPage([&](size_t i) {
+           extractPage(backend, reinterpret_cast<int64_t>(&results[i]), scratch, kExtractLines);
+         });
+       }},
+      {"group", [&] { eachPage([&](size_t i) { groups[i] = groupLinesByProximity(pages[i]); }); }},
+      {"txt", [&] { eachPage([&](size_t i) { out.clear(); serializeTxt(out, pages[i], groups[i]); }); }},
+      {"xml", [&] { eachPage([&](size_t i) { out.clear(); serializeXml(out, "page.txt", pages[i], true); }); }},
+      {"jsonl", [&] { eachPage([&](size_t i) { out.clear(); serializeJsonl(out, pages[i], groups[i], true); }); }},
+      // What one pass of `ocr` spends per page after the engine
+      {"all",
+       [&] {
+         eachPage([&](size_t i) {
+           extractPage(backend, reinterpret_cast<int64_t>(&results[i]), scratch);
+           scratch.imageHeight = results[i].height;
+           LineGroups g = groupLinesByProximity(scratch);
+           out.clear();
+           serializeTxt(out, scratch, g);
+           serializeXml(out, "page.txt", scratch, true);
+         });
+       }},
+  };
+  for (auto &[name, body] : benches) {
+    if (!filter.empty() && filter != name) continue;
+    printResult(measure("replay", name, lines, words, minTime, body), json);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  bool json = false;
+  string filter;
+  chrono::milliseconds minTime(300);
+  string replay;
+  for (int i = 1; i < argc; ++i) {
+    string a = argv[i];
+    if (a == "--json") {
+      json = true;
+    } else if (a == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (a == "--min-time-ms" && i + 1 < argc) {
+      minTime = chrono::milliseconds(max(atoi(argv[++i]), 1));
+    } else if (a == "--replay" && i + 1 < argc) {
+      replay = argv[++i];
+    } else {
+      printf("Usage: ocr_bench [--json] [--filter name] [--min-time-ms N] [--replay capture]\n");
+      return a == "--help" ? 0 : -1;
+    }
+  }
+  if (!replay.empty()) {
+    return replayBench(replay, filter, minTime, json);
+  }
+  if (!json) {
+    printf("%-6s %-13s %6s %12s %10s %12s %8s\n", "layout", "bench", "lines", "ns/iter", "ns/line", "bytes/iter",
+           "allocs");
+  }
+
+  struct Layout {
+    const char *name;
+    SyntheticBackend page;
+  };
+  Layout layouts[] = {{"comic", comicPage()}, {"book", bookPage()}, {"form", formPage()}};
+
+  for (Layout &layout : layouts) {
+    OcrPage page;
+    extractPage(layout.page, 1, page);
+    page.imageHeight = layout.page.imageHeight;
+    LineGroups groups = groupLinesByProximity(page);
+    size_t lines = page.lineCount(), words = page.wordCount();
+    string allText;
+    for (size_t i = 0; i < lines; i++) {
+      allText += page.lineContent(i);
+      allText += '\n';
+    }
+
+    OutputBuffer out;
+    OcrPage scratch;
+    vector<pair<const char *, function<void()>>> benches = {
+        // Polygon to axis-aligned box reduction plus line/word copies
+        {"extract", [&] { extractPage(layout.page, 1, page); }},
+        // Same without words (line outputs) and without geometry
+        {"extract.lines", [&] { extractPage(layout.page, 1, scratch, kExtractLines); }},
+        {"extract.text", [&] { extractPage(layout.page, 1, scratch, kExtractText); }},
+        {"group", [&] { groups = groupLinesByProximity(page); }},
+        // One distance per line, against its successor
+        {"distance",
+         [&] {
+           double sum = 0;
+           for (size_t i = 0; i + 1 < lines; i++) sum += calculateDistance(page, i, i + 1);
+           if (sum < 0) printf("?");
+         }},
+        {"escape", [&] { escapeXml(allText); }},
+        {"txt", [&] { out.clear(); serializeTxt(out, page, groups); }},
+        {"xml", [&] { out.clear(); serializeXml(out, "page.txt", page, true); }},
+        {"jsonl", [&] { out.clear(); serializeJsonl(out, page, groups, true); }},
+        {"bin", [&] { out.clear(); serializeBinary(out, page, groups, true); }},
+    };
+    for (auto &[name, body] : benches) {
+      if (!filter.empty() && filter != name && filter != layout.name) continue;
+      printResult(measure(layout.name, name, lines, words, minTime, body), json);
+    }
+  }
+  return 0;
+}
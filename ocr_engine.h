@@ -0,0 +1,453 @@
+#pragma once
+
+// Embeddable OCR engine: loads nothing itself, but owns the pipelines it is
+// given and one worker thread per pipeline, and turns in-memory images into
+// in-memory results (lines, words, boxes and grouped blocks). Jobs can be
+// submitted from any thread and come back through a future or a callback.
+// At most maxInFlight jobs per lane are pending; submit() waits for room,
+// which keeps a fast producer from piling up decoded images. Results already
+// handed back don't count; a caller holding on to them bounds that itself. Jobs queue in
+// an interactive or a bulk lane and may carry a deadline. With
+// EngineOptions::atlas, small images waiting in the queue are recognized
+// together in one atlas (see atlas.h). A job can be cancelled until a
+// worker starts on it; one cancelled while running still finishes in the
+// engine, but its result is dropped.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atlas.h"
+#include "downscale.h"
+#include "grouping.h"
+#include "ingest.h"
+#include "ocr_backend.h"
+#include "ocr_output.h"
+#include "ocr_types.h"
+#include "result_cache.h"
+#include "scheduler.h"
+#include "trace.h"
+
+// 8-bit pixels owned by the caller
+struct ImageView {
+  const uint8_t *pixels = nullptr;
+  int32_t width = 0, height = 0;
+  size_t stride = 0; // bytes per row
+  int channels = 4;  // 4 = BGRA (used in place), 3 = BGR, 1 = gray
+  // Released once the job is done; without it the caller keeps the pixels
+  // alive until then
+  std::shared_ptr<const void> owner;
+};
+
+struct SubmitOptions {
+  std::shared_ptr<CancelToken> cancel;
+  // Interactive jobs run ahead of queued bulk ones (see scheduler.h)
+  JobLane lane = kLaneInteractive;
+  // A job still queued by then is dropped with kPageExpired
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  // For a downscaled image: boxes are mapped back to the original size
+  // before grouping (see scalePage)
+  float scaleX = 1, scaleY = 1;
+  int originalHeight = 0;
+};
+
+struct PageResult {
+  int32_t status = kPageOk;
+  std::string error;
+  OcrPage page;      // lines and words with their boxes
+  LineGroups groups; // blocks of nearby lines, as line indices
+  std::string text;  // grouped text as in the .txt (EngineOptions::text)
+  bool ok() const { return status == kPageOk; }
+};
+
+struct EngineOptions {
+  // Submitted jobs not finished yet, per lane; submit() waits beyond that
+  size_t maxInFlight = 64;
+  ExtractProfile profile = kExtractWords;
+  // Fill PageResult::text
+  bool text = true;
+  // Looked up before the pipeline runs and filled after; not owned
+  ResultCache *cache = nullptr;
+  // Small images queued together share one pipeline call (off by default)
+  AtlasOptions atlas;
+};
+
+struct EngineStats {
+  std::atomic<uint64_t> jobs{0};
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> cancelled{0};
+  std::atomic<uint64_t> expired{0};
+  // Summed over the workers
+  std::atomic<uint64_t> busyMicros{0};
+};
+
+class OcrEngine {
+public:
+  using Callback = std::function<void(PageResult &&)>;
+
+  // backends may be empty; see addBackend()
+  OcrEngine(std::vector<std::unique_ptr<OcrBackend>> backends, EngineOptions options = {})
+      : options_(options), jobs_(std::max<size_t>(options.maxInFlight, 1)) {
+    options_.maxInFlight = std::max<size_t>(options_.maxInFlight, 1);
+    for (auto &backend : backends) addBackend(std::move(backend));
+  }
+
+  ~OcrEngine() { shutdown(); }
+  OcrEngine(const OcrEngine &) = delete;
+  OcrEngine &operator=(const OcrEngine &) = delete;
+
+  // done runs on a worker thread (or right here if the engine is shut down)
+  void submit(ImageView image, Callback done, SubmitOptions options = {}) {
+    auto job = std::make_shared<Job>(Job{std::move(image), std::move(options), std::move(done)});
+    job->options.lane = std::min<JobLane>(job->options.lane, kLaneBulk);
+    size_t lane = job->options.lane;
+    bool admitted;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      room_.wait(lock, [&] { return stopping_ || inFlight_[lane] < options_.maxInFlight; });
+      admitted = !stopping_;
+      if (admitted) inFlight_[lane]++;
+    }
+    if (admitted && jobs_.push(job, job->options.lane, job->options.deadline, job->options.cancel)) return;
+    if (admitted) release(lane);
+    stats_.cancelled++;
+    PageResult result;
+    result.status = kPageCancelled;
+    result.error = "engine shut down";
+    job->done(std::move(result));
+  }
+
+  std::future<PageResult> submit(ImageView image, SubmitOptions options = {}) {
+    auto promise = std::make_shared<std::promise<PageResult>>();
+    std::future<PageResult> future = promise->get_future();
+    submit(
+        std::move(image), [promise](PageResult &&result) { promise->set_value(std::move(result)); },
+        std::move(options));
+    return future;
+  }
+
+  // Adds a pipeline with its own worker, e.g. from a thread still loading
+  // the model; jobs submitted before the first one wait in the queue
+  void addBackend(std::unique_ptr<OcrBackend> backend) {
+    std::lock_guard<std::mutex> lock(workersMutex_);
+    if (stopping_) return;
+    OcrBackend *pipeline = backend.get();
+    cores_.add(1);
+    backends_.push_back(std::move(backend));
+    workers_.emplace_back([this, pipeline] { workerLoop(*pipeline); });
+  }
+
+  // Stops taking jobs and cancels the queued ones; running jobs finish
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) return;
+      stopping_ = true;
+    }
+    room_.notify_all();
+    jobs_.close();
+    std::lock_guard<std::mutex> lock(workersMutex_);
+    for (auto &t : workers_) t.join();
+    // Without workers nobody drained the queue
+    while (std::optional<JobScheduler<std::shared_ptr<Job>>::Entry> left = jobs_.tryPop()) {
+      cancel(*left->item);
+    }
+  }
+
+  const EngineOptions &options() const { return options_; }
+  size_t workers() const {
+    std::lock_guard<std::mutex> lock(workersMutex_);
+    return backends_.size();
+  }
+  const EngineStats &stats() const { return stats_; }
+  // Queue depth and wait times per lane
+  SchedulerMetrics metrics() const { return jobs_.metrics(); }
+
+private:
+  struct Job {
+    ImageView image;
+    SubmitOptions options;
+    Callback done;
+  };
+
+  void release(size_t lane) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      inFlight_[lane]--;
+    }
+    // Submitters of both lanes wait here
+    room_.notify_all();
+  }
+
+  static bool cancelled(const Job &job) { return job.options.cancel && job.options.cancel->cancelled; }
+
+  bool atlasCandidate(const Job &job) const {
+    return options_.atlas.enabled() && options_.atlas.fits(job.image.width, job.image.height);
+  }
+
+  // Buffers a worker reuses from job to job
+  struct Scratch {
+    OutputBuffer text;
+    OcrPage atlasPage;
+    std::vector<OcrPage> atlasPages;
+  };
+
+  void workerLoop(OcrBackend &backend) {
+    Scratch scratch;
+    // Jobs taken from the queue but not run yet (atlas overflow, or the
+    // large job that ended a batch)
+    std::deque<std::shared_ptr<Job>> held;
+    auto take = [&](bool wait) -> std::shared_ptr<Job> {
+      if (!held.empty()) {
+        std::shared_ptr<Job> job = std::move(held.front());
+        held.pop_front();
+        return job;
+      }
+      // Expired and cancelled jobs are answered here and skipped
+      for (;;) {
+        std::optional<JobScheduler<std::shared_ptr<Job>>::Entry> next = wait ? jobs_.pop() : jobs_.tryPop();
+        if (!next) return nullptr;
+        if (next->drop == JobDrop::kNone) return std::move(next->item);
+        if (next->drop == JobDrop::kExpired) {
+          PageResult result;
+          result.status = kPageExpired;
+          result.error = "deadline passed";
+          complete(*next->item, std::move(result));
+        } else {
+          cancel(*next->item);
+        }
+      }
+    };
+    while (std::shared_ptr<Job> job = take(true)) {
+      if (stopping_ || cancelled(*job)) {
+        cancel(*job);
+        continue;
+      }
+      auto start = std::chrono::steady_clock::now();
+      if (atlasCandidate(*job)) {
+        // Small jobs queued right behind this one share its call
+        std::vector<std::shared_ptr<Job>> batch{std::move(job)};
+        while (batch.size() < options_.atlas.maxImages) {
+          std::shared_ptr<Job> more = take(false);
+          if (!more) break;
+          if (!atlasCandidate(*more)) {
+            held.push_back(std::move(more));
+            break;
+          }
+          batch.push_back(std::move(more));
+        }
+        runAtlas(backend, batch, held, scratch);
+      } else {
+        PageResult result;
+        run(backend, *job, result, scratch.text);
+        complete(*job, std::move(result));
+      }
+      stats_.busyMicros += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    }
+  }
+
+  void run(OcrBackend &backend, Job &job, PageResult &result, OutputBuffer &text) {
+    IngestedImage ingested;
+    if (!ingest(job, ingested, result)) {
+      return;
+    }
+    if (!recognizeCached(backend, ingested.img, result.page)) {
+      result.status = kPageFailed;
+      result.error = "OCR failed";
+      return;
+    }
+    ingested.frame.reset();
+    finishPage(job, result, text);
+  }
+
+  // Up to maxImages small jobs in one pipeline call. Cache hits and bad
+  // images are answered on their own; what doesn't fit the atlas goes back
+  // to the front of held.
+  void runAtlas(OcrBackend &backend, std::vector<std::shared_ptr<Job>> &batch,
+                std::deque<std::shared_ptr<Job>> &held, Scratch &scratch) {
+    OutputBuffer &text = scratch.text;
+    std::vector<std::shared_ptr<Job>> jobs;
+    std::vector<IngestedImage> ingested;
+    std::vector<CacheKey> keys;
+    for (std::shared_ptr<Job> &job : batch) {
+      if (stopping_ || cancelled(*job)) {
+        cancel(*job);
+        continue;
+      }
+      PageResult result;
+      IngestedImage image;
+      if (!ingest(*job, image, result)) {
+        complete(*job, std::move(result));
+        continue;
+      }
+      CacheKey key;
+      if (options_.cache) {
+        trace::Span span("cache");
+        key = options_.cache->keyOf(image.img);
+        if (options_.cache->lookup(key, result.page)) {
+          finishPage(*job, result, text);
+          complete(*job, std::move(result));
+          continue;
+        }
+      }
+      jobs.push_back(std::move(job));
+      ingested.push_back(std::move(image));
+      keys.push_back(key);
+    }
+    if (jobs.size() == 1) {
+      PageResult result;
+      if (recognizePage(backend, ingested[0].img, result.page, options_.profile)) {
+        if (options_.cache) options_.cache->insert(keys[0], result.page);
+        finishPage(*jobs[0], result, text);
+      } else {
+        result.status = kPageFailed;
+        result.error = "OCR failed";
+      }
+      ingested.clear();
+      complete(*jobs[0], std::move(result));
+      return;
+    }
+    if (jobs.empty()) return;
+
+    std::vector<std::pair<int, int>> sizes;
+    std::vector<Img> images;
+    for (const IngestedImage &image : ingested) {
+      sizes.push_back({image.img.col, image.img.row});
+      images.push_back(image.img);
+    }
+    AtlasLayout layout = packAtlas(sizes, options_.atlas);
+    int64_t placed = 0;
+    for (size_t i = jobs.size(); i-- > 0;) {
+      if (layout.cells[i].placed) {
+        placed++;
+      } else {
+        held.push_front(std::move(jobs[i]));
+      }
+    }
+    bool ok;
+    {
+      trace::Span span("atlas");
+      span.setArg(placed);
+      FramePool::Lease frame;
+      Img atlas = composeAtlas(layout, images, pool_, frame);
+      ingested.clear();
+      // Words are needed to cut lines that cross cells
+      ok = recognizePage(backend, atlas, scratch.atlasPage, kExtractWords);
+    }
+    if (ok) {
+      splitAtlasPage(scratch.atlasPage, layout, scratch.atlasPages, options_.profile == kExtractWords);
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+      if (!jobs[i]) continue;
+      PageResult result;
+      if (ok) {
+        std::swap(result.page, scratch.atlasPages[i]);
+        if (options_.cache) options_.cache->insert(keys[i], result.page);
+        finishPage(*jobs[i], result, text);
+      } else {
+        result.status = kPageFailed;
+        result.error = "OCR failed";
+      }
+      complete(*jobs[i], std::move(result));
+    }
+  }
+
+  bool ingest(const Job &job, IngestedImage &ingested, PageResult &result) {
+    const ImageView &image = job.image;
+    if (!image.pixels || image.width <= 0 || image.height <= 0 ||
+        image.stride < (size_t)image.width * std::max(image.channels, 1) ||
+        !ingestPixels(image.pixels, image.stride, image.channels, image.width, image.height, pool_, ingested)) {
+      result.status = kPageBadImage;
+      result.error = "unsupported image";
+      return false;
+    }
+    return true;
+  }
+
+  void finishPage(const Job &job, PageResult &result, OutputBuffer &text) {
+    const SubmitOptions &options = job.options;
+    if (options.originalHeight > 0) {
+      scalePage(result.page, options.scaleX, options.scaleY, options.originalHeight);
+    }
+    result.groups = groupLinesByProximity(result.page);
+    if (options_.text) {
+      text.clear();
+      serializeTxt(text, result.page, result.groups);
+      result.text = text.str();
+    }
+  }
+
+  void cancel(Job &job) {
+    PageResult result;
+    result.status = kPageCancelled;
+    result.error = stopping_ ? "engine shut down" : "cancelled";
+    complete(job, std::move(result));
+  }
+
+  void complete(Job &job, PageResult &&result) {
+    if (result.ok() && cancelled(job)) {
+      result = PageResult();
+      result.status = kPageCancelled;
+      result.error = "cancelled";
+    }
+    if (result.status == kPageCancelled) {
+      stats_.cancelled++;
+    } else if (result.status == kPageExpired) {
+      stats_.expired++;
+    } else if (!result.ok()) {
+      stats_.failed++;
+    } else {
+      stats_.jobs++;
+    }
+    // Room for the next job before the callback, which may submit one
+    job.image.owner.reset();
+    release(job.options.lane);
+    job.done(std::move(result));
+  }
+
+  bool recognizeCached(OcrBackend &backend, const Img &img, OcrPage &page) {
+    ResultCache *cache = options_.cache;
+    if (!cache) {
+      return recognizePage(backend, img, page, options_.profile);
+    }
+    CacheKey key;
+    {
+      trace::Span span("cache");
+      key = cache->keyOf(img);
+      if (cache->lookup(key, page)) {
+        return true;
+      }
+    }
+    if (!recognizePage(backend, img, page, options_.profile)) {
+      return false;
+    }
+    cache->insert(key, page);
+    return true;
+  }
+
+  std::vector<std::unique_ptr<OcrBackend>> backends_;
+  EngineOptions options_;
+  JobScheduler<std::shared_ptr<Job>> jobs_;
+  std::vector<std::thread> workers_;
+  mutable std::mutex workersMutex_;
+  CoreReservation cores_; // one per worker
+  // Converted (non-BGRA) images
+  FramePool pool_;
+
+  std::mutex mutex_;
+  std::condition_variable room_;
+  size_t inFlight_[kLanes] = {};
+  std::atomic<bool> stopping_{false};
+  EngineStats stats_;
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "grouping.h"
+#include "ocr_types.h"
+#include "serializer.h"
+#include "trace.h"
+
+// Outputs written next to the .txt file (which is always written)
+enum OutputFormat : unsigned {
+  kFormatXml = 1,    // .xml, the original export
+  kFormatJsonl = 2,  // .jsonl, one JSON object per line of text
+  kFormatBinary = 4, // .ocrb, see serializeBinary
+};
+
+struct OutputOptions {
+  unsigned formats = kFormatXml;
+  // Include words in the XML (and in the JSON Lines / binary outputs)
+  bool verboseXml = false;
+};
+
+// Parses a comma separated list such as "xml,jsonl,bin"
+inline bool parseOutputFormats(const std::string &list, unsigned &formats) {
+  formats = 0;
+  std::stringstream in(list);
+  std::string name;
+  while (std::getline(in, name, ',')) {
+    if (name == "xml") {
+      formats |= kFormatXml;
+    } else if (name == "jsonl" || name == "json") {
+      formats |= kFormatJsonl;
+    } else if (name == "bin" || name == "ocrb") {
+      formats |= kFormatBinary;
+    } else if (name != "txt") {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Simple XML escape helper
+inline std::string escapeXml(const std::string &s) {
+  OutputBuffer out;
+  out.appendXmlEscaped(s);
+  return out.str();
+}
+
+// Grouped text: lines in a group on one line, groups separated by blank lines
+inline void serializeTxt(OutputBuffer &out, const OcrPage &page, const LineGroups &groupedLines) {
+  for (size_t groupIdx = 0; groupIdx < groupedLines.size(); groupIdx++) {
+    if (groupIdx > 0) {
+      out.append("\n\n"); // Newline between groups (speech bubbles)
+    }
+    auto group = groupedLines[groupIdx];
+    for (size_t lineIdx = 0; lineIdx < group.size(); lineIdx++) {
+      out.append(page.lineContent(group[lineIdx]));
+      // Add space between lines in a group, except after the last line
+      if (lineIdx < group.size() - 1) {
+        out.put(' ');
+      }
+    }
+  }
+}
+
+// Lines with bounding boxes and their words (words only when verboseXml is true)
+inline void serializeXml(OutputBuffer &out, const std::string &source, const OcrPage &page, bool verboseXml) {
+  out.append("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+  out.append("<ocrExport source=\"");
+  out.appendXmlEscaped(source);
+  out.append("\">\n");
+
+  auto attr = [&](const char *name, float v) {
+    out.put(' ');
+    out.append(name);
+    out.append("=\"");
+    out.appendFloat(v);
+    out.put('"');
+  };
+
+  static const char *const cornerNames[6] = {"x1", "y1", "x2", "y2", "x3", "y3"};
+  for (size_t i = 0; i < page.lineCount(); i++) {
+    out.append("  <line id=\"");
+    out.appendInt((int64_t)i);
+    out.put('"');
+    attr("x", page.x[i]);
+    attr("y", page.y[i]);
+    attr("width", page.width[i]);
+    attr("height", page.height[i]);
+    out.append(" cornerCount=\"");
+    out.appendInt(page.cornerCount[i]);
+    out.put('"');
+    const float *corners = page.lineCorners(i);
+    for (int k = 0; k < 6; k++) attr(cornerNames[k], corners[k]);
+    out.append(">\n    <text>");
+    out.appendXmlEscaped(page.lineContent(i));
+    out.append("</text>\n");
+    if (verboseXml) {
+      uint32_t first = page.wordBegin[i];
+      for (uint32_t w = first; w < page.wordBegin[i + 1]; w++) {
+        const float *box = page.wordBoxOf(w);
+        out.append("    <word id=\"");
+        out.appendInt((int64_t)(w - first));
+        out.put('"');
+        attr("x", box[0]);
+        attr("y", box[1]);
+        attr("width", box[2]);
+        attr("height", box[3]);
+        out.put('>');
+        out.appendXmlEscaped(page.wordContent(w));
+        out.append("</word>\n");
+      }
+    }
+    out.append("  </line>\n");
+  }
+  out.append("</ocrExport>\n");
+}
+
+// Group index of every line, for the machine-readable formats
+inline std::vector<uint32_t> groupOfLines(const OcrPage &page, const LineGroups &groupedLines) {
+  std::vector<uint32_t> groupOf(page.lineCount(), 0);
+  for (size_t g = 0; g < groupedLines.size(); g++) {
+    for (uint32_t line : groupedLines[g]) groupOf[line] = (uint32_t)g;
+  }
+  return groupOf;
+}
+
+// One object per line of text:
+// {"id":0,"group":0,"x":..,"y":..,"width":..,"height":..,"cornerCount":3,
+//  "corners":[x1,y1,x2,y2,x3,y3],"text":"...","words":[{"x":..,...,"text":".."}]}
+inline void serializeJsonl(OutputBuffer &out, const OcrPage &page, const LineGroups &groupedLines, bool words) {
+  std::vector<uint32_t> groupOf = groupOfLines(page, groupedLines);
+  auto box = [&](float x, float y, float w, float h) {
+    out.append("\"x\":");
+    out.appendJsonFloat(x);
+    out.append(",\"y\":");
+    out.appendJsonFloat(y);
+    out.append(",\"width\":");
+    out.appendJsonFloat(w);
+    out.append(",\"height\":");
+    out.appendJsonFloat(h);
+  };
+  for (size_t i = 0; i < page.lineCount(); i++) {
+    out.append("{\"id\":");
+    out.appendInt((int64_t)i);
+    out.append(",\"group\":");
+    out.appendInt(groupOf[i]);
+    out.put(',');
+    box(page.x[i], page.y[i], page.width[i], page.height[i]);
+    out.append(",\"cornerCount\":");
+    out.appendInt(page.cornerCount[i]);
+    out.append(",\"corners\":[");
+    const float *corners = page.lineCorners(i);
+    for (int k = 0; k < 6; k++) {
+      if (k) out.put(',');
+      out.appendJsonFloat(corners[k]);
+    }
+    out.append("],\"text\":\"");
+    out.appendJsonEscaped(page.lineContent(i));
+    out.put('"');
+    if (words) {
+      out.append(",\"words\":[");
+      for (uint32_t w = page.wordBegin[i]; w < page.wordBegin[i + 1]; w++) {
+        if (w > page.wordBegin[i]) out.put(',');
+        out.put('{');
+        const float *wb = page.wordBoxOf(w);
+        box(wb[0], wb[1], wb[2], wb[3]);
+        out.append(",\"text\":\"");
+        out.appendJsonEscaped(page.wordContent(w));
+        out.append("\"}");
+      }
+      out.put(']');
+    }
+    out.append("}\n");
+  }
+}
+
+// Compact little-endian record format (.ocrb):
+//   "OCRB" u32 version(1) i32 imageHeight u32 lineCount u32 groupCount u32 flags(bit0 = words)
+//   per line:  f32 x y width height, i32 cornerCount, f32 x1 y1 x2 y2 x3 y3,
+//              u32 group, u32 textLen, text bytes,
+//              [u32 wordCount, per word: f32 x y width height, u32 textLen, text bytes]
+constexpr uint32_t kBinaryVersion = 1;
+
+inline void serializeBinary(OutputBuffer &out, const OcrPage &page, const LineGroups &groupedLines, bool words) {
+  std::vector<uint32_t> groupOf = groupOfLines(page, groupedLines);
+  out.append("OCRB");
+  out.appendRaw(kBinaryVersion);
+  out.appendRaw((int32_t)page.imageHeight);
+  out.appendRaw((uint32_t)page.lineCount());
+  out.appendRaw((uint32_t)groupedLines.size());
+  out.appendRaw((uint32_t)(words ? 1 : 0));
+  for (size_t i = 0; i < page.lineCount(); i++) {
+    const float box[4] = {page.x[i], page.y[i], page.width[i], page.height[i]};
+    for (float v : box) out.appendRaw(v);
+    out.appendRaw(page.cornerCount[i]);
+    const float *corners = page.lineCorners(i);
+    for (int k = 0; k < 6; k++) out.appendRaw(corners[k]);
+    out.appendRaw(groupOf[i]);
+    out.appendSized(page.lineContent(i));
+    if (words) {
+      out.appendRaw(page.wordBegin[i + 1] - page.wordBegin[i]);
+      for (uint32_t w = page.wordBegin[i]; w < page.wordBegin[i + 1]; w++) {
+        const float *wbox = page.wordBoxOf(w);
+        for (int k = 0; k < 4; k++) out.appendRaw(wbox[k]);
+        out.appendSized(page.wordContent(w));
+      }
+    }
+  }
+}
+
+// Write grouped results to output file
+inline bool writeTxt(const std::string &output_file, const OcrPage &page, const LineGroups &groupedLines) {
+  trace::Span span("write.txt");
+  thread_local OutputBuffer out;
+  out.clear();
+  serializeTxt(out, page, groupedLines);
+  if (!out.writeTo(output_file, true)) {
+    std::cerr << "Failed to open output file: " << output_file << std::endl;
+    return false;
+  }
+  printf("OCR results saved to %s\n", output_file.c_str());
+  return true;
+}
+
+// Write XML export next to the .txt file
+inline bool writeXml(const std::string &output_file, const OcrPage &page, bool verboseXml) {
+  trace::Span span("write.xml");
+  try {
+    std::string xml_file = std::filesystem::path(output_file).replace_extension(".xml").string();
+    thread_local OutputBuffer out;
+    out.clear();
+    serializeXml(out, output_file, page, verboseXml);
+    if (out.writeTo(xml_file, true)) {
+      printf("XML export saved to %s\n", xml_file.c_str());
+      return true;
+    } else {
+      printf("Failed to open XML output: %s\n", xml_file.c_str());
+    }
+  } catch (const std::exception &e) {
+    printf("Exception while writing XML: %s\n", e.what());
+  }
+  return false;
+}
+
+inline bool writeJsonl(const std::string &output_file, const OcrPage &page, const LineGroups &groupedLines, bool words) {
+  trace::Span span("write.jsonl");
+  std::string jsonl_file = std::filesystem::path(output_file).replace_extension(".jsonl").string();
+  thread_local OutputBuffer out;
+  out.clear();
+  serializeJsonl(out, page, groupedLines, words);
+  if (!out.writeTo(jsonl_file, false)) {
+    printf("Failed to open JSON Lines output: %s\n", jsonl_file.c_str());
+    return false;
+  }
+  printf("JSON Lines export saved to %s\n", jsonl_file.c_str());
+  return true;
+}
+
+inline bool writeBinary(const std::string &output_file, const OcrPage &page, const LineGroups &groupedLines, bool words) {
+  trace::Span span("write.bin");
+  std::string bin_file = std::filesystem::path(output_file).replace_extension(".ocrb").string();
+  thread_local OutputBuffer out;
+  out.clear();
+  serializeBinary(out, page, groupedLines, words);
+  if (!out.writeTo(bin_file, false)) {
+    printf("Failed to open binary output: %s\n", bin_file.c_str());
+    return false;
+  }
+  printf("Binary export saved to %s\n", bin_file.c_str());
+  return true;
+}
+
+// .txt plus every selected format; true if all of them were written
+inline bool writeOutputs(const std::string &output_file, const OcrPage &page, const LineGroups &groupedLines,
+                         const OutputOptions &options) {
+  if (!writeTxt(output_file, page, groupedLines)) {
+    return false;
+  }
+  bool ok = true;
+  if (options.formats & kFormatXml) ok = writeXml(output_file, page, options.verboseXml) && ok;
+  if (options.formats & kFormatJsonl) ok = writeJsonl(output_file, page, groupedLines, options.verboseXml) && ok;
+  if (options.formats & kFormatBinary) ok = writeBinary(output_file, page, groupedLines, options.verboseXml) && ok;
+  return ok;
+}
@@ -0,0 +1,582 @@
+// Checks for the pipeline (line grouping, tile merging, incremental frames,
+// atlas batching, capture files, the TXT/XML outputs, the word boxes passed
+// between stages and the job scheduler's lanes) on hand-made results and on
+// images read by a stub engine. Needs neither OpenCV nor oneocr.dll. Prints
+// each failed check and exits non-zero if any failed.
+//
+//   ./ocr_selftest
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "atlas.h"
+#include "capture.h"
+#include "fake_backend.h"
+#include "frame_diff.h"
+#include "grouping.h"
+#include "ingest.h"
+#include "ocr_backend.h"
+#include "ocr_output.h"
+#include "ocr_types.h"
+#include "scheduler.h"
+#include "tiling.h"
+
+using namespace std;
+
+static int g_failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  do {                                                                                                                 \
+    if (!(cond)) {                                                                                                     \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                         \
+      g_failures++;                                                                                                    \
+    }                                                                                                                  \
+  } while (0)
+
+static bool near(float a, float b) { return fabsf(a - b) < 0.01f; }
+
+// Stub engine that reads dark rectangles. The image is cut into columns at
+// white gaps of columnGap pixels, each column top to bottom into lines (runs
+// of rows with a dark pixel) and each line into words at white gaps of
+// wordGap pixels; columns come out one after the other, like the engine
+// reads a two-column page. A word's text is its width in pixels.
+class DarkRunsBackend : public OcrBackend {
+public:
+  explicit DarkRunsBackend(int columnGap = 40, int wordGap = 6) : columnGap_(columnGap), wordGap_(wordGap) {}
+
+  int64_t run(const Img &img) override {
+    auto *result = new Result;
+    vector<char> inkCol(img.col, 0);
+    for (int x = 0; x < img.col; x++) {
+      for (int y = 0; y < img.row && !inkCol[x]; y++) inkCol[x] = dark(img, x, y);
+    }
+    for (auto [cx0, cx1] : runs(inkCol, columnGap_)) {
+      vector<char> inkRow(img.row, 0);
+      for (int y = 0; y < img.row; y++) {
+        for (int x = cx0; x < cx1 && !inkRow[y]; x++) inkRow[y] = dark(img, x, y);
+      }
+      for (auto [y0, y1] : runs(inkRow, 1)) {
+        vector<char> ink(img.col, 0);
+        for (int x = cx0; x < cx1; x++) {
+          for (int y = y0; y < y1 && !ink[x]; y++) ink[x] = dark(img, x, y);
+        }
+        Line &line = result->lines.emplace_back();
+        float lx0 = 1e30f, lx1 = 0;
+        for (auto [x0, x1] : runs(ink, wordGap_)) {
+          Word &word = line.words.emplace_back();
+          word.text = to_string(x1 - x0);
+          const float box[4] = {(float)(x1 - x0), (float)(y1 - y0), (float)x0, (float)y0};
+          copy(box, box + 4, word.box);
+          if (!line.text.empty()) line.text += ' ';
+          line.text += word.text;
+          lx0 = min(lx0, (float)x0);
+          lx1 = max(lx1, (float)x1);
+        }
+        const float box[8] = {lx0, (float)y0, lx1, (float)y0, lx1, (float)y1, lx0, (float)y1};
+        copy(box, box + 8, line.box);
+      }
+    }
+    return reinterpret_cast<int64_t>(result);
+  }
+  void releaseResult(int64_t instance) override { delete reinterpret_cast<Result *>(instance); }
+
+  int64_t lineCount(int64_t instance) override { return (int64_t)reinterpret_cast<Result *>(instance)->lines.size(); }
+  int64_t line(int64_t instance, int64_t index) override {
+    return reinterpret_cast<int64_t>(&reinterpret_cast<Result *>(instance)->lines[index]);
+  }
+  const char *lineContent(int64_t line) override { return reinterpret_cast<Line *>(line)->text.c_str(); }
+  const float *lineBoundingBox(int64_t line) override { return reinterpret_cast<Line *>(line)->box; }
+  int64_t wordCount(int64_t line) override { return (int64_t)reinterpret_cast<Line *>(line)->words.size(); }
+  int64_t word(int64_t line, int64_t index) override {
+    return reinterpret_cast<int64_t>(&reinterpret_cast<Line *>(line)->words[index]);
+  }
+  const char *wordContent(int64_t word) override { return reinterpret_cast<Word *>(word)->text.c_str(); }
+  const float *wordBoundingBox(int64_t word) override { return reinterpret_cast<Word *>(word)->box; }
+
+private:
+  struct Word {
+    string text;
+    float box[4]; // width, height, x, y like the engine
+  };
+  struct Line {
+    string text;
+    float box[8];
+    vector<Word> words;
+  };
+  struct Result {
+    vector<Line> lines;
+  };
+
+  static bool dark(const Img &img, int x, int y) {
+    const uint8_t *px = reinterpret_cast<const uint8_t *>(img.data_ptr) + (size_t)y * img.step + (size_t)x * 4;
+    return px[0] + px[1] + px[2] < 3 * 128;
+  }
+
+  // [start, end) runs of set entries, joined across gaps shorter than gap
+  static vector<pair<int, int>> runs(const vector<char> &set, int gap) {
+    vector<pair<int, int>> out;
+    for (int i = 0; i < (int)set.size(); i++) {
+      if (!set[i]) continue;
+      if (!out.empty() && i - out.back().second < gap) {
+        out.back().second = i + 1;
+      } else {
+        out.push_back({i, i + 1});
+      }
+    }
+    return out;
+  }
+
+  int columnGap_, wordGap_;
+};
+
+// White BGRA canvas to draw dark rectangles on
+struct Canvas {
+  int width, height;
+  vector<uint8_t> pixels;
+
+  Canvas(int w, int h) : width(w), height(h), pixels((size_t)w * h * 4, 0xff) {}
+  void fill(int x, int y, int w, int h) {
+    for (int row = y; row < y + h; row++) memset(&pixels[((size_t)row * width + x) * 4], 0, (size_t)w * 4);
+  }
+  Img img() {
+    return {.t = 3, .col = width, .row = height, ._unk = 0, .step = (int64_t)width * 4,
+            .data_ptr = (int64_t)pixels.data()};
+  }
+};
+
+static bool samePage(const OcrPage &a, const OcrPage &b) {
+  if (a.lineCount() != b.lineCount() || a.wordCount() != b.wordCount()) return false;
+  for (size_t i = 0; i < a.lineCount(); i++) {
+    if (a.lineContent(i) != b.lineContent(i) || !near(a.x[i], b.x[i]) || !near(a.y[i], b.y[i]) ||
+        !near(a.width[i], b.width[i]) || !near(a.height[i], b.height[i])) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < a.wordBox.size(); i++) {
+    if (!near(a.wordBox[i], b.wordBox[i])) return false;
+  }
+  return true;
+}
+
+// The grouping scan the clusterer replaced, kept as the reference: restart
+// the scan after every added line, with the group's span re-read for each
+// candidate. The scan's std::sort left lines on the same row in any order;
+// here they keep line index order like in the clusterer.
+static vector<vector<uint32_t>> referenceGroups(const OcrPage &page, double maxDistance) {
+  const vector<float> &cx = page.centerX, &cy = page.centerY;
+  size_t n = page.lineCount();
+  vector<vector<uint32_t>> groups;
+  vector<bool> used(n, false);
+  for (size_t i = 0; i < n; i++) {
+    if (used[i]) continue;
+    vector<uint32_t> group{(uint32_t)i};
+    used[i] = true;
+    bool foundNew = true;
+    while (foundNew) {
+      foundNew = false;
+      for (size_t j = 0; j < n && !foundNew; j++) {
+        if (used[j]) continue;
+        float minY = cy[group[0]], maxY = cy[group[0]];
+        for (uint32_t g : group) {
+          minY = min(minY, cy[g]);
+          maxY = max(maxY, cy[g]);
+        }
+        float verticalCompensation = 0.5f * (maxY - minY);
+        for (uint32_t g : group) {
+          float dx = cx[j] - cx[g];
+          float dy = cy[j] - cy[g];
+          float dist = sqrt(dx * dx + dy * dy);
+          float compensatedMaxDistance = maxDistance;
+          if (fabs(dy) > 0) compensatedMaxDistance += verticalCompensation;
+          if (dist <= compensatedMaxDistance) {
+            group.push_back((uint32_t)j);
+            used[j] = true;
+            foundNew = true;
+            break;
+          }
+        }
+      }
+    }
+    sort(group.begin(), group.end(), [&](uint32_t a, uint32_t b) { return cy[a] < cy[b] || (cy[a] == cy[b] && a < b); });
+    groups.push_back(group);
+  }
+  stable_sort(groups.begin(), groups.end(), [&](const vector<uint32_t> &a, const vector<uint32_t> &b) {
+    if (abs(cy[a[0]] - cy[b[0]]) < 50) return cx[a[0]] < cx[b[0]];
+    return cy[a[0]] < cy[b[0]];
+  });
+  return groups;
+}
+
+// Adds a line of the given size centered on (cx, cy)
+static void addCenteredLine(OcrPage &page, float cx, float cy, float w, float h) {
+  const float box[4] = {cx - w / 2, cy - h / 2, w, h};
+  const float corners[6] = {cx + w / 2, cy - h / 2, cx + w / 2, cy + h / 2, cx - w / 2, cy + h / 2};
+  page.addLine("line", box, cx, cy, 3, corners);
+}
+
+// Groups the page and compares membership and order with the reference
+static bool sameGroups(const OcrPage &page) {
+  LineGroups groups = groupLinesByProximity(page);
+  double maxDistance = max(page.imageHeight * 0.1, 100.0);
+  vector<vector<uint32_t>> expected = referenceGroups(page, maxDistance);
+  if (groups.size() != expected.size()) return false;
+  for (size_t g = 0; g < groups.size(); g++) {
+    span<const uint32_t> lines = groups[g];
+    if (!equal(lines.begin(), lines.end(), expected[g].begin(), expected[g].end())) return false;
+  }
+  return true;
+}
+
+// The grid clusterer must give the same groups, in the same order, as the
+// scan it replaced (maxDistance is 100 on all pages below)
+static void checkGrouping() {
+  OcrPage page;
+  page.imageHeight = 800;
+  CHECK(groupLinesByProximity(page).size() == 0);
+  CHECK(sameGroups(page));
+
+  // Lines exactly maxDistance apart join, a hair further they don't; the
+  // diagonal pair is 60/80 apart, 100 in total
+  addCenteredLine(page, 100, 100, 80, 20);
+  addCenteredLine(page, 200, 100, 80, 20);
+  addCenteredLine(page, 300.5f, 100, 80, 20);
+  addCenteredLine(page, 600, 400, 80, 20);
+  addCenteredLine(page, 660, 480, 80, 20);
+  CHECK(groupLinesByProximity(page).size() == 3);
+  CHECK(sameGroups(page));
+
+  // Vertical compensation: a tall line and a short one stack to a span of 90,
+  // so an offset line 140 away joins (limit 100 + 45), while a line 140 away
+  // on the same row as that one gets no compensation and stays apart
+  page.clear();
+  addCenteredLine(page, 100, 100, 60, 80);
+  addCenteredLine(page, 100, 190, 60, 12);
+  addCenteredLine(page, 100 + 140 * 0.6f, 190 + 140 * 0.8f, 60, 12);
+  addCenteredLine(page, 100 + 140 * 0.6f + 140, 190 + 140 * 0.8f, 60, 12);
+  LineGroups groups = groupLinesByProximity(page);
+  CHECK(groups.size() == 2 && groups[0].size() == 3);
+  CHECK(sameGroups(page));
+
+  // Dense columns of lines with jittered spacing and heights
+  mt19937 rng(1234);
+  page.clear();
+  for (int column = 0; column < 3; column++) {
+    float y = 20;
+    for (int i = 0; i < 40; i++) {
+      float h = 10 + rng() % 40;
+      y += h / 2 + rng() % 30;
+      addCenteredLine(page, 150 + column * 300 + (float)(rng() % 60), y, 80 + rng() % 100, h);
+      y += h / 2;
+    }
+  }
+  CHECK(sameGroups(page));
+
+  // Random pages on a 10 px grid, so many pairs sit exactly on the threshold
+  for (int round = 0; round < 300; round++) {
+    page.clear();
+    int lines = rng() % 80;
+    float side = 200 + rng() % 1200;
+    for (int i = 0; i < lines; i++) {
+      float cx = 10 * (float)(rng() % (int)(side / 10));
+      float cy = 10 * (float)(rng() % (int)(side / 10));
+      addCenteredLine(page, cx, cy, 40 + rng() % 200, 8 + rng() % 60);
+    }
+    CHECK(sameGroups(page));
+  }
+}
+
+// TXT and XML of a fake engine page plus a hand-made line, written out in
+// the format the per-line writer produced: groups split by a blank line,
+// coordinates like ostream's default float output, five escaped characters
+static void checkTextOutputs() {
+  Canvas image(333, 250);
+  FakeOcrBackend engine(2);
+  OcrPage page;
+  CHECK(recognizePage(engine, image.img(), page));
+  CHECK(page.lineCount() == 2);
+  if (page.lineCount() != 2) return;
+
+  const float box[4] = {1234.5678f, 200, 40.0f / 3, 0.0001f};
+  const float corners[6] = {1234.5678f, 200, 1e7f, 200, -2.5f, 123456789.0f};
+  page.addLine("<tag> & \"quoted\" it's", box, 1241.24f, 200, 3, corners);
+  page.addWord("<tag>", box);
+  const float empty[4] = {0, 0, 0, 0};
+  page.addWord("it's", empty);
+
+  OutputBuffer txt;
+  serializeTxt(txt, page, groupLinesByProximity(page));
+  CHECK(txt.str() == "of OCR page 2024 dog word bubble page 2024 scan manga manga text\n\n"
+                     "<tag> & \"quoted\" it's");
+
+  OutputBuffer xml;
+  serializeXml(xml, "in/a&b.txt", page, true);
+  CHECK(xml.str() ==
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<ocrExport source=\"in/a&amp;b.txt\">\n"
+        "  <line id=\"0\" x=\"9.99\" y=\"9.99\" width=\"125\" height=\"10\" cornerCount=\"3\" x1=\"9.99\" "
+        "y1=\"9.99\" x2=\"134.99\" y2=\"9.99\" x3=\"134.99\" y3=\"19.99\">\n"
+        "    <text>of OCR page 2024 dog word</text>\n"
+        "    <word id=\"0\" x=\"9.99\" y=\"9.99\" width=\"10\" height=\"10\">of</word>\n"
+        "    <word id=\"1\" x=\"24.99\" y=\"9.99\" width=\"15\" height=\"10\">OCR</word>\n"
+        "    <word id=\"2\" x=\"44.99\" y=\"9.99\" width=\"20\" height=\"10\">page</word>\n"
+        "    <word id=\"3\" x=\"69.99\" y=\"9.99\" width=\"20\" height=\"10\">2024</word>\n"
+        "    <word id=\"4\" x=\"94.99\" y=\"9.99\" width=\"15\" height=\"10\">dog</word>\n"
+        "    <word id=\"5\" x=\"114.99\" y=\"9.99\" width=\"20\" height=\"10\">word</word>\n"
+        "  </line>\n"
+        "  <line id=\"1\" x=\"9.99\" y=\"24.99\" width=\"190\" height=\"10\" cornerCount=\"3\" x1=\"9.99\" "
+        "y1=\"24.99\" x2=\"199.99\" y2=\"24.99\" x3=\"199.99\" y3=\"34.99\">\n"
+        "    <text>bubble page 2024 scan manga manga text</text>\n"
+        "    <word id=\"0\" x=\"9.99\" y=\"24.99\" width=\"30\" height=\"10\">bubble</word>\n"
+        "    <word id=\"1\" x=\"44.99\" y=\"24.99\" width=\"20\" height=\"10\">page</word>\n"
+        "    <word id=\"2\" x=\"69.99\" y=\"24.99\" width=\"20\" height=\"10\">2024</word>\n"
+        "    <word id=\"3\" x=\"94.99\" y=\"24.99\" width=\"20\" height=\"10\">scan</word>\n"
+        "    <word id=\"4\" x=\"119.99\" y=\"24.99\" width=\"25\" height=\"10\">manga</word>\n"
+        "    <word id=\"5\" x=\"149.99\" y=\"24.99\" width=\"25\" height=\"10\">manga</word>\n"
+        "    <word id=\"6\" x=\"179.99\" y=\"24.99\" width=\"20\" height=\"10\">text</word>\n"
+        "  </line>\n"
+        "  <line id=\"2\" x=\"1234.57\" y=\"200\" width=\"13.3333\" height=\"0.0001\" cornerCount=\"3\" "
+        "x1=\"1234.57\" y1=\"200\" x2=\"1e+07\" y2=\"200\" x3=\"-2.5\" y3=\"1.23457e+08\">\n"
+        "    <text>&lt;tag&gt; &amp; &quot;quoted&quot; it&apos;s</text>\n"
+        "    <word id=\"0\" x=\"1234.57\" y=\"200\" width=\"13.3333\" height=\"0.0001\">&lt;tag&gt;</word>\n"
+        "    <word id=\"1\" x=\"0\" y=\"0\" width=\"0\" height=\"0\">it&apos;s</word>\n"
+        "  </line>\n"
+        "</ocrExport>\n");
+
+  // Without verboseXml the words are left out
+  OutputBuffer brief;
+  serializeXml(brief, "in/a&b.txt", page, false);
+  CHECK(brief.str().find("<word") == string::npos && brief.str().find("<text>bubble page") != string::npos);
+}
+
+static TileLine tileLine(const char *text, float x, float y, float w, float h) {
+  TileLine line;
+  line.text = text;
+  line.hasBox = true;
+  const float box[8] = {x, y, x + w, y, x + w, y + h, x, y + h};
+  copy(box, box + 8, line.box);
+  return line;
+}
+
+// Word box in the engine's width, height, x, y order
+static TileWord tileWord(const char *text, float x, float y, float w, float h) {
+  TileWord word;
+  word.text = text;
+  word.hasBox = true;
+  const float box[4] = {w, h, x, y};
+  copy(box, box + 4, word.box);
+  return word;
+}
+
+// Two bands of a 300x180 page sharing rows 80-99. "shared" is seen by both:
+// the top tile's copy touches its inner edge, so the bottom tile's is kept.
+static void checkMergeTiles() {
+  vector<TileResult> tiles(2);
+  tiles[0].rect = {0, 0, 300, 100};
+  tiles[1].rect = {0, 80, 300, 100};
+
+  TileLine top = tileLine("top", 10, 10, 120, 20);
+  top.words.push_back(tileWord("top", 15, 10, 40, 20));
+  tiles[0].lines.push_back(top);
+  TileLine cut = tileLine("shared", 20, 85, 100, 15);
+  cut.words.push_back(tileWord("shared", 20, 85, 30, 15));
+  tiles[0].lines.push_back(cut);
+
+  TileLine shared = tileLine("shared", 20, 5, 100, 15);
+  shared.words.push_back(tileWord("shared", 20, 5, 30, 15));
+  tiles[1].lines.push_back(shared);
+  TileLine bottom = tileLine("bottom", 40, 60, 90, 20);
+  bottom.words.push_back(tileWord("bot", 40, 60, 25, 20));
+  bottom.words.push_back(tileWord("tom", 70, 60, 25, 20));
+  tiles[1].lines.push_back(bottom);
+
+  vector<TileLine> merged = mergeTiles(tiles);
+  CHECK(merged.size() == 3);
+  if (merged.size() != 3) return;
+  CHECK(merged[0].text == "top" && merged[1].text == "shared" && merged[2].text == "bottom");
+
+  // Line polygons move as a whole
+  CHECK(near(merged[1].box[1], 85) && near(merged[1].box[5], 100));
+  CHECK(near(merged[2].box[0], 40) && near(merged[2].box[1], 140) && near(merged[2].box[4], 130));
+
+  // Word boxes keep their size and only move their origin
+  const TileWord &w = merged[1].words[0];
+  CHECK(near(w.box[0], 30) && near(w.box[1], 15) && near(w.box[2], 20) && near(w.box[3], 85));
+  const TileWord &first = merged[0].words[0];
+  CHECK(near(first.box[0], 40) && near(first.box[1], 20) && near(first.box[2], 15) && near(first.box[3], 10));
+
+  // And come out of extraction as x, y, width, height in page coordinates
+  TileLinesReader reader;
+  OcrPage page;
+  extractPage(reader, reinterpret_cast<int64_t>(&merged), page);
+  CHECK(page.lineCount() == 3 && page.wordCount() == 4);
+  if (page.wordCount() != 4) return;
+  CHECK(page.wordContent(3) == "tom");
+  CHECK(near(page.wordBox[12], 70) && near(page.wordBox[13], 140) && near(page.wordBox[14], 25) &&
+        near(page.wordBox[15], 20));
+}
+
+// Two columns read left column first. A change in the right column must
+// come out exactly like a full read of the new frame: same line order (not
+// sorted by position) and word boxes in frame coordinates.
+static void checkFrameUpdate() {
+  Canvas frame(640, 400);
+  frame.fill(20, 40, 60, 16);   // left column, 1st line
+  frame.fill(100, 40, 80, 16);
+  frame.fill(20, 200, 120, 16); // left column, 2nd line
+  frame.fill(400, 120, 90, 16); // right column, 1st line
+  frame.fill(400, 300, 50, 16); // right column, 2nd line
+
+  DarkRunsBackend engine;
+  FrameSequenceOcr frames(engine);
+  OcrPage page;
+  CHECK(frames.recognize(frame.img(), page));
+  CHECK(page.lineCount() == 4 && page.lineContent(0) == "60 80" && page.lineContent(2) == "90");
+
+  frame.fill(510, 120, 30, 16); // a word appears in the right column
+  CHECK(frames.recognize(frame.img(), page));
+  CHECK(frames.stats().regions == 1 && frames.stats().fullFrames == 1);
+
+  DarkRunsBackend fullEngine;
+  FrameSequenceOcr full(fullEngine);
+  OcrPage expected;
+  CHECK(full.recognize(frame.img(), expected));
+  CHECK(samePage(page, expected));
+  CHECK(page.lineCount() == 4 && page.lineContent(2) == "90 30");
+  if (page.wordCount() == 6) {
+    CHECK(near(page.wordBox[12], 400) && near(page.wordBox[13], 120) && near(page.wordBox[14], 90) &&
+          near(page.wordBox[15], 16));
+  }
+
+  // Text in an empty part of the screen goes before the first line below it
+  frame.fill(20, 120, 40, 16);
+  CHECK(frames.recognize(frame.img(), page));
+  CHECK(page.lineCount() == 5 && page.lineContent(1) == "40" && page.lineContent(2) == "120");
+}
+
+// Three snippets packed into one atlas and read in one call, where the
+// engine reads the first line of the two top cells as one line. Each cell's
+// page must match a read of its own image: lines cut along their words, and
+// word boxes moved into the cell without changing their size.
+static void checkAtlasSplit() {
+  vector<Canvas> images;
+  images.emplace_back(200, 80);
+  images[0].fill(10, 10, 50, 16);
+  images[0].fill(70, 10, 40, 16);
+  images[0].fill(10, 50, 120, 16);
+  images.emplace_back(180, 80);
+  images[1].fill(12, 10, 60, 16);
+  images[1].fill(90, 10, 30, 16);
+  images.emplace_back(150, 40);
+  images[2].fill(20, 12, 70, 16);
+
+  AtlasOptions options;
+  options.maxImages = 3;
+  options.maxSide = 460;
+  vector<pair<int, int>> sizes;
+  vector<Img> imgs;
+  for (Canvas &c : images) {
+    sizes.push_back({c.width, c.height});
+    imgs.push_back(c.img());
+  }
+  AtlasLayout layout = packAtlas(sizes, options);
+  for (const AtlasCell &cell : layout.cells) CHECK(cell.placed);
+  CHECK(layout.cells[0].y == layout.cells[1].y && layout.cells[2].y > layout.cells[0].y);
+
+  FramePool pool;
+  FramePool::Lease frame;
+  Img atlas = composeAtlas(layout, imgs, pool, frame);
+  DarkRunsBackend engine(1000); // no column breaks: lines run across cells
+  OcrPage atlasPage;
+  CHECK(recognizePage(engine, atlas, atlasPage));
+  CHECK(atlasPage.lineCount() == 3 && atlasPage.lineContent(0) == "50 40 60 30");
+
+  vector<OcrPage> pages;
+  splitAtlasPage(atlasPage, layout, pages, true);
+  CHECK(pages.size() == 3);
+  for (size_t i = 0; i < pages.size() && i < images.size(); i++) {
+    OcrPage expected;
+    CHECK(recognizePage(engine, images[i].img(), expected));
+    CHECK(samePage(pages[i], expected));
+  }
+  if (pages.size() == 3 && pages[1].wordCount() == 2) {
+    CHECK(near(pages[1].wordBox[4], 90) && near(pages[1].wordBox[5], 10) && near(pages[1].wordBox[6], 30) &&
+          near(pages[1].wordBox[7], 16));
+  }
+}
+
+// A page recorded to a capture file replays with the same lines and boxes
+static void checkCaptureReplay() {
+  Canvas image(300, 120);
+  image.fill(10, 10, 50, 16);
+  image.fill(70, 10, 40, 16);
+  image.fill(30, 60, 200, 20);
+  const string path = "ocr_selftest.ocrr";
+
+  OcrPage recorded;
+  {
+    CaptureWriter writer;
+    CHECK(writer.open(path));
+    RecordingBackend recorder(make_unique<DarkRunsBackend>(), writer);
+    CHECK(recognizePage(recorder, image.img(), recorded));
+    CHECK(writer.results() == 1);
+  }
+  Capture capture;
+  CHECK(capture.load(path));
+  remove(path.c_str());
+  ReplayBackend replay(capture);
+  OcrPage replayed;
+  CHECK(recognizePage(replay, image.img(), replayed));
+  CHECK(recorded.wordCount() == 3 && samePage(recorded, replayed));
+}
+
+// With a burst of two and a bulk job waiting, the cancelled and expired
+// interactive jobs taken first don't use up the bulk job's turn: it comes
+// after two interactive jobs that ran, and the streak starts over after it.
+static void checkSchedulerLanes() {
+  using clock = JobScheduler<int>::clock;
+  JobScheduler<int> scheduler(16, 2);
+  auto cancelled = make_shared<CancelToken>();
+  cancelled->cancel();
+  CHECK(scheduler.push(100, kLaneBulk));
+  CHECK(scheduler.push(101, kLaneBulk));
+  CHECK(scheduler.push(1, kLaneInteractive, clock::time_point::max(), cancelled));
+  CHECK(scheduler.push(2, kLaneInteractive, clock::now() - chrono::seconds(1)));
+  CHECK(scheduler.push(3, kLaneInteractive, clock::time_point::max(), cancelled));
+  for (int i = 4; i <= 7; i++) CHECK(scheduler.push(i, kLaneInteractive));
+
+  const int order[] = {1, 2, 3, 4, 5, 100, 6, 7, 101};
+  const JobDrop drops[] = {JobDrop::kCancelled, JobDrop::kExpired, JobDrop::kCancelled};
+  for (size_t i = 0; i < size(order); i++) {
+    optional<JobScheduler<int>::Entry> entry = scheduler.tryPop();
+    CHECK(entry && entry->item == order[i]);
+    if (entry) CHECK(entry->drop == (i < size(drops) ? drops[i] : JobDrop::kNone));
+  }
+  CHECK(!scheduler.tryPop());
+
+  SchedulerMetrics metrics = scheduler.metrics();
+  CHECK(metrics.lanes[kLaneInteractive].started == 4 && metrics.lanes[kLaneInteractive].cancelled == 2 &&
+        metrics.lanes[kLaneInteractive].expired == 1 && metrics.lanes[kLaneBulk].started == 2);
+}
+
+int main() {
+  checkGrouping();
+  checkTextOutputs();
+  checkMergeTiles();
+  checkFrameUpdate();
+  checkAtlasSplit();
+  checkCaptureReplay();
+  checkSchedulerLanes();
+  if (g_failures) {
+    fprintf(stderr, "%d checks failed\n", g_failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
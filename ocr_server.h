@@ -0,0 +1,582 @@
+#pragma once
+
+// Long-running OCR server: the pipelines are created once and jobs arrive
+// over a local stream socket (AF_UNIX; Windows 10 1803+ supports it too).
+//
+// Protocol, all integers little-endian, any number of requests per
+// connection, answered in order:
+//   request:  u32 'OCRQ', u32 type, u32 flags (bit0 = include words,
+//             bit1 = bulk lane, bit2 = deadline, bit3 = job id),
+//             [u32 deadline ms if bit2], [u64 job id if bit3]
+//             type 1 (path): u32 len, path bytes
+//             type 2 (BGRA): i32 width, i32 height, u32 stride, stride * height bytes
+//             type 3 (stats): nothing; answered right away with the queue
+//                    metrics as text (see formatMetrics)
+//             type 4 (cancel): u64 job id; answered right away, ok if a
+//                    job with that id was waiting (its own request is then
+//                    answered with kPageCancelled), kPageFailed if none
+//   response: u32 'OCRR', i32 status (kPage*, 0 = ok), u32 payloadLen, payload
+//             ok:    u32 textLen, grouped text (as in the .txt),
+//                    then a .ocrb record (see serializeBinary)
+//             error: message bytes
+//
+// Jobs are scheduled by lane (see scheduler.h): interactive unless bit1 is
+// set. A job still queued when its deadline passes is answered with
+// kPageExpired, and one whose client hangs up while it waits is dropped.
+// Job ids are picked by the client and only serve cancel requests, which
+// come over another connection (this one is waiting for the answer); they
+// should be unique across clients, e.g. random. A job already running when
+// its cancel arrives still finishes.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+typedef SOCKET socket_t;
+#define OCR_INVALID_SOCKET INVALID_SOCKET
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int socket_t;
+#define OCR_INVALID_SOCKET (-1)
+#endif
+
+#include "grouping.h"
+#include "ocr_backend.h"
+#include "ocr_output.h"
+#include "ocr_types.h"
+#include "scheduler.h"
+
+constexpr uint32_t kRequestMagic = 0x5152434F;  // "OCRQ"
+constexpr uint32_t kResponseMagic = 0x5252434F; // "OCRR"
+constexpr uint32_t kJobPath = 1;
+constexpr uint32_t kJobBgra = 2;
+constexpr uint32_t kJobStats = 3;
+constexpr uint32_t kJobCancel = 4;
+constexpr uint32_t kJobWords = 1;
+constexpr uint32_t kJobBulk = 2;
+constexpr uint32_t kJobDeadline = 4;
+constexpr uint32_t kJobId = 8;
+// Largest raw frame accepted (a 16k x 8k BGRA image)
+constexpr uint64_t kMaxJobBytes = 512ull << 20;
+
+namespace socket_io {
+
+inline void closeSocket(socket_t s) {
+#ifdef _WIN32
+  closesocket(s);
+#else
+  close(s);
+#endif
+}
+
+inline void shutdownSocket(socket_t s) {
+#ifdef _WIN32
+  shutdown(s, SD_BOTH);
+#else
+  shutdown(s, SHUT_RDWR);
+#endif
+}
+
+inline bool startup() {
+#ifdef _WIN32
+  static bool ok = [] {
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }();
+  return ok;
+#else
+  return true;
+#endif
+}
+
+inline bool readAll(socket_t s, void *buffer, size_t size) {
+  char *p = static_cast<char *>(buffer);
+  while (size > 0) {
+    int chunk = (int)std::min<size_t>(size, 1 << 30);
+    int n = (int)recv(s, p, chunk, 0);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+inline bool writeAll(socket_t s, const void *buffer, size_t size) {
+  const char *p = static_cast<const char *>(buffer);
+  while (size > 0) {
+    int chunk = (int)std::min<size_t>(size, 1 << 30);
+#ifdef MSG_NOSIGNAL
+    int n = (int)send(s, p, chunk, MSG_NOSIGNAL);
+#else
+    int n = (int)send(s, p, chunk, 0);
+#endif
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+template <class T>
+bool readValue(socket_t s, T &v) {
+  return readAll(s, &v, sizeof(T));
+}
+
+// True once the peer has closed (or reset) the connection; never blocks.
+// poll() rather than select(), which can't take descriptors past FD_SETSIZE.
+inline bool peerClosed(socket_t s) {
+#ifdef _WIN32
+  WSAPOLLFD p{s, POLLRDNORM, 0};
+  if (WSAPoll(&p, 1, 0) <= 0) return false;
+#else
+  pollfd p{s, POLLIN, 0};
+  if (poll(&p, 1, 0) <= 0) return false;
+#endif
+  if (p.revents & (POLLERR | POLLHUP)) return true;
+  char c;
+  return recv(s, &c, 1, MSG_PEEK) <= 0;
+}
+
+inline bool fillAddress(const std::string &path, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) return false;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+} // namespace socket_io
+
+// Response payload for a recognized page: sized grouped text, then the
+// .ocrb record. record is cleared first; text is scratch.
+inline void encodeResult(const OcrPage &page, bool words, OutputBuffer &text, OutputBuffer &record) {
+  LineGroups groups = groupLinesByProximity(page);
+  text.clear();
+  serializeTxt(text, page, groups);
+  record.clear();
+  record.appendSized(text.str());
+  serializeBinary(record, page, groups, words);
+}
+
+// Decodes an image file for a path job. Fills img and returns whatever keeps
+// its pixels alive, or nullptr with error set.
+using FileDecoder = std::function<std::shared_ptr<void>(const std::string &path, Img &img, std::string &error)>;
+
+struct ServerStats {
+  std::atomic<uint64_t> jobs{0};
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> expired{0};
+  std::atomic<uint64_t> cancelled{0};
+  std::atomic<uint64_t> connections{0};
+};
+
+class OcrServer {
+public:
+  // backends: one worker thread each. decoder may be empty (raw jobs only).
+  // maxQueued is per lane.
+  OcrServer(std::vector<std::unique_ptr<OcrBackend>> backends, FileDecoder decoder, size_t maxQueued = 64)
+      : backends_(std::move(backends)), decoder_(std::move(decoder)), jobs_(maxQueued) {}
+
+  ~OcrServer() { stop(); }
+
+  // Binds the socket and starts the workers; serve() then accepts clients
+  bool listen(const std::string &path) {
+    if (!socket_io::startup()) return false;
+    path_ = path;
+    sockaddr_un addr;
+    if (!socket_io::fillAddress(path, addr)) {
+      fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    DeleteFileA(path.c_str());
+#else
+    unlink(path.c_str());
+#endif
+    listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener_ == OCR_INVALID_SOCKET || bind(listener_, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        ::listen(listener_, 64) != 0) {
+      fprintf(stderr, "Failed to listen on %s\n", path.c_str());
+      return false;
+    }
+    for (size_t w = 0; w < backends_.size(); w++) {
+      workers_.emplace_back([this, w] { workerLoop(*backends_[w]); });
+    }
+    cores_.add((int64_t)backends_.size());
+    return true;
+  }
+
+  // Accepts clients until stop(); one thread per connection
+  void serve() {
+    while (!stopping_) {
+      socket_t client = accept(listener_, nullptr, nullptr);
+      if (client == OCR_INVALID_SOCKET) {
+        if (stopping_) break;
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(connectionsMutex_);
+      if (stopping_) {
+        socket_io::closeSocket(client);
+        break;
+      }
+      stats_.connections++;
+      reapConnections();
+      auto connection = std::make_unique<Connection>();
+      connection->socket = client;
+      Connection *c = connection.get();
+      connection->thread = std::thread([this, c] {
+        connectionLoop(c->socket);
+        c->done = true;
+      });
+      connections_.push_back(std::move(connection));
+    }
+  }
+
+  void stop() {
+    if (stopping_.exchange(true)) return;
+    if (listener_ != OCR_INVALID_SOCKET) {
+      socket_io::shutdownSocket(listener_);
+      socket_io::closeSocket(listener_);
+    }
+    // Unblocks connections waiting for a request; queued jobs still finish
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    for (auto &c : connections_) socket_io::shutdownSocket(c->socket);
+    jobs_.close();
+    for (auto &t : workers_) t.join();
+    for (auto &c : connections_) {
+      c->thread.join();
+      socket_io::closeSocket(c->socket);
+    }
+    connections_.clear();
+#ifdef _WIN32
+    DeleteFileA(path_.c_str());
+#else
+    unlink(path_.c_str());
+#endif
+  }
+
+  const ServerStats &stats() const { return stats_; }
+  SchedulerMetrics metrics() const { return jobs_.metrics(); }
+
+private:
+  struct Job {
+    uint32_t type = 0;
+    uint32_t flags = 0;
+    uint64_t id = 0; // client-chosen, with kJobId or for kJobCancel
+    // Waiting -> started (worker) or waiting -> cancelled (cancel request)
+    enum : int { kWaiting, kStarted, kCancelled };
+    std::atomic<int> state{kWaiting};
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    std::shared_ptr<CancelToken> cancel = std::make_shared<CancelToken>();
+    Img img{};
+    std::vector<uint8_t> pixels;
+    std::string path;
+    std::promise<std::pair<int32_t, std::string>> done;
+  };
+
+  void workerLoop(OcrBackend &backend) {
+    OcrPage page;
+    OutputBuffer text, record;
+    while (std::optional<JobScheduler<std::shared_ptr<Job>>::Entry> next = jobs_.pop()) {
+      Job &job = *next->item;
+      if (next->drop == JobDrop::kExpired) {
+        stats_.expired++;
+        job.done.set_value({kPageExpired, "deadline passed"});
+        continue;
+      }
+      int waiting = Job::kWaiting;
+      if (next->drop == JobDrop::kCancelled || !job.state.compare_exchange_strong(waiting, Job::kStarted)) {
+        stats_.cancelled++;
+        job.done.set_value({kPageCancelled, "cancelled"});
+        continue;
+      }
+      std::shared_ptr<void> keepAlive;
+      std::string error;
+      if (!job.path.empty()) {
+        if (decoder_) {
+          keepAlive = decoder_(job.path, job.img, error);
+        } else {
+          error = "path jobs are not supported by this server";
+        }
+        if (!keepAlive) {
+          stats_.failed++;
+          job.done.set_value({kPageUnreadable, error.empty() ? "can't read image: " + job.path : error});
+          continue;
+        }
+      }
+      if (!recognizePage(backend, job.img, page, (job.flags & kJobWords) ? kExtractWords : kExtractLines)) {
+        stats_.failed++;
+        job.done.set_value({kPageFailed, "OCR failed"});
+        continue;
+      }
+      encodeResult(page, (job.flags & kJobWords) != 0, text, record);
+      stats_.jobs++;
+      job.done.set_value({kPageOk, record.str()});
+    }
+  }
+
+  // Reads one request into job; false on a broken or malformed stream
+  bool readJob(socket_t s, Job &job, std::string &error) {
+    uint32_t magic = 0, type = 0;
+    if (!socket_io::readValue(s, magic) || magic != kRequestMagic) return false;
+    if (!socket_io::readValue(s, type) || !socket_io::readValue(s, job.flags)) return false;
+    job.type = type;
+    if (job.flags & kJobDeadline) {
+      uint32_t ms = 0;
+      if (!socket_io::readValue(s, ms)) return false;
+      job.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    }
+    if ((job.flags & kJobId) && !socket_io::readValue(s, job.id)) return false;
+    if (type == kJobStats) {
+      return true;
+    }
+    if (type == kJobCancel) {
+      return socket_io::readValue(s, job.id);
+    }
+    if (type == kJobPath) {
+      uint32_t len = 0;
+      if (!socket_io::readValue(s, len) || len == 0 || len > 65536) return false;
+      job.path.resize(len);
+      return socket_io::readAll(s, job.path.data(), len);
+    }
+    if (type == kJobBgra) {
+      int32_t width = 0, height = 0;
+      uint32_t stride = 0;
+      if (!socket_io::readValue(s, width) || !socket_io::readValue(s, height) || !socket_io::readValue(s, stride)) {
+        return false;
+      }
+      uint64_t bytes = (uint64_t)stride * (uint64_t)(height > 0 ? height : 0);
+      if (width <= 0 || height <= 0 || stride < (uint64_t)width * 4 || bytes > kMaxJobBytes) {
+        error = "bad frame size";
+        return false;
+      }
+      job.pixels.resize(bytes);
+      if (!socket_io::readAll(s, job.pixels.data(), bytes)) return false;
+      // The worker reads straight from the received bytes
+      job.img = {.t = 3, .col = width, .row = height, ._unk = 0, .step = stride,
+                 .data_ptr = (int64_t)job.pixels.data()};
+      return true;
+    }
+    error = "unknown job type";
+    return false;
+  }
+
+  static bool writeResponse(socket_t s, int32_t status, const std::string &payload) {
+    char header[12];
+    uint32_t len = (uint32_t)payload.size();
+    memcpy(header, &kResponseMagic, 4);
+    memcpy(header + 4, &status, 4);
+    memcpy(header + 8, &len, 4);
+    return socket_io::writeAll(s, header, sizeof(header)) && socket_io::writeAll(s, payload.data(), payload.size());
+  }
+
+  void connectionLoop(socket_t s) {
+    for (;;) {
+      auto job = std::make_shared<Job>();
+      std::string error;
+      if (!readJob(s, *job, error)) {
+        if (!error.empty()) writeResponse(s, kPageBadImage, error);
+        break;
+      }
+      if (job->type == kJobStats) {
+        if (!writeResponse(s, kPageOk, formatMetrics(jobs_.metrics()))) break;
+        continue;
+      }
+      if (job->type == kJobCancel) {
+        bool found = cancelJob(job->id);
+        if (!writeResponse(s, found ? kPageOk : kPageFailed, found ? "" : "no waiting job with that id")) break;
+        continue;
+      }
+      auto result = job->done.get_future();
+      JobLane lane = (job->flags & kJobBulk) ? kLaneBulk : kLaneInteractive;
+      bool registered = (job->flags & kJobId) != 0;
+      if (registered) {
+        std::lock_guard<std::mutex> lock(idsMutex_);
+        ids_.emplace(job->id, job);
+      }
+      bool queued = jobs_.push(job, lane, job->deadline, job->cancel);
+      // A client that hangs up no longer wants the answer
+      while (queued && result.wait_for(std::chrono::milliseconds(20)) != std::future_status::ready) {
+        if (!job->cancel->cancelled && socket_io::peerClosed(s)) job->cancel->cancel();
+      }
+      if (registered) forgetJob(job->id, job.get());
+      if (!queued) break;
+      auto [status, payload] = result.get();
+      if (!writeResponse(s, status, payload)) break;
+    }
+    // Closed by the reaper, so stop() never touches a reused handle
+    socket_io::shutdownSocket(s);
+  }
+
+  // Cancels every job under id that hasn't started; false if there was none
+  bool cancelJob(uint64_t id) {
+    std::lock_guard<std::mutex> lock(idsMutex_);
+    bool found = false;
+    auto [first, last] = ids_.equal_range(id);
+    for (auto it = first; it != last; ++it) {
+      int waiting = Job::kWaiting;
+      if (it->second->state.compare_exchange_strong(waiting, Job::kCancelled)) {
+        it->second->cancel->cancel(); // lets the scheduler drop it unseen
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  void forgetJob(uint64_t id, const Job *job) {
+    std::lock_guard<std::mutex> lock(idsMutex_);
+    auto [first, last] = ids_.equal_range(id);
+    for (auto it = first; it != last; ++it) {
+      if (it->second.get() == job) {
+        ids_.erase(it);
+        return;
+      }
+    }
+  }
+
+  // Joins finished connections; caller holds connectionsMutex_
+  void reapConnections() {
+    for (size_t i = 0; i < connections_.size();) {
+      if (connections_[i]->done) {
+        connections_[i]->thread.join();
+        socket_io::closeSocket(connections_[i]->socket);
+        connections_[i] = std::move(connections_.back());
+        connections_.pop_back();
+      } else {
+        i++;
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<OcrBackend>> backends_;
+  FileDecoder decoder_;
+  JobScheduler<std::shared_ptr<Job>> jobs_;
+  std::vector<std::thread> workers_;
+  CoreReservation cores_; // one per worker
+
+  std::string path_;
+  socket_t listener_ = OCR_INVALID_SOCKET;
+  std::atomic<bool> stopping_{false};
+  struct Connection {
+    socket_t socket = OCR_INVALID_SOCKET;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+  std::mutex connectionsMutex_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+  // Jobs submitted with an id, until answered
+  std::mutex idsMutex_;
+  std::unordered_multimap<uint64_t, std::shared_ptr<Job>> ids_;
+  ServerStats stats_;
+};
+
+// Blocking client for one connection
+class OcrClient {
+public:
+  ~OcrClient() {
+    if (socket_ != OCR_INVALID_SOCKET) socket_io::closeSocket(socket_);
+  }
+
+  bool connect(const std::string &path) {
+    if (!socket_io::startup()) return false;
+    sockaddr_un addr;
+    if (!socket_io::fillAddress(path, addr)) return false;
+    socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    return socket_ != OCR_INVALID_SOCKET && ::connect(socket_, (sockaddr *)&addr, sizeof(addr)) == 0;
+  }
+
+  // Sends a job and waits for its answer. status is 0 on success; payload is
+  // the response body described at the top of this file. deadlineMs = 0
+  // means no deadline; a nonzero jobId lets cancel() on another connection
+  // drop the job while it waits.
+  bool submitPath(const std::string &path, uint32_t flags, int32_t &status, std::string &payload,
+                  uint32_t deadlineMs = 0, uint64_t jobId = 0) {
+    std::string request = header(kJobPath, flags, deadlineMs, jobId);
+    appendValue(request, (uint32_t)path.size());
+    request += path;
+    return socket_io::writeAll(socket_, request.data(), request.size()) && readResponse(status, payload);
+  }
+
+  bool submitBgra(const uint8_t *pixels, int32_t width, int32_t height, uint32_t stride, uint32_t flags,
+                  int32_t &status, std::string &payload, uint32_t deadlineMs = 0, uint64_t jobId = 0) {
+    std::string request = header(kJobBgra, flags, deadlineMs, jobId);
+    appendValue(request, width);
+    appendValue(request, height);
+    appendValue(request, stride);
+    return socket_io::writeAll(socket_, request.data(), request.size()) &&
+           socket_io::writeAll(socket_, pixels, (size_t)stride * height) && readResponse(status, payload);
+  }
+
+  // The server's queue metrics, one line per lane
+  bool stats(std::string &metrics) {
+    std::string request = header(kJobStats, 0, 0);
+    int32_t status = -1;
+    return socket_io::writeAll(socket_, request.data(), request.size()) && readResponse(status, metrics) &&
+           status == kPageOk;
+  }
+
+  // Drops the waiting jobs submitted with jobId on any connection; false if
+  // there were none (never sent, already running or answered)
+  bool cancel(uint64_t jobId) {
+    std::string request = header(kJobCancel, 0, 0);
+    appendValue(request, jobId);
+    int32_t status = -1;
+    std::string payload;
+    return socket_io::writeAll(socket_, request.data(), request.size()) && readResponse(status, payload) &&
+           status == kPageOk;
+  }
+
+private:
+  template <class T>
+  static void appendValue(std::string &out, T v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+  }
+
+  static std::string header(uint32_t type, uint32_t flags, uint32_t deadlineMs, uint64_t jobId = 0) {
+    std::string out;
+    flags = deadlineMs ? flags | kJobDeadline : flags & ~kJobDeadline;
+    flags = jobId ? flags | kJobId : flags & ~kJobId;
+    appendValue(out, kRequestMagic);
+    appendValue(out, type);
+    appendValue(out, flags);
+    if (deadlineMs) appendValue(out, deadlineMs);
+    if (jobId) appendValue(out, jobId);
+    return out;
+  }
+
+  bool readResponse(int32_t &status, std::string &payload) {
+    uint32_t magic = 0, len = 0;
+    if (!socket_io::readValue(socket_, magic) || magic != kResponseMagic) return false;
+    if (!socket_io::readValue(socket_, status) || !socket_io::readValue(socket_, len)) return false;
+    payload.resize(len);
+    return socket_io::readAll(socket_, payload.data(), len);
+  }
+
+  socket_t socket_ = OCR_INVALID_SOCKET;
+};
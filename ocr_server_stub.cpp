@@ -0,0 +1,275 @@
+// Server and load generator built without OpenCV or oneocr.dll: the server
+// runs fake pipelines and only takes raw BGRA jobs. Used to load test the
+// socket protocol and the job queue on Linux, and the shared-memory ring
+// with a synthetic capture producer.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_backend.h"
+#include "ocr_server.h"
+#include "shm_ring.h"
+
+using namespace std;
+
+// Synthetic page; seed changes the pixels the fake backend hashes
+static vector<uint8_t> make_frame(int width, int height, uint32_t seed) {
+  vector<uint8_t> pixels((size_t)width * height * 4);
+  uint32_t x = seed * 2654435761u + 1;
+  for (auto &p : pixels) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    p = (uint8_t)x;
+  }
+  return pixels;
+}
+
+static double percentile(vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+  return sorted[i];
+}
+
+// Each client sends jobs back to back on its own connection. Bulk clients
+// (after the interactive ones) use the bulk lane and deadlineMs; their
+// expired jobs are counted apart from failures.
+static int load_test(const string &socket_path, int clients, int bulkClients, int jobs, int width, int height,
+                     uint32_t deadlineMs) {
+  using clock = chrono::steady_clock;
+  int total = clients + bulkClients;
+  vector<vector<double>> latencies(total);
+  vector<size_t> failures(total, 0), expired(total, 0);
+  auto start = clock::now();
+  vector<thread> threads;
+  for (int c = 0; c < total; c++) {
+    threads.emplace_back([&, c] {
+      bool bulk = c >= clients;
+      OcrClient client;
+      if (!client.connect(socket_path)) {
+        failures[c] = jobs;
+        return;
+      }
+      // A few distinct frames per client, reused so generation stays out of the timings
+      vector<vector<uint8_t>> frames;
+      for (uint32_t f = 0; f < 4; f++) frames.push_back(make_frame(width, height, c * 4 + f));
+      string payload;
+      for (int j = 0; j < jobs; j++) {
+        int32_t status = -1;
+        auto t0 = clock::now();
+        bool ok = client.submitBgra(frames[j % frames.size()].data(), width, height, width * 4,
+                                    bulk ? kJobWords | kJobBulk : kJobWords, status, payload, bulk ? deadlineMs : 0);
+        latencies[c].push_back(chrono::duration<double, milli>(clock::now() - t0).count());
+        if (ok && status == kPageExpired) {
+          expired[c]++;
+        } else if (!ok || status != kPageOk) {
+          failures[c]++;
+        }
+        if (!ok) break;
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  double seconds = chrono::duration<double>(clock::now() - start).count();
+
+  size_t failed = 0, sent = 0;
+  for (int lane = 0; lane < 2; lane++) {
+    vector<double> all;
+    size_t laneExpired = 0;
+    for (int c = lane ? clients : 0; c < (lane ? total : clients); c++) {
+      all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+      failed += failures[c];
+      laneExpired += expired[c];
+    }
+    if (all.empty()) continue;
+    sent += all.size();
+    sort(all.begin(), all.end());
+    printf("%-11s %zu jobs, %zu expired, latency ms: p50 %.2f  p95 %.2f  p99 %.2f  max %.2f\n",
+           lane ? "bulk" : "interactive", all.size(), laneExpired, percentile(all, 0.50), percentile(all, 0.95),
+           percentile(all, 0.99), all.back());
+  }
+  printf("%zu jobs from %d client(s) in %.2fs (%.1f jobs/s), %zu failed\n", sent, total, seconds,
+         seconds > 0 ? sent / seconds : 0.0, failed);
+  OcrClient client;
+  string metrics;
+  if (client.connect(socket_path) && client.stats(metrics)) {
+    printf("%s", metrics.c_str());
+  }
+  return failed ? 1 : 0;
+}
+
+// Synthetic capture producer: creates the ring, writes frames into the slots
+// and reads the results, keeping every slot in flight
+static int shm_test(const string &name, int frames, uint32_t slots, int width, int height) {
+  using clock = chrono::steady_clock;
+  ShmProducer producer;
+  if (!producer.create(name, slots, (uint64_t)width * height * 4)) {
+    return -1;
+  }
+  vector<vector<uint8_t>> images;
+  for (uint32_t f = 0; f < 4; f++) images.push_back(make_frame(width, height, f));
+  vector<clock::time_point> published(frames);
+  vector<double> latencies;
+  size_t failed = 0;
+  string payload;
+  auto collect = [&](uint64_t sequence) {
+    int32_t status = -1;
+    if (!producer.result(sequence, status, payload, chrono::seconds(10))) {
+      return false;
+    }
+    latencies.push_back(chrono::duration<double, milli>(clock::now() - published[sequence]).count());
+    if (status != kPageOk || payload.size() < 4) failed++;
+    return true;
+  };
+
+  auto start = clock::now();
+  int collected = 0, sent = 0;
+  for (int f = 0; f < frames; f++) {
+    // The slot of frame f frees up once the result of f - slots is read
+    if (f >= (int)slots && !collect(collected++)) break;
+    uint8_t *slot = producer.acquire((uint64_t)width * height * 4);
+    if (!slot) {
+      fprintf(stderr, "No free frame slot for frame %d (consumer stuck or gone)\n", f);
+      break;
+    }
+    // Stands in for the capture API writing the frame
+    memcpy(slot, images[f % images.size()].data(), (size_t)width * height * 4);
+    published[f] = clock::now();
+    producer.publish(width, height, width * 4, kJobWords);
+    sent++;
+  }
+  while (collected < sent && collect(collected)) collected++;
+  producer.close();
+  double seconds = chrono::duration<double>(clock::now() - start).count();
+
+  sort(latencies.begin(), latencies.end());
+  failed += frames - collected;
+  printf("%d frames through %u slot(s) in %.2fs (%.1f frames/s), %zu failed\n", collected, slots, seconds,
+         seconds > 0 ? collected / seconds : 0.0, failed);
+  printf("latency ms: p50 %.2f  p95 %.2f  p99 %.2f  max %.2f\n", percentile(latencies, 0.50),
+         percentile(latencies, 0.95), percentile(latencies, 0.99), latencies.empty() ? 0.0 : latencies.back());
+  return failed ? 1 : 0;
+}
+
+static void print_usage() {
+  printf("Usage: ocr_server_stub --serve <socket_path> [--workers N] [--fake-latency-ms N]\n"
+         "       ocr_server_stub --load-test <socket_path> [--clients N] [--jobs N] [--size WxH] [--spawn]\n"
+         "         [--bulk-clients N] [--deadline-ms N]\n"
+         "       ocr_server_stub --shm-serve <name> [--workers N] [--fake-latency-ms N]\n"
+         "       ocr_server_stub --shm-test <name> [--frames N] [--slots N] [--size WxH] [--spawn]\n"
+         "         (--spawn runs the server in this process with the --workers / --fake-latency-ms settings)\n");
+}
+
+int main(int argc, char *argv[]) {
+  string socket_path;
+  bool serveMode = false, loadMode = false, spawn = false, shmServe = false, shmTest = false;
+  int workers = 2, clients = 8, bulkClients = 0, jobs = 50, width = 1600, height = 2400, frames = 200, slots = 4;
+  string shm_name;
+  chrono::microseconds latency{0};
+  uint32_t deadlineMs = 0;
+  for (int i = 1; i < argc; ++i) {
+    string a = argv[i];
+    if (a == "--serve" && i + 1 < argc) {
+      serveMode = true;
+      socket_path = argv[++i];
+    } else if (a == "--load-test" && i + 1 < argc) {
+      loadMode = true;
+      socket_path = argv[++i];
+    } else if (a == "--shm-serve" && i + 1 < argc) {
+      shmServe = true;
+      shm_name = argv[++i];
+    } else if (a == "--shm-test" && i + 1 < argc) {
+      shmTest = true;
+      shm_name = argv[++i];
+    } else if (a == "--frames" && i + 1 < argc) {
+      frames = max(atoi(argv[++i]), 1);
+    } else if (a == "--slots" && i + 1 < argc) {
+      slots = max(atoi(argv[++i]), 1);
+    } else if (a == "--workers" && i + 1 < argc) {
+      workers = max(atoi(argv[++i]), 1);
+    } else if (a == "--fake-latency-ms" && i + 1 < argc) {
+      latency = chrono::milliseconds(atoi(argv[++i]));
+    } else if (a == "--clients" && i + 1 < argc) {
+      clients = max(atoi(argv[++i]), 1);
+    } else if (a == "--bulk-clients" && i + 1 < argc) {
+      bulkClients = max(atoi(argv[++i]), 0);
+    } else if (a == "--deadline-ms" && i + 1 < argc) {
+      deadlineMs = (uint32_t)max(atoi(argv[++i]), 0);
+    } else if (a == "--jobs" && i + 1 < argc) {
+      jobs = max(atoi(argv[++i]), 1);
+    } else if (a == "--size" && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+        print_usage();
+        return -1;
+      }
+    } else if (a == "--spawn") {
+      spawn = true;
+    }
+  }
+  if (serveMode + loadMode + shmServe + shmTest != 1) {
+    print_usage();
+    return 0;
+  }
+
+  auto fake_backends = [&] {
+    vector<unique_ptr<OcrBackend>> backends;
+    for (int w = 0; w < workers; w++) backends.push_back(make_unique<FakeOcrBackend>(1000, latency));
+    return backends;
+  };
+  if (shmServe || shmTest) {
+    // The consumer waits for the producer to create the ring
+    auto consume = [&](chrono::milliseconds timeout) {
+      ShmConsumer consumer;
+      if (!consumer.waitFor(shm_name, timeout)) {
+        fprintf(stderr, "No ring named %s\n", shm_name.c_str());
+        return;
+      }
+      vector<unique_ptr<OcrBackend>> backends = fake_backends();
+      consumer.run(backends);
+      printf("Consumer handled %llu frame(s), %llu failed\n", (unsigned long long)consumer.stats().frames,
+             (unsigned long long)consumer.stats().failed);
+      if (consumer.producerLost()) printf("Producer exited without closing the ring\n");
+    };
+    if (shmServe) {
+      consume(chrono::minutes(10));
+      return 0;
+    }
+    thread consumer;
+    if (spawn) consumer = thread(consume, chrono::seconds(10));
+    int result = shm_test(shm_name, frames, (uint32_t)slots, width, height);
+    if (consumer.joinable()) consumer.join();
+    return result;
+  }
+
+  unique_ptr<OcrServer> server;
+  thread acceptor;
+  if (serveMode || spawn) {
+    server = make_unique<OcrServer>(fake_backends(), nullptr);
+    if (!server->listen(socket_path)) {
+      return -1;
+    }
+    printf("Serving on %s with %d fake worker(s)\n", socket_path.c_str(), workers);
+    if (serveMode) {
+      server->serve();
+      return 0;
+    }
+    acceptor = thread([&] { server->serve(); });
+  }
+
+  int result = load_test(socket_path, clients, bulkClients, jobs, width, height, deadlineMs);
+  if (server) {
+    server->stop();
+    acceptor.join();
+    printf("Server handled %llu job(s) over %llu connection(s), %llu expired, %llu cancelled\n",
+           (unsigned long long)server->stats().jobs, (unsigned long long)server->stats().connections,
+           (unsigned long long)server->stats().expired, (unsigned long long)server->stats().cancelled);
+  }
+  return result;
+}
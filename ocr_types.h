@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Image descriptor passed to RunOcrPipeline (BGRA, t = 3)
+typedef struct {
+  int32_t t;
+  int32_t col;
+  int32_t row;
+  int32_t _unk;
+  int64_t step;
+  int64_t data_ptr;
+} Img;
+static_assert(sizeof(Img) == 0x20, "Img layout must match oneocr.dll");
+
+// Job status: PageResult::status, and the status of socket server and
+// shared-memory ring responses
+constexpr int32_t kPageOk = 0;
+constexpr int32_t kPageUnreadable = 1; // image file missing or not decodable
+constexpr int32_t kPageFailed = 2;     // the engine returned no result
+constexpr int32_t kPageBadImage = 3;   // bad pixels or a malformed request
+constexpr int32_t kPageTooLarge = 4;   // answer doesn't fit a ring result slot
+constexpr int32_t kPageCancelled = 5;
+constexpr int32_t kPageExpired = 6;
+
+// Text of a line or word: a slice of OcrPage::text
+struct TextRef {
+  uint32_t offset = 0;
+  uint32_t size = 0;
+};
+
+// Everything extracted from one OCR result. All text sits in one arena and
+// the geometry in one array per field (index = line or word), so a page is a
+// handful of allocations, and none once the page object is reused.
+struct OcrPage {
+  // Image height, used for the grouping distance
+  int imageHeight = 0;
+  // Line and word text, back to back
+  std::string text;
+
+  // Lines: axis-aligned box, its center, and up to three corners as
+  // reported by the engine (x1 y1 x2 y2 x3 y3 per line)
+  std::vector<TextRef> lineText;
+  std::vector<float> x, y, width, height;
+  std::vector<float> centerX, centerY;
+  std::vector<int32_t> cornerCount;
+  std::vector<float> corners;
+
+  // Words of line i are [wordBegin[i], wordBegin[i + 1]); box is x y width
+  // height per word
+  std::vector<uint32_t> wordBegin{0};
+  std::vector<TextRef> wordText;
+  std::vector<float> wordBox;
+
+  size_t lineCount() const { return lineText.size(); }
+  size_t wordCount() const { return wordText.size(); }
+  std::string_view content(TextRef ref) const { return std::string_view(text).substr(ref.offset, ref.size); }
+  std::string_view lineContent(size_t line) const { return content(lineText[line]); }
+  std::string_view wordContent(size_t word) const { return content(wordText[word]); }
+  const float *lineCorners(size_t line) const { return &corners[line * 6]; }
+  const float *wordBoxOf(size_t word) const { return &wordBox[word * 4]; }
+
+  // Empties the page, keeping capacity
+  void clear() {
+    text.clear();
+    lineText.clear();
+    x.clear();
+    y.clear();
+    width.clear();
+    height.clear();
+    centerX.clear();
+    centerY.clear();
+    cornerCount.clear();
+    corners.clear();
+    wordBegin.assign(1, 0);
+    wordText.clear();
+    wordBox.clear();
+  }
+
+  void reserve(size_t lines) {
+    lineText.reserve(lines);
+    for (auto *v : {&x, &y, &width, &height, &centerX, &centerY}) v->reserve(lines);
+    cornerCount.reserve(lines);
+    corners.reserve(lines * 6);
+    wordBegin.reserve(lines + 1);
+  }
+
+  TextRef addText(std::string_view s) {
+    TextRef ref{(uint32_t)text.size(), (uint32_t)s.size()};
+    text.append(s);
+    return ref;
+  }
+
+  // box is x y width height, lineCorners x1 y1 x2 y2 x3 y3
+  void addLine(std::string_view content, const float *box, float cx, float cy, int32_t count,
+               const float *lineCorners) {
+    lineText.push_back(addText(content));
+    x.push_back(box[0]);
+    y.push_back(box[1]);
+    width.push_back(box[2]);
+    height.push_back(box[3]);
+    centerX.push_back(cx);
+    centerY.push_back(cy);
+    cornerCount.push_back(count);
+    corners.insert(corners.end(), lineCorners, lineCorners + 6);
+    wordBegin.push_back(wordBegin.back());
+  }
+
+  // Appends the lines and words of another page
+  void append(const OcrPage &other) {
+    uint32_t textBase = (uint32_t)text.size(), wordBase = wordBegin.back();
+    text.append(other.text);
+    for (TextRef ref : other.lineText) lineText.push_back({ref.offset + textBase, ref.size});
+    for (TextRef ref : other.wordText) wordText.push_back({ref.offset + textBase, ref.size});
+    auto extend = [](std::vector<float> &to, const std::vector<float> &from) {
+      to.insert(to.end(), from.begin(), from.end());
+    };
+    extend(x, other.x);
+    extend(y, other.y);
+    extend(width, other.width);
+    extend(height, other.height);
+    extend(centerX, other.centerX);
+    extend(centerY, other.centerY);
+    extend(corners, other.corners);
+    extend(wordBox, other.wordBox);
+    cornerCount.insert(cornerCount.end(), other.cornerCount.begin(), other.cornerCount.end());
+    for (size_t i = 1; i < other.wordBegin.size(); i++) wordBegin.push_back(other.wordBegin[i] + wordBase);
+  }
+
+  // Adds a word to the last line
+  void addWord(std::string_view content, const float *box) {
+    wordText.push_back(addText(content));
+    wordBox.insert(wordBox.end(), box, box + 4);
+    wordBegin.back()++;
+  }
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+// OcrBackend over oneocr.dll from SnippingTool (Windows only)
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <stdio.h>
+#include <type_traits>
+
+#include "ocr_backend.h"
+#include "trace.h"
+
+typedef __int64(__cdecl *CreateOcrInitOptions_t)(__int64 *);
+typedef __int64(__cdecl *GetOcrLineCount_t)(__int64, __int64 *);
+typedef __int64(__cdecl *GetOcrLine_t)(__int64, __int64, __int64 *);
+typedef __int64(__cdecl *GetOcrLineContent_t)(__int64, __int64 *);
+typedef __int64(__cdecl *GetOcrLineBoundingBox_t)(__int64, __int64 *);
+typedef __int64(__cdecl *GetOcrLineWordCount_t)(__int64, __int64 *);
+typedef __int64(__cdecl *GetOcrWord_t)(__int64, __int64, __int64 *);
+typedef __int64(__cdecl *GetOcrWordContent_t)(__int64, __int64 *);
+typedef __int64(__cdecl *GetOcrWordBoundingBox_t)(__int64, __int64 *);
+typedef __int64(__cdecl *OcrProcessOptionsSetMaxRecognitionLineCount_t)(
+    __int64, __int64);
+typedef __int64(__cdecl *RunOcrPipeline_t)(__int64, Img *, __int64, __int64 *);
+typedef __int64(__cdecl *CreateOcrProcessOptions_t)(__int64 *);
+typedef __int64(__cdecl *OcrInitOptionsSetUseModelDelayLoad_t)(__int64, char);
+typedef __int64(__cdecl *CreateOcrPipeline_t)(__int64, __int64, __int64,
+                                              __int64 *);
+typedef void(__cdecl *ReleaseOcrHandle_t)(__int64);
+
+// Key for the model shipped with SnippingTool
+static const char *kOneOcrModelKey = "kj)TGtrK>f]b[Piow.gU+nC@s\"\"\"\"\"\"4";
+
+// Entry points of oneocr.dll, resolved once per process
+struct OneOcrApi {
+  CreateOcrInitOptions_t CreateOcrInitOptions = nullptr;
+  OcrInitOptionsSetUseModelDelayLoad_t OcrInitOptionsSetUseModelDelayLoad = nullptr;
+  CreateOcrPipeline_t CreateOcrPipeline = nullptr;
+  CreateOcrProcessOptions_t CreateOcrProcessOptions = nullptr;
+  OcrProcessOptionsSetMaxRecognitionLineCount_t OcrProcessOptionsSetMaxRecognitionLineCount = nullptr;
+  RunOcrPipeline_t RunOcrPipeline = nullptr;
+  GetOcrLineCount_t GetOcrLineCount = nullptr;
+  GetOcrLine_t GetOcrLine = nullptr;
+  GetOcrLineContent_t GetOcrLineContent = nullptr;
+  GetOcrLineBoundingBox_t GetOcrLineBoundingBox = nullptr;
+  GetOcrLineWordCount_t GetOcrLineWordCount = nullptr;
+  GetOcrWord_t GetOcrWord = nullptr;
+  GetOcrWordContent_t GetOcrWordContent = nullptr;
+  GetOcrWordBoundingBox_t GetOcrWordBoundingBox = nullptr;
+  // Optional, older builds may not export them
+  ReleaseOcrHandle_t ReleaseOcrResult = nullptr;
+  ReleaseOcrHandle_t ReleaseOcrProcessOptions = nullptr;
+  ReleaseOcrHandle_t ReleaseOcrPipeline = nullptr;
+  ReleaseOcrHandle_t ReleaseOcrInitOptions = nullptr;
+
+  bool load(const char *dllName = "oneocr.dll") {
+    HINSTANCE hDLL = LoadLibraryA(dllName);
+    if (hDLL == NULL) {
+      fprintf(stderr, "Failed to load DLL: %lu\n", (unsigned long)GetLastError());
+      return false;
+    }
+    bool ok = true;
+    auto resolve = [&](auto &fn, const char *name, bool required = true) {
+      fn = reinterpret_cast<std::remove_reference_t<decltype(fn)>>(GetProcAddress(hDLL, name));
+      if (!fn && required) {
+        fprintf(stderr, "Missing export in %s: %s\n", dllName, name);
+        ok = false;
+      }
+    };
+    resolve(CreateOcrInitOptions, "CreateOcrInitOptions");
+    resolve(OcrInitOptionsSetUseModelDelayLoad, "OcrInitOptionsSetUseModelDelayLoad");
+    resolve(CreateOcrPipeline, "CreateOcrPipeline");
+    resolve(CreateOcrProcessOptions, "CreateOcrProcessOptions");
+    resolve(OcrProcessOptionsSetMaxRecognitionLineCount, "OcrProcessOptionsSetMaxRecognitionLineCount");
+    resolve(RunOcrPipeline, "RunOcrPipeline");
+    resolve(GetOcrLineCount, "GetOcrLineCount");
+    resolve(GetOcrLine, "GetOcrLine");
+    resolve(GetOcrLineContent, "GetOcrLineContent");
+    resolve(GetOcrLineBoundingBox, "GetOcrLineBoundingBox");
+    resolve(GetOcrLineWordCount, "GetOcrLineWordCount");
+    resolve(GetOcrWord, "GetOcrWord");
+    resolve(GetOcrWordContent, "GetOcrWordContent");
+    resolve(GetOcrWordBoundingBox, "GetOcrWordBoundingBox");
+    resolve(ReleaseOcrResult, "ReleaseOcrResult", false);
+    resolve(ReleaseOcrProcessOptions, "ReleaseOcrProcessOptions", false);
+    resolve(ReleaseOcrPipeline, "ReleaseOcrPipeline", false);
+    resolve(ReleaseOcrInitOptions, "ReleaseOcrInitOptions", false);
+    return ok;
+  }
+};
+
+// One pipeline + process options created through a loaded OneOcrApi
+class OneOcrBackend : public OcrBackend {
+public:
+  explicit OneOcrBackend(const OneOcrApi &api) : api_(api) {}
+  OneOcrBackend(const OneOcrBackend &) = delete;
+  OneOcrBackend &operator=(const OneOcrBackend &) = delete;
+
+  ~OneOcrBackend() override {
+    if (opt_ && api_.ReleaseOcrProcessOptions) api_.ReleaseOcrProcessOptions(opt_);
+    if (pipeline_ && api_.ReleaseOcrPipeline) api_.ReleaseOcrPipeline(pipeline_);
+    if (ctx_ && api_.ReleaseOcrInitOptions) api_.ReleaseOcrInitOptions(ctx_);
+  }
+
+  // Loads the model; returns false (with a message) on failure
+  bool init(const char *modelPath, bool delayLoad, __int64 maxLines) {
+    __int64 res = api_.CreateOcrInitOptions(&ctx_);
+    if (res == 0) res = api_.OcrInitOptionsSetUseModelDelayLoad(ctx_, delayLoad ? 1 : 0);
+    if (res == 0) res = api_.CreateOcrPipeline((__int64)modelPath, (__int64)kOneOcrModelKey, ctx_, &pipeline_);
+    if (res != 0) {
+      fprintf(stderr, "Failed to create OCR pipeline from %s: %lld\n", modelPath, res);
+      return false;
+    }
+    res = api_.CreateOcrProcessOptions(&opt_);
+    if (res == 0) res = api_.OcrProcessOptionsSetMaxRecognitionLineCount(opt_, maxLines);
+    if (res != 0) {
+      fprintf(stderr, "Failed to create OCR process options: %lld\n", res);
+      return false;
+    }
+    return true;
+  }
+
+  int64_t run(const Img &img) override {
+    Img ig = img;
+    __int64 instance = 0;
+    __int64 res = api_.RunOcrPipeline(pipeline_, &ig, opt_, &instance);
+    trace::log("Running ocr pipeline...\n");
+    trace::log("\t ctx: 0x%llx, pipeline: 0x%llx, opt: 0x%llx, instance: "
+               "0x%llx\n",
+               ctx_, pipeline_, opt_, instance);
+    if (res != 0) {
+      fprintf(stderr, "RunOcrPipeline failed: %lld\n", res);
+      return 0;
+    }
+    return instance;
+  }
+
+  void releaseResult(int64_t instance) override {
+    if (api_.ReleaseOcrResult) api_.ReleaseOcrResult(instance);
+  }
+
+  int64_t lineCount(int64_t instance) override {
+    __int64 lc = 0;
+    if (api_.GetOcrLineCount(instance, &lc) != 0) return 0;
+    return lc;
+  }
+  int64_t line(int64_t instance, int64_t index) override {
+    __int64 line = 0;
+    api_.GetOcrLine(instance, index, &line);
+    return line;
+  }
+  const char *lineContent(int64_t line) override {
+    __int64 content = 0;
+    api_.GetOcrLineContent(line, &content);
+    return reinterpret_cast<const char *>(content);
+  }
+  const float *lineBoundingBox(int64_t line) override {
+    __int64 bbox = 0;
+    api_.GetOcrLineBoundingBox(line, &bbox);
+    return reinterpret_cast<const float *>(bbox);
+  }
+
+  int64_t wordCount(int64_t line) override {
+    __int64 count = 0;
+    api_.GetOcrLineWordCount(line, &count);
+    return count;
+  }
+  int64_t word(int64_t line, int64_t index) override {
+    __int64 word = 0;
+    api_.GetOcrWord(line, index, &word);
+    return word;
+  }
+  const char *wordContent(int64_t word) override {
+    __int64 content = 0;
+    api_.GetOcrWordContent(word, &content);
+    return reinterpret_cast<const char *>(content);
+  }
+  const float *wordBoundingBox(int64_t word) override {
+    __int64 bbox = 0;
+    api_.GetOcrWordBoundingBox(word, &bbox);
+    return reinterpret_cast<const float *>(bbox);
+  }
+  // Nothing says the Get* accessors of oneocr.dll are safe to call from
+  // several threads, so large pages are extracted on one
+  bool concurrentReads() const override { return false; }
+
+private:
+  const OneOcrApi &api_;
+  __int64 ctx_ = 0;
+  __int64 pipeline_ = 0;
+  __int64 opt_ = 0;
+};
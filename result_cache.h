@@ -0,0 +1,449 @@
+#pragma once
+
+// Result cache keyed by the decoded pixels and the backend that recognized
+// them. Byte-identical images are found by a 64-bit content hash;
+// near-identical ones (re-encodes, compression noise) optionally by a 64-bit
+// difference hash of a 9x8 luminance grid. Near candidates come from buckets
+// of dHash bands and are confirmed against a 32x32 grid of mean luminance
+// before their page is reused. A hit returns the stored page, which then
+// goes through grouping and the writers like a fresh result.
+//
+// The index is an append-only file:
+//   "OCRC" u32 version
+//   per entry: u64 pixelHash, u64 dHash, i32 width, i32 height,
+//              u32 backend, u32 gridLen, grid bytes (0 or kCacheGridCells),
+//              u32 recordLen, page record (see serializePage)
+// A torn last entry (killed mid-write) is cut off on load.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ocr_types.h"
+#include "serializer.h"
+
+namespace cache_detail {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+
+inline uint64_t rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+// FNV-1a of a name, for the backend tag
+inline uint32_t nameHash(std::string_view name) {
+  uint32_t h = 2166136261u;
+  for (char c : name) h = (h ^ (uint8_t)c) * 16777619u;
+  return h;
+}
+inline uint64_t mix(uint64_t acc, uint64_t v) { return rotl(acc + v * kPrime2, 31) * kPrime1; }
+inline uint64_t load64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline int popcount(uint64_t v) {
+  int n = 0;
+  for (; v; n++) v &= v - 1;
+  return n;
+}
+
+} // namespace cache_detail
+
+// Hash of the visible BGRA pixels (row padding excluded) and the size.
+// Four independent lanes per 32 bytes, so it runs at memory speed.
+inline uint64_t hashPixels(const Img &img) {
+  using namespace cache_detail;
+  uint64_t lanes[4] = {kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1};
+  const size_t rowBytes = (size_t)img.col * 4;
+  for (int32_t y = 0; y < img.row; y++) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(img.data_ptr) + (size_t)y * img.step;
+    size_t i = 0;
+    for (; i + 32 <= rowBytes; i += 32) {
+      for (int k = 0; k < 4; k++) lanes[k] = mix(lanes[k], load64(p + i + 8 * k));
+    }
+    for (; i + 8 <= rowBytes; i += 8) lanes[0] = mix(lanes[0], load64(p + i));
+    if (i < rowBytes) {
+      uint64_t tail = 0;
+      memcpy(&tail, p + i, rowBytes - i);
+      lanes[1] = mix(lanes[1], tail);
+    }
+  }
+  uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+  h = mix(h, ((uint64_t)(uint32_t)img.col << 32) | (uint32_t)img.row);
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  return h;
+}
+
+// Difference hash: mean luminance of a 9x8 grid of cells (each sampled on a
+// 16x16 lattice), bit set where a cell is brighter than its right neighbour
+// by more than one grey level, so flat paper doesn't flip on sensor noise
+inline uint64_t dHashPixels(const Img &img) {
+  if (img.col <= 0 || img.row <= 0) return 0;
+  float cells[8][9];
+  for (int cy = 0; cy < 8; cy++) {
+    for (int cx = 0; cx < 9; cx++) {
+      uint32_t sum = 0;
+      for (int sy = 0; sy < 16; sy++) {
+        int32_t y = (int32_t)(((int64_t)cy * 16 + sy) * img.row / 128);
+        const uint8_t *row = reinterpret_cast<const uint8_t *>(img.data_ptr) + (size_t)y * img.step;
+        for (int sx = 0; sx < 16; sx++) {
+          int32_t x = (int32_t)(((int64_t)cx * 16 + sx) * img.col / 144);
+          const uint8_t *px = row + (size_t)x * 4;
+          sum += (px[0] * 29u + px[1] * 150u + px[2] * 77u) >> 8;
+        }
+      }
+      cells[cy][cx] = (float)sum;
+    }
+  }
+  uint64_t h = 0;
+  for (int cy = 0; cy < 8; cy++) {
+    for (int cx = 0; cx < 8; cx++) {
+      h = (h << 1) | (cells[cy][cx] > cells[cy][cx + 1] + 256 ? 1 : 0);
+    }
+  }
+  return h;
+}
+
+// Side of the confirmation grid
+constexpr int kCacheGrid = 32;
+constexpr size_t kCacheGridCells = kCacheGrid * kCacheGrid;
+
+// Mean luminance of each cell of a 32x32 grid over every pixel. Finer than
+// the dHash, so a form filled in differently moves some cell by several
+// levels, while re-encoding noise stays within a level or two.
+inline std::vector<uint8_t> gridPixels(const Img &img) {
+  std::vector<uint8_t> grid;
+  if (img.col < kCacheGrid || img.row < kCacheGrid) return grid;
+  std::vector<uint64_t> sums(kCacheGridCells, 0);
+  std::vector<uint16_t> column(img.col);
+  for (int32_t x = 0; x < img.col; x++) column[x] = (uint16_t)((int64_t)x * kCacheGrid / img.col);
+  for (int32_t y = 0; y < img.row; y++) {
+    const uint8_t *px = reinterpret_cast<const uint8_t *>(img.data_ptr) + (size_t)y * img.step;
+    uint64_t *row = &sums[(size_t)((int64_t)y * kCacheGrid / img.row) * kCacheGrid];
+    for (int32_t x = 0; x < img.col; x++, px += 4) row[column[x]] += (px[0] * 29u + px[1] * 150u + px[2] * 77u) >> 8;
+  }
+  grid.resize(kCacheGridCells);
+  for (int cy = 0; cy < kCacheGrid; cy++) {
+    int64_t h = (int64_t)(cy + 1) * img.row / kCacheGrid - (int64_t)cy * img.row / kCacheGrid;
+    for (int cx = 0; cx < kCacheGrid; cx++) {
+      int64_t w = (int64_t)(cx + 1) * img.col / kCacheGrid - (int64_t)cx * img.col / kCacheGrid;
+      grid[cy * kCacheGrid + cx] = (uint8_t)(sums[cy * kCacheGrid + cx] / (uint64_t)(w * h));
+    }
+  }
+  return grid;
+}
+
+// Every field of the page, so a replayed page is exactly what the engine
+// gave. Word centers are part of the record format; they follow from the box.
+inline void serializePage(OutputBuffer &out, const OcrPage &page) {
+  out.appendRaw((int32_t)page.imageHeight);
+  out.appendRaw((uint32_t)page.lineCount());
+  for (size_t i = 0; i < page.lineCount(); i++) {
+    out.appendSized(page.lineContent(i));
+    const float box[6] = {page.x[i], page.y[i], page.width[i], page.height[i], page.centerX[i], page.centerY[i]};
+    for (float c : box) out.appendRaw(c);
+    out.appendRaw(page.cornerCount[i]);
+    const float *corners = page.lineCorners(i);
+    for (int k = 0; k < 6; k++) out.appendRaw(corners[k]);
+    out.appendRaw(page.wordBegin[i + 1] - page.wordBegin[i]);
+    for (uint32_t w = page.wordBegin[i]; w < page.wordBegin[i + 1]; w++) {
+      out.appendSized(page.wordContent(w));
+      const float *wb = page.wordBoxOf(w);
+      const float c[6] = {wb[0], wb[1], wb[2], wb[3], wb[0] + wb[2] / 2, wb[1] + wb[3] / 2};
+      for (float v : c) out.appendRaw(v);
+    }
+  }
+}
+
+class RecordReader {
+public:
+  RecordReader(const char *data, size_t size) : p_(data), end_(data + size) {}
+
+  template <class T>
+  bool read(T &v) {
+    if ((size_t)(end_ - p_) < sizeof(T)) return false;
+    memcpy(&v, p_, sizeof(T));
+    p_ += sizeof(T);
+    return true;
+  }
+
+  // s points into the record
+  bool readSized(std::string_view &s) {
+    uint32_t len = 0;
+    if (!read(len) || (size_t)(end_ - p_) < len) return false;
+    s = std::string_view(p_, len);
+    p_ += len;
+    return true;
+  }
+
+  template <class T>
+  bool readArray(T *v, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      if (!read(v[i])) return false;
+    }
+    return true;
+  }
+
+private:
+  const char *p_;
+  const char *end_;
+};
+
+inline bool parsePage(const char *data, size_t size, OcrPage &page) {
+  RecordReader in(data, size);
+  int32_t imageHeight = 0;
+  uint32_t lineCount = 0;
+  if (!in.read(imageHeight) || !in.read(lineCount) || lineCount > size) return false;
+  page.clear();
+  page.reserve(lineCount);
+  page.imageHeight = imageHeight;
+  for (uint32_t i = 0; i < lineCount; i++) {
+    std::string_view text;
+    float box[6], corners[6];
+    int32_t cornerCount = 0;
+    uint32_t wordCount = 0;
+    if (!in.readSized(text) || !in.readArray(box, 6) || !in.read(cornerCount) || !in.readArray(corners, 6) ||
+        !in.read(wordCount)) {
+      return false;
+    }
+    page.addLine(text, box, box[4], box[5], cornerCount, corners);
+    for (uint32_t w = 0; w < wordCount; w++) {
+      float wb[6];
+      if (!in.readSized(text) || !in.readArray(wb, 6)) return false;
+      page.addWord(text, wb);
+    }
+  }
+  return true;
+}
+
+struct CacheKey {
+  uint64_t pixelHash = 0;
+  uint64_t dHash = 0;
+  int32_t width = 0, height = 0;
+  uint32_t backend = 0;      // nameHash of the backend
+  std::vector<uint8_t> grid; // gridPixels; only with near matching
+};
+
+// Thread safe: lookups share a lock, inserts append under an exclusive one
+class ResultCache {
+public:
+  static constexpr uint32_t kVersion = 2;
+  // Near matching uses dHash bands below this distance, a full scan above
+  static constexpr int kMaxBands = 16;
+  // Grid confirmation: largest cell difference and mean cell difference
+  static constexpr int kGridMaxDiff = 8;
+  static constexpr int kGridMeanDiff = 2;
+
+  ~ResultCache() {
+    if (file_) fclose(file_);
+  }
+
+  // maxNearDistance < 0 disables near-duplicate matching; otherwise images
+  // of the same size whose dHash differs in at most that many bits match,
+  // if their grids agree. Only entries made by the named backend are used.
+  bool open(const std::string &path, int maxNearDistance, std::string_view backend) {
+    maxNearDistance_ = maxNearDistance;
+    bands_ = maxNearDistance >= 0 && maxNearDistance < kMaxBands ? maxNearDistance + 1 : 0;
+    backend_ = cache_detail::nameHash(backend);
+    std::error_code ec;
+    uintmax_t good = 0;
+    if (std::filesystem::exists(path, ec)) {
+      good = load(path);
+      if (good == 0) {
+        fprintf(stderr, "Ignoring unreadable cache index %s\n", path.c_str());
+      } else if (good != std::filesystem::file_size(path, ec)) {
+        std::filesystem::resize_file(path, good, ec); // drop a torn last entry
+      }
+    }
+    file_ = fopen(path.c_str(), good ? "ab" : "wb");
+    if (!file_) {
+      fprintf(stderr, "Failed to open cache index %s\n", path.c_str());
+      return false;
+    }
+    if (!good) {
+      fwrite("OCRC", 1, 4, file_);
+      fwrite(&kVersion, sizeof(kVersion), 1, file_);
+      fflush(file_);
+    }
+    return true;
+  }
+
+  // Key for an image; the dHash and grid are only computed when near
+  // matching is on
+  CacheKey keyOf(const Img &img) const {
+    CacheKey key;
+    key.pixelHash = hashPixels(img);
+    if (maxNearDistance_ >= 0) {
+      key.dHash = dHashPixels(img);
+      key.grid = gridPixels(img);
+    }
+    key.width = img.col;
+    key.height = img.row;
+    key.backend = backend_;
+    return key;
+  }
+
+  bool lookup(const CacheKey &key, OcrPage &page) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = byPixels_.find(exactKey(key));
+    if (it != byPixels_.end() && sameImage(entries_[it->second].key, key)) {
+      hits_++;
+      return parsePage(entries_[it->second].record.data(), entries_[it->second].record.size(), page);
+    }
+    if (maxNearDistance_ >= 0 && !key.grid.empty()) {
+      const Entry *best = nullptr;
+      int bestDistance = maxNearDistance_ + 1;
+      auto consider = [&](const Entry &e) {
+        if (e.key.width == key.width && e.key.height == key.height && e.key.backend == key.backend) {
+          int d = cache_detail::popcount(e.key.dHash ^ key.dHash);
+          if (d < bestDistance && gridsAgree(e.key.grid, key.grid)) {
+            bestDistance = d;
+            best = &e;
+          }
+        }
+      };
+      if (bands_) {
+        // Within bands_ - 1 bits, at least one band is unchanged
+        for (int b = 0; b < bands_; b++) {
+          auto bucket = buckets_.find(bandKey(key.dHash, b));
+          if (bucket == buckets_.end()) continue;
+          for (size_t i : bucket->second) consider(entries_[i]);
+        }
+      } else {
+        for (const Entry &e : entries_) consider(e);
+      }
+      if (best) {
+        nearHits_++;
+        return parsePage(best->record.data(), best->record.size(), page);
+      }
+    }
+    misses_++;
+    return false;
+  }
+
+  void insert(const CacheKey &key, const OcrPage &page) {
+    OutputBuffer record;
+    serializePage(record, page);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (byPixels_.count(exactKey(key))) return;
+    if (file_) {
+      OutputBuffer header;
+      header.appendRaw(key.pixelHash);
+      header.appendRaw(key.dHash);
+      header.appendRaw(key.width);
+      header.appendRaw(key.height);
+      header.appendRaw(key.backend);
+      header.appendSized(std::string_view(reinterpret_cast<const char *>(key.grid.data()), key.grid.size()));
+      header.appendRaw((uint32_t)record.size());
+      fwrite(header.data(), 1, header.size(), file_);
+      fwrite(record.data(), 1, record.size(), file_);
+      fflush(file_);
+    }
+    add({key, record.str()});
+  }
+
+  size_t hits() const { return hits_; }
+  size_t nearHits() const { return nearHits_; }
+  size_t misses() const { return misses_; }
+  size_t size() const { return entries_.size(); }
+
+private:
+  struct Entry {
+    CacheKey key;
+    std::string record;
+  };
+
+  // Same pixels, size and backend
+  static bool sameImage(const CacheKey &a, const CacheKey &b) {
+    return a.pixelHash == b.pixelHash && a.width == b.width && a.height == b.height && a.backend == b.backend;
+  }
+  static uint64_t exactKey(const CacheKey &key) { return key.pixelHash ^ cache_detail::mix(0, key.backend); }
+
+  // Band b of bands_ equal slices of the dHash, tagged with b
+  uint64_t bandKey(uint64_t dHash, int b) const {
+    int lo = 64 * b / bands_, hi = 64 * (b + 1) / bands_;
+    uint64_t bits = hi - lo == 64 ? dHash : (dHash >> lo) & ((1ull << (hi - lo)) - 1);
+    return cache_detail::mix(bits, (uint64_t)b + 1);
+  }
+
+  static bool gridsAgree(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+    if (a.size() != kCacheGridCells || b.size() != kCacheGridCells) return false;
+    size_t total = 0;
+    for (size_t i = 0; i < kCacheGridCells; i++) {
+      int d = std::abs((int)a[i] - (int)b[i]);
+      if (d > kGridMaxDiff) return false;
+      total += d;
+    }
+    return total <= kCacheGridCells * kGridMeanDiff;
+  }
+
+  // Caller holds the lock (or is loading)
+  void add(Entry entry) {
+    size_t index = entries_.size();
+    byPixels_[exactKey(entry.key)] = index;
+    if (bands_ && entry.key.grid.size() == kCacheGridCells) {
+      for (int b = 0; b < bands_; b++) buckets_[bandKey(entry.key.dHash, b)].push_back(index);
+    }
+    entries_.push_back(std::move(entry));
+  }
+
+  // Reads every complete entry; returns the byte length of the good prefix
+  // (0 if the header is wrong)
+  uintmax_t load(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return 0;
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.append(chunk, n);
+    fclose(f);
+
+    uint32_t version = 0;
+    if (data.size() < 8 || data.compare(0, 4, "OCRC") != 0) return 0;
+    memcpy(&version, data.data() + 4, 4);
+    if (version != kVersion) return 0;
+    size_t pos = 8;
+    while (pos < data.size()) {
+      Entry e;
+      uint32_t len = 0;
+      std::string_view grid;
+      RecordReader in(data.data() + pos, data.size() - pos);
+      if (!in.read(e.key.pixelHash) || !in.read(e.key.dHash) || !in.read(e.key.width) || !in.read(e.key.height) ||
+          !in.read(e.key.backend) || !in.readSized(grid) || (!grid.empty() && grid.size() != kCacheGridCells) ||
+          !in.read(len)) {
+        break;
+      }
+      size_t headerSize = 8 + 8 + 4 + 4 + 4 + 4 + grid.size() + 4;
+      if (data.size() - pos - headerSize < len) break;
+      e.key.grid.assign(grid.begin(), grid.end());
+      e.record.assign(data, pos + headerSize, len);
+      pos += headerSize + len;
+      add(std::move(e));
+    }
+    return pos;
+  }
+
+  std::shared_mutex mutex_;
+  std::vector<Entry> entries_;
+  std::unordered_map<uint64_t, size_t> byPixels_;
+  // Band key -> entries with that band (bands_ > 0)
+  std::unordered_map<uint64_t, std::vector<size_t>> buckets_;
+  FILE *file_ = nullptr;
+  int maxNearDistance_ = -1;
+  int bands_ = 0;
+  uint32_t backend_ = 0;
+  std::atomic<size_t> hits_{0}, nearHits_{0}, misses_{0};
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+// Job queue with priority lanes, in front of the OCR workers. Interactive
+// jobs go ahead of bulk ones, but after interactiveBurst interactive jobs
+// run in a row a waiting bulk job gets a turn, so a steady stream of
+// requests can't starve a backfill. Each lane has its own capacity, so a full bulk
+// lane never blocks an interactive push. Jobs whose deadline has passed or
+// whose token was cancelled are handed out with a drop reason instead of
+// being run; the owner still completes them. Wait times (push to pop) are
+// kept per lane in a log histogram for the metrics.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+enum JobLane : uint32_t { kLaneInteractive = 0, kLaneBulk = 1 };
+constexpr size_t kLanes = 2;
+
+struct CancelToken {
+  std::atomic<bool> cancelled{false};
+  void cancel() { cancelled = true; }
+};
+
+// Why an entry came out of the scheduler without being run
+enum class JobDrop { kNone, kExpired, kCancelled };
+
+struct LaneMetrics {
+  size_t depth = 0, maxDepth = 0;
+  uint64_t queued = 0, started = 0, expired = 0, cancelled = 0;
+  // Push to pop, for started jobs; percentiles are histogram bucket bounds
+  double waitAvgMs = 0, waitP50Ms = 0, waitP99Ms = 0, waitMaxMs = 0;
+};
+
+struct SchedulerMetrics {
+  std::array<LaneMetrics, kLanes> lanes;
+};
+
+// One line per lane, key=value
+inline std::string formatMetrics(const SchedulerMetrics &metrics) {
+  static const char *const names[kLanes] = {"interactive", "bulk"};
+  std::string out;
+  char line[320];
+  for (size_t l = 0; l < kLanes; l++) {
+    const LaneMetrics &m = metrics.lanes[l];
+    snprintf(line, sizeof(line),
+             "lane=%s depth=%zu max_depth=%zu queued=%llu started=%llu expired=%llu cancelled=%llu "
+             "wait_avg_ms=%.2f wait_p50_ms=%.2f wait_p99_ms=%.2f wait_max_ms=%.2f\n",
+             names[l], m.depth, m.maxDepth, (unsigned long long)m.queued, (unsigned long long)m.started,
+             (unsigned long long)m.expired, (unsigned long long)m.cancelled, m.waitAvgMs, m.waitP50Ms, m.waitP99Ms,
+             m.waitMaxMs);
+    out += line;
+  }
+  return out;
+}
+
+template <class T>
+class JobScheduler {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct Entry {
+    T item;
+    JobLane lane = kLaneInteractive;
+    JobDrop drop = JobDrop::kNone;
+  };
+
+  explicit JobScheduler(size_t capacityPerLane, unsigned interactiveBurst = 8)
+      : capacity_(capacityPerLane ? capacityPerLane : 1), burst_(std::max(interactiveBurst, 1u)) {}
+
+  // Waits while the lane is full; false if the scheduler was closed first
+  bool push(T item, JobLane lane = kLaneInteractive, clock::time_point deadline = clock::time_point::max(),
+            std::shared_ptr<CancelToken> cancel = nullptr) {
+    Lane &l = lanes_[std::min<size_t>(lane, kLanes - 1)];
+    std::unique_lock<std::mutex> lock(mutex_);
+    l.notFull.wait(lock, [&] { return closed_ || l.items.size() < capacity_; });
+    if (closed_) return false;
+    l.items.push_back({std::move(item), deadline, std::move(cancel), clock::now()});
+    l.queued++;
+    l.maxDepth = std::max(l.maxDepth, l.items.size());
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  // Next entry by priority; nullopt once closed and drained
+  std::optional<Entry> pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notEmpty_.wait(lock, [&] { return closed_ || !empty(); });
+    return take();
+  }
+
+  // Like pop(), but nullopt right away when nothing is queued
+  std::optional<Entry> tryPop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return take();
+  }
+
+  // Wakes everyone; pop() then drains what is left
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    notEmpty_.notify_all();
+    for (Lane &l : lanes_) l.notFull.notify_all();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (const Lane &l : lanes_) n += l.items.size();
+    return n;
+  }
+
+  SchedulerMetrics metrics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SchedulerMetrics out;
+    for (size_t i = 0; i < kLanes; i++) {
+      const Lane &l = lanes_[i];
+      LaneMetrics &m = out.lanes[i];
+      m.depth = l.items.size();
+      m.maxDepth = l.maxDepth;
+      m.queued = l.queued;
+      m.started = l.started;
+      m.expired = l.expired;
+      m.cancelled = l.cancelled;
+      if (l.started) {
+        m.waitAvgMs = l.waitSumMicros / 1000.0 / l.started;
+        m.waitP50Ms = percentile(l, 0.50);
+        m.waitP99Ms = percentile(l, 0.99);
+        m.waitMaxMs = l.waitMaxMicros / 1000.0;
+      }
+    }
+    return out;
+  }
+
+private:
+  // Quarter-octave buckets of microseconds: bucket b holds waits up to 2^(b/4)
+  static constexpr size_t kBuckets = 128;
+
+  struct Item {
+    T item;
+    clock::time_point deadline;
+    std::shared_ptr<CancelToken> cancel;
+    clock::time_point queuedAt;
+  };
+  struct Lane {
+    std::deque<Item> items;
+    std::condition_variable notFull;
+    size_t maxDepth = 0;
+    uint64_t queued = 0, started = 0, expired = 0, cancelled = 0;
+    uint64_t waitSumMicros = 0, waitMaxMicros = 0;
+    std::array<uint64_t, kBuckets> waits{};
+  };
+
+  bool empty() const {
+    for (const Lane &l : lanes_) {
+      if (!l.items.empty()) return false;
+    }
+    return true;
+  }
+
+  static double percentile(const Lane &l, double p) {
+    uint64_t rank = (uint64_t)std::ceil(p * l.started), seen = 0;
+    for (size_t b = 0; b < kBuckets; b++) {
+      seen += l.waits[b];
+      if (seen >= rank && seen > 0) return std::min(std::exp2(b / 4.0), (double)l.waitMaxMicros) / 1000.0;
+    }
+    return l.waitMaxMicros / 1000.0;
+  }
+
+  // Caller holds mutex_
+  std::optional<Entry> take() {
+    Lane &interactive = lanes_[kLaneInteractive], &bulk = lanes_[kLaneBulk];
+    size_t lane;
+    bool bulkWaiting = !bulk.items.empty();
+    if (!interactive.items.empty() && (!bulkWaiting || streak_ < burst_)) {
+      lane = kLaneInteractive;
+    } else if (!bulk.items.empty()) {
+      lane = kLaneBulk;
+      streak_ = 0;
+    } else {
+      return std::nullopt;
+    }
+    Lane &l = lanes_[lane];
+    Item item = std::move(l.items.front());
+    l.items.pop_front();
+    l.notFull.notify_one();
+
+    Entry entry{std::move(item.item), (JobLane)lane, JobDrop::kNone};
+    auto now = clock::now();
+    if (item.cancel && item.cancel->cancelled) {
+      entry.drop = JobDrop::kCancelled;
+      l.cancelled++;
+    } else if (now > item.deadline) {
+      entry.drop = JobDrop::kExpired;
+      l.expired++;
+    } else {
+      uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - item.queuedAt).count();
+      size_t bucket = micros ? std::min<size_t>((size_t)std::ceil(std::log2((double)micros) * 4), kBuckets - 1) : 0;
+      l.waits[bucket]++;
+      l.started++;
+      l.waitSumMicros += micros;
+      l.waitMaxMicros = std::max(l.waitMaxMicros, micros);
+    }
+    // Only interactive jobs run ahead of a waiting bulk job count toward its
+    // turn; dropped ones cost the bulk lane nothing
+    if (lane == kLaneInteractive) {
+      if (!bulkWaiting) {
+        streak_ = 0;
+      } else if (entry.drop == JobDrop::kNone) {
+        streak_++;
+      }
+    }
+    return entry;
+  }
+
+  const size_t capacity_;
+  const unsigned burst_;
+  mutable std::mutex mutex_;
+  std::condition_variable notEmpty_;
+  std::array<Lane, kLanes> lanes_;
+  unsigned streak_ = 0;
+  bool closed_ = false;
+};
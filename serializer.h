@@ -0,0 +1,174 @@
+#pragma once
+
+// Buffered output: every document is built in one growable buffer with
+// std::to_chars number formatting and SIMD escaping, then written with a
+// single call.
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define SERIALIZER_SSE2 1
+#endif
+
+class OutputBuffer {
+public:
+  void clear() { buf_.clear(); }
+  const char *data() const { return buf_.data(); }
+  size_t size() const { return buf_.size(); }
+  const std::string &str() const { return buf_; }
+
+  void append(std::string_view s) { buf_.append(s.data(), s.size()); }
+  void put(char c) { buf_.push_back(c); }
+
+  void appendInt(int64_t v) {
+    char tmp[24];
+    auto r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    buf_.append(tmp, r.ptr - tmp);
+  }
+
+  // Same text as ostream << float (%g, 6 significant digits, "C" locale)
+  void appendFloat(float v) {
+    char tmp[32];
+    auto r = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::general, 6);
+    buf_.append(tmp, r.ptr - tmp);
+  }
+
+  // Shortest text that reads back to the same float; null for NaN/inf
+  void appendJsonFloat(float v) {
+    if (!std::isfinite(v)) {
+      append("null");
+      return;
+    }
+    char tmp[32];
+    auto r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    buf_.append(tmp, r.ptr - tmp);
+  }
+
+  // Little-endian raw value (all supported targets are little-endian)
+  template <class T>
+  void appendRaw(T v) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    buf_.append(reinterpret_cast<const char *>(&v), sizeof(T));
+  }
+
+  // u32 length + bytes
+  void appendSized(std::string_view s) {
+    appendRaw((uint32_t)s.size());
+    append(s);
+  }
+
+  void appendXmlEscaped(std::string_view s) {
+    appendEscaped(s, isXmlSpecial, xmlMask, [this](char c) {
+      switch (c) {
+        case '&': append("&amp;"); break;
+        case '<': append("&lt;"); break;
+        case '>': append("&gt;"); break;
+        case '"': append("&quot;"); break;
+        default: append("&apos;"); break;
+      }
+    });
+  }
+
+  void appendJsonEscaped(std::string_view s) {
+    appendEscaped(s, isJsonSpecial, jsonMask, [this](char c) {
+      switch (c) {
+        case '"': append("\\\""); break;
+        case '\\': append("\\\\"); break;
+        case '\n': append("\\n"); break;
+        case '\r': append("\\r"); break;
+        case '\t': append("\\t"); break;
+        default: {
+          static const char hex[] = "0123456789abcdef";
+          char esc[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF]};
+          buf_.append(esc, 6);
+        }
+      }
+    });
+  }
+
+  // One write for the whole document. Text mode keeps the CRLF line endings
+  // the ofstream writers produced on Windows.
+  bool writeTo(const std::string &path, bool text) const {
+    FILE *f = fopen(path.c_str(), text ? "w" : "wb");
+    if (!f) return false;
+    bool ok = fwrite(buf_.data(), 1, buf_.size(), f) == buf_.size();
+    return fclose(f) == 0 && ok;
+  }
+
+private:
+  static bool isXmlSpecial(unsigned char c) { return c == '&' || c == '<' || c == '>' || c == '"' || c == '\''; }
+  static bool isJsonSpecial(unsigned char c) { return c == '"' || c == '\\' || c < 0x20; }
+
+#if SERIALIZER_SSE2
+  // Bit i set if p[i] is special, same sets as the predicates above
+  static int xmlMask(const char *p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')), _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    return _mm_movemask_epi8(hit);
+  }
+
+  static int jsonMask(const char *p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    // c <= 0x1F unsigned  <=>  max(c, 0x1F) == 0x1F
+    __m128i hit = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    return _mm_movemask_epi8(hit);
+  }
+
+  static int ctz(int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, (unsigned long)mask);
+    return (int)index;
+#else
+    return __builtin_ctz((unsigned)mask);
+#endif
+  }
+#else
+  static int xmlMask(const char *) { return 0; }
+  static int jsonMask(const char *) { return 0; }
+#endif
+
+  // Copies runs without special characters in bulk, checking 16 bytes at a
+  // time with SSE2 where available
+  template <class Escape>
+  void appendEscaped(std::string_view s, bool (*isSpecial)(unsigned char), int (*mask16)(const char *),
+                     Escape escape) {
+    const char *p = s.data(), *end = p + s.size();
+    while (p < end) {
+      const char *run = p;
+#if SERIALIZER_SSE2
+      while (end - p >= 16) {
+        int mask = mask16(p);
+        if (mask) {
+          p += ctz(mask);
+          break;
+        }
+        p += 16;
+      }
+#else
+      (void)mask16;
+#endif
+      while (p < end && !isSpecial((unsigned char)*p)) p++;
+      buf_.append(run, p - run);
+      if (p < end) escape(*p++);
+    }
+  }
+
+  std::string buf_;
+};
@@ -0,0 +1,486 @@
+#pragma once
+
+// Shared-memory frame ingest. A capture process (the producer) creates a
+// named ring of frame slots and writes raw BGRA frames into it; the OCR side
+// builds Img straight over the slot memory, so a frame is never encoded,
+// copied or decoded on the way. Each frame slot has a matching result slot
+// the answer is written to, in the same format as the socket server's
+// response payload (see encodeResult).
+//
+// Memory layout: ShmHeader, then slots x (ShmFrameSlot + frameBytes), then
+// slots x (ShmResultSlot + resultBytes), everything 64-byte aligned.
+// Sequence number n lives in slot n % slots. One producer; any number of
+// consumer threads (in one process) claim sequence numbers in order. A
+// slot's sequence number and state share one 64-bit tag, so a slot is seen
+// and claimed in one atomic step. Both sides record their process id, and
+// a side waiting on the other gives up once that process is gone.
+//
+// POSIX shared memory (shm_open) on Linux, a named file mapping on Windows.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ocr_backend.h"
+#include "ocr_server.h"
+#include "ocr_types.h"
+
+constexpr uint32_t kShmMagic = 0x5352434F; // "OCRS"
+constexpr uint32_t kShmVersion = 2;
+
+// Slot states; a frame slot goes Free -> Ready (producer) -> Busy (consumer)
+// -> Free once its result is written, a result slot Free -> Ready -> Free
+constexpr uint64_t kSlotFree = 0;
+constexpr uint64_t kSlotReady = 1;
+constexpr uint64_t kSlotBusy = 2;
+
+// Slot tag: sequence number above the two state bits
+inline uint64_t slotTag(uint64_t sequence, uint64_t state) { return sequence << 2 | state; }
+inline uint64_t slotState(uint64_t tag) { return tag & 3; }
+
+struct alignas(64) ShmHeader {
+  std::atomic<uint32_t> magic; // written last by the producer
+  uint32_t version;
+  uint32_t slots;
+  uint32_t reserved;
+  uint64_t frameBytes;  // pixel capacity of a frame slot
+  uint64_t resultBytes; // payload capacity of a result slot
+  std::atomic<uint32_t> closed;   // set by the producer after its last frame
+  std::atomic<uint64_t> claimed;  // next sequence number for a consumer to take
+  std::atomic<uint32_t> producerPid;
+  std::atomic<uint32_t> consumerPid; // 0 until a consumer attaches
+};
+
+struct alignas(64) ShmFrameSlot {
+  std::atomic<uint64_t> tag; // slotTag(sequence, state)
+  uint32_t flags;            // kJobWords
+  int32_t width, height;
+  uint32_t stride;
+};
+
+struct alignas(64) ShmResultSlot {
+  std::atomic<uint64_t> tag;
+  int32_t status; // kPage*, as in the socket protocol
+  uint32_t size;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "shared-memory atomics must be lock free");
+
+namespace shm_detail {
+
+inline uint64_t alignUp(uint64_t n) { return (n + 63) / 64 * 64; }
+
+inline uint32_t currentPid() {
+#ifdef _WIN32
+  return (uint32_t)GetCurrentProcessId();
+#else
+  return (uint32_t)getpid();
+#endif
+}
+
+// False once the process has exited; pid 0 (nobody attached yet) is alive
+inline bool processAlive(uint32_t pid) {
+  if (pid == 0) return true;
+#ifdef _WIN32
+  HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+  if (!process) return GetLastError() == ERROR_ACCESS_DENIED;
+  bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+  CloseHandle(process);
+  return alive;
+#else
+  return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// Spins briefly, then yields, then sleeps; for waits across processes
+class Backoff {
+public:
+  // True about every 50 ms once sleeping, for checks too slow to run on
+  // every round (the peer process still being there)
+  bool slow() const { return count_ > 0 && (count_ >= 4096 ? count_ % 50 == 0 : count_ % 1024 == 0); }
+
+  void pause() {
+    if (++count_ < 64) return;
+    if (count_ < 256) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(count_ < 4096 ? 50 : 1000));
+    }
+  }
+
+private:
+  uint32_t count_ = 0;
+};
+
+} // namespace shm_detail
+
+// A named shared-memory block, unmapped (and removed, if created here) on
+// destruction
+class SharedMemory {
+public:
+  SharedMemory() = default;
+  ~SharedMemory() { close(); }
+  SharedMemory(const SharedMemory &) = delete;
+  SharedMemory &operator=(const SharedMemory &) = delete;
+
+  // Creates the block, replacing a stale one of the same name
+  bool create(const std::string &name, uint64_t size) {
+    close();
+#ifdef _WIN32
+    std::string full = "Local\\" + name;
+    handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(size >> 32),
+                                 (DWORD)size, full.c_str());
+    if (!handle_) return false;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+      fprintf(stderr, "Shared memory %s is in use\n", name.c_str());
+      close();
+      return false;
+    }
+    data_ = static_cast<uint8_t *>(MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size));
+#else
+    std::string full = posixName(name);
+    shm_unlink(full.c_str());
+    int fd = shm_open(full.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return false;
+    name_ = full;
+    if (ftruncate(fd, (off_t)size) != 0) {
+      ::close(fd);
+      return false;
+    }
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    data_ = p == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p);
+#endif
+    size_ = size;
+    return data_ != nullptr;
+  }
+
+  // Maps a block created by another process
+  bool open(const std::string &name) {
+    close();
+#ifdef _WIN32
+    std::string full = "Local\\" + name;
+    handle_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, full.c_str());
+    if (!handle_) return false;
+    data_ = static_cast<uint8_t *>(MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    MEMORY_BASIC_INFORMATION info;
+    if (data_ && VirtualQuery(data_, &info, sizeof(info))) size_ = info.RegionSize;
+#else
+    int fd = shm_open(posixName(name).c_str(), O_RDWR, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        data_ = static_cast<uint8_t *>(p);
+        size_ = (uint64_t)st.st_size;
+      }
+    }
+    ::close(fd);
+#endif
+    return data_ != nullptr;
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (handle_) CloseHandle(handle_);
+    handle_ = nullptr;
+#else
+    if (data_) munmap(data_, size_);
+    if (!name_.empty()) shm_unlink(name_.c_str());
+    name_.clear();
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  uint8_t *data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+  HANDLE handle_ = nullptr;
+#else
+  static std::string posixName(const std::string &name) { return name.empty() || name[0] != '/' ? "/" + name : name; }
+  std::string name_; // set when created here, for shm_unlink
+#endif
+  uint8_t *data_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+// Typed view of the ring inside a SharedMemory block
+class ShmRing {
+public:
+  static uint64_t bytesFor(uint32_t slots, uint64_t frameBytes, uint64_t resultBytes) {
+    using shm_detail::alignUp;
+    return sizeof(ShmHeader) + slots * (sizeof(ShmFrameSlot) + alignUp(frameBytes)) +
+           slots * (sizeof(ShmResultSlot) + alignUp(resultBytes));
+  }
+
+  // Producer side: lays out a new ring
+  bool create(const std::string &name, uint32_t slots, uint64_t frameBytes, uint64_t resultBytes) {
+    slots = std::max(slots, 1u);
+    frameBytes = shm_detail::alignUp(frameBytes);
+    resultBytes = shm_detail::alignUp(resultBytes);
+    if (!memory_.create(name, bytesFor(slots, frameBytes, resultBytes))) {
+      fprintf(stderr, "Failed to create shared memory %s\n", name.c_str());
+      return false;
+    }
+    header_ = new (memory_.data()) ShmHeader{{0}, kShmVersion, slots, 0, frameBytes, resultBytes, {0}, {0},
+                                             {shm_detail::currentPid()}, {0}};
+    for (uint32_t i = 0; i < slots; i++) {
+      new (frameSlot(i)) ShmFrameSlot{{slotTag(0, kSlotFree)}, 0, 0, 0, 0};
+      new (resultSlot(i)) ShmResultSlot{{slotTag(0, kSlotFree)}, 0, 0};
+    }
+    // A consumer polling for the ring only accepts it once this is set
+    header_->magic.store(kShmMagic, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: maps and checks an existing ring
+  bool open(const std::string &name) {
+    if (!memory_.open(name)) return false;
+    header_ = reinterpret_cast<ShmHeader *>(memory_.data());
+    if (memory_.size() < sizeof(ShmHeader) || header_->magic.load(std::memory_order_acquire) != kShmMagic ||
+        header_->version != kShmVersion ||
+        memory_.size() < bytesFor(header_->slots, header_->frameBytes, header_->resultBytes)) {
+      // magic 0: the producer is still laying it out
+      if (memory_.size() < sizeof(ShmHeader) || header_->magic.load(std::memory_order_relaxed) != 0) {
+        fprintf(stderr, "Shared memory %s is not an OCR ring\n", name.c_str());
+      }
+      memory_.close();
+      header_ = nullptr;
+      return false;
+    }
+    header_->consumerPid.store(shm_detail::currentPid(), std::memory_order_release);
+    return true;
+  }
+
+  ShmHeader &header() const { return *header_; }
+  uint32_t slots() const { return header_->slots; }
+
+  bool producerAlive() const {
+    return shm_detail::processAlive(header_->producerPid.load(std::memory_order_acquire));
+  }
+  bool consumerAlive() const {
+    return shm_detail::processAlive(header_->consumerPid.load(std::memory_order_acquire));
+  }
+
+  ShmFrameSlot *frameSlot(uint64_t sequence) const {
+    uint64_t stride = sizeof(ShmFrameSlot) + header_->frameBytes;
+    return reinterpret_cast<ShmFrameSlot *>(memory_.data() + sizeof(ShmHeader) +
+                                            sequence % header_->slots * stride);
+  }
+  uint8_t *framePixels(uint64_t sequence) const { return reinterpret_cast<uint8_t *>(frameSlot(sequence) + 1); }
+
+  ShmResultSlot *resultSlot(uint64_t sequence) const {
+    uint64_t stride = sizeof(ShmResultSlot) + header_->resultBytes;
+    return reinterpret_cast<ShmResultSlot *>(memory_.data() + sizeof(ShmHeader) +
+                                             header_->slots * (sizeof(ShmFrameSlot) + header_->frameBytes) +
+                                             sequence % header_->slots * stride);
+  }
+  uint8_t *resultPayload(uint64_t sequence) const { return reinterpret_cast<uint8_t *>(resultSlot(sequence) + 1); }
+
+private:
+  SharedMemory memory_;
+  ShmHeader *header_ = nullptr;
+};
+
+// Writes frames and reads their results, in sequence order
+class ShmProducer {
+public:
+  bool create(const std::string &name, uint32_t slots, uint64_t frameBytes, uint64_t resultBytes = 4 << 20) {
+    return ring_.create(name, slots, frameBytes, resultBytes);
+  }
+
+  // Slot memory for the next frame, once the slot is free again (its
+  // previous result must have been read); null if the frame can't fit, or
+  // the slot stays busy past timeout or because the consumer is gone
+  uint8_t *acquire(uint64_t bytes, std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+    if (bytes > ring_.header().frameBytes) return nullptr;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    shm_detail::Backoff backoff;
+    while (slotState(ring_.frameSlot(next_)->tag.load(std::memory_order_acquire)) != kSlotFree) {
+      if (backoff.slow() && (std::chrono::steady_clock::now() > deadline || !ring_.consumerAlive())) return nullptr;
+      backoff.pause();
+    }
+    return ring_.framePixels(next_);
+  }
+
+  // Hands the frame written into acquire()'s memory to the consumers and
+  // returns its sequence number
+  uint64_t publish(int32_t width, int32_t height, uint32_t stride, uint32_t flags) {
+    ShmFrameSlot *slot = ring_.frameSlot(next_);
+    slot->width = width;
+    slot->height = height;
+    slot->stride = stride;
+    slot->flags = flags;
+    slot->tag.store(slotTag(next_, kSlotReady), std::memory_order_release);
+    return next_++;
+  }
+
+  // Waits for the result of sequence; false on timeout or once the
+  // consumer is gone
+  bool result(uint64_t sequence, int32_t &status, std::string &payload, std::chrono::milliseconds timeout) {
+    ShmResultSlot *slot = ring_.resultSlot(sequence);
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    shm_detail::Backoff backoff;
+    while (slot->tag.load(std::memory_order_acquire) != slotTag(sequence, kSlotReady)) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      if (backoff.slow() && !ring_.consumerAlive()) return false;
+      backoff.pause();
+    }
+    status = slot->status;
+    payload.assign(reinterpret_cast<const char *>(ring_.resultPayload(sequence)), slot->size);
+    slot->tag.store(slotTag(sequence, kSlotFree), std::memory_order_release);
+    return true;
+  }
+
+  // No more frames; consumers exit once the published ones are done
+  void close() { ring_.header().closed.store(1, std::memory_order_release); }
+
+  uint32_t slots() const { return ring_.slots(); }
+
+private:
+  ShmRing ring_;
+  uint64_t next_ = 0;
+};
+
+struct ShmStats {
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> failed{0};
+};
+
+// Recognizes frames from a ring until the producer closes it. Each backend
+// gets a thread that claims the next sequence number, runs it on the slot's
+// pixels and writes the answer to the matching result slot.
+class ShmConsumer {
+public:
+  bool open(const std::string &name) { return ring_.open(name); }
+
+  // Waits up to timeout for a producer to create the ring
+  bool waitFor(const std::string &name, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!ring_.open(name)) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return true;
+  }
+
+  uint32_t slots() const { return ring_.slots(); }
+
+  void run(std::vector<std::unique_ptr<OcrBackend>> &backends) {
+    CoreReservation cores((int64_t)backends.size());
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < backends.size(); w++) threads.emplace_back([&, w] { workerLoop(*backends[w]); });
+    workerLoop(*backends[0]);
+    for (auto &t : threads) t.join();
+  }
+
+  const ShmStats &stats() const { return stats_; }
+  // The producer exited without closing the ring
+  bool producerLost() const { return lost_; }
+
+private:
+  void workerLoop(OcrBackend &backend) {
+    ShmHeader &header = ring_.header();
+    OcrPage page;
+    OutputBuffer text, record;
+    for (;;) {
+      uint64_t sequence = header.claimed.fetch_add(1, std::memory_order_relaxed);
+      ShmFrameSlot *frame = ring_.frameSlot(sequence);
+      shm_detail::Backoff backoff;
+      // Ready -> Busy in one step; the tag also says the slot holds this
+      // sequence and not the previous round
+      auto claim = [&] {
+        uint64_t expected = slotTag(sequence, kSlotReady);
+        return frame->tag.compare_exchange_strong(expected, slotTag(sequence, kSlotBusy), std::memory_order_acquire,
+                                                  std::memory_order_relaxed);
+      };
+      while (!claim()) {
+        // Everything published is ready before closed is set
+        if (header.closed.load(std::memory_order_acquire) && !claim()) return;
+        if (backoff.slow() && !ring_.producerAlive()) {
+          lost_ = true;
+          return;
+        }
+        backoff.pause();
+      }
+
+      int32_t status = kPageOk;
+      const char *error = nullptr;
+      uint64_t bytes = (uint64_t)frame->stride * (uint64_t)std::max(frame->height, 0);
+      if (frame->width <= 0 || frame->height <= 0 || frame->stride < (uint64_t)frame->width * 4 ||
+          bytes > header.frameBytes) {
+        status = kPageBadImage;
+        error = "bad frame size";
+      } else {
+        // Zero copy: the pipeline reads the slot memory
+        Img img{.t = 3, .col = frame->width, .row = frame->height, ._unk = 0, .step = frame->stride,
+                .data_ptr = (int64_t)ring_.framePixels(sequence)};
+        if (recognizePage(backend, img, page, (frame->flags & kJobWords) ? kExtractWords : kExtractLines)) {
+          encodeResult(page, (frame->flags & kJobWords) != 0, text, record);
+        } else {
+          status = kPageFailed;
+          error = "OCR failed";
+        }
+      }
+      std::string_view payload = error ? std::string_view(error) : std::string_view(record.str());
+      if (!error && payload.size() > header.resultBytes) {
+        status = kPageTooLarge;
+        payload = "result too large for the ring";
+      }
+      if (status != kPageOk) {
+        stats_.failed++;
+      } else {
+        stats_.frames++;
+      }
+
+      // The result slot frees up when the producer reads the previous round
+      ShmResultSlot *result = ring_.resultSlot(sequence);
+      while (slotState(result->tag.load(std::memory_order_acquire)) != kSlotFree) {
+        if (backoff.slow() && !ring_.producerAlive()) {
+          lost_ = true;
+          return;
+        }
+        backoff.pause();
+      }
+      memcpy(ring_.resultPayload(sequence), payload.data(), payload.size());
+      result->status = status;
+      result->size = (uint32_t)payload.size();
+      result->tag.store(slotTag(sequence, kSlotReady), std::memory_order_release);
+      frame->tag.store(slotTag(sequence, kSlotFree), std::memory_order_release);
+    }
+  }
+
+  ShmRing ring_;
+  ShmStats stats_;
+  std::atomic<bool> lost_{false};
+};
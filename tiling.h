@@ -0,0 +1,322 @@
+#pragma once
+
+// Tiled recognition for images too large for one RunOcrPipeline call (and
+// its 1000 line cap). The image is cut into overlapping tiles, zero-copy
+// views of the same pixels, which run concurrently on separate pipelines.
+// Tile-local polygons are moved to page coordinates, and lines seen by two
+// tiles in an overlap band are reduced to the most complete copy. The result
+// is served through the OcrBackend interface, so extraction, the cache and
+// grouping work on it unchanged.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ocr_backend.h"
+#include "ocr_types.h"
+#include "trace.h"
+
+// Images up to tileSize wide are cut into full-width bands only. Wider ones
+// also get vertical tile edges, where a line longer than the overlap can
+// come out in two pieces.
+struct TileOptions {
+  // Longest tile side in pixels
+  int tileSize = 2560;
+  // Pixels shared by neighbouring tiles; should exceed the tallest line
+  int overlap = 160;
+  // Copy words out of the tile results (only word outputs need them)
+  bool words = true;
+};
+
+struct TileRect {
+  int x = 0, y = 0, width = 0, height = 0;
+};
+
+struct TileWord {
+  std::string text;
+  bool hasBox = false;
+  float box[4] = {}; // width, height, x, y like the engine
+};
+
+struct TileLine {
+  std::string text;
+  bool hasBox = false;
+  float box[8] = {}; // TL, TR, BR, BL like the engine
+  std::vector<TileWord> words;
+};
+
+// Lines of one tile, in tile coordinates
+struct TileResult {
+  TileRect rect;
+  std::vector<TileLine> lines;
+};
+
+// Splits one axis into count spans of equal length overlapping by overlap
+inline std::vector<std::pair<int, int>> splitAxis(int length, int tileSize, int overlap) {
+  std::vector<std::pair<int, int>> spans;
+  if (length <= tileSize) {
+    spans.push_back({0, length});
+    return spans;
+  }
+  overlap = std::clamp(overlap, 0, tileSize / 2);
+  int count = (length - overlap + (tileSize - overlap) - 1) / (tileSize - overlap);
+  int span = (length + (count - 1) * overlap + count - 1) / count;
+  for (int i = 0; i < count; i++) {
+    int start = std::min(i * (span - overlap), length - span);
+    spans.push_back({start, span});
+  }
+  return spans;
+}
+
+// Row-major tiles covering the image; one tile when it already fits
+inline std::vector<TileRect> planTiles(int width, int height, const TileOptions &options) {
+  std::vector<TileRect> tiles;
+  for (auto [y, h] : splitAxis(height, options.tileSize, options.overlap)) {
+    for (auto [x, w] : splitAxis(width, options.tileSize, options.overlap)) {
+      tiles.push_back({x, y, w, h});
+    }
+  }
+  return tiles;
+}
+
+namespace tiling_detail {
+
+struct Box {
+  float x0, y0, x1, y1;
+  float area() const { return std::max(x1 - x0, 0.0f) * std::max(y1 - y0, 0.0f); }
+};
+
+// Axis-aligned box of a polygon; (0,0) points are unused slots, as in extractPage
+inline Box boundsOf(const float *poly) {
+  Box b{poly[0], poly[1], poly[0], poly[1]};
+  for (int p = 1; p < 4; p++) {
+    float x = poly[2 * p], y = poly[2 * p + 1];
+    if (x == 0.0f && y == 0.0f) continue;
+    b.x0 = std::min(b.x0, x);
+    b.y0 = std::min(b.y0, y);
+    b.x1 = std::max(b.x1, x);
+    b.y1 = std::max(b.y1, y);
+  }
+  return b;
+}
+
+inline float intersection(const Box &a, const Box &b) {
+  Box i{std::max(a.x0, b.x0), std::max(a.y0, b.y0), std::min(a.x1, b.x1), std::min(a.y1, b.y1)};
+  return i.x1 > i.x0 && i.y1 > i.y0 ? i.area() : 0.0f;
+}
+
+inline void translate(float *poly, float dx, float dy) {
+  for (int p = 0; p < 4; p++) {
+    if (poly[2 * p] == 0.0f && poly[2 * p + 1] == 0.0f) continue;
+    poly[2 * p] += dx;
+    poly[2 * p + 1] += dy;
+  }
+}
+
+// Word boxes are width, height, x, y; only the origin moves
+inline void translateWord(float *box, float dx, float dy) {
+  box[2] += dx;
+  box[3] += dy;
+}
+
+} // namespace tiling_detail
+
+// Moves every tile's lines to page coordinates and drops duplicates from the
+// overlap bands. Two lines of different tiles are the same line when their
+// boxes share at least half of the smaller box; the copy kept is the one not
+// cut by its tile's inner edge, then the larger one. Lines away from the
+// bands, and lines without a box, are kept as they are. Output is in tile
+// order, then engine order within a tile.
+inline std::vector<TileLine> mergeTiles(std::vector<TileResult> &tiles) {
+  using namespace tiling_detail;
+  struct Candidate {
+    TileLine *line;
+    size_t tile;
+    Box box;
+    bool cut, inBand;
+  };
+  // Page extent, to tell inner tile edges from image borders
+  int pageWidth = 0, pageHeight = 0;
+  for (const TileResult &t : tiles) {
+    pageWidth = std::max(pageWidth, t.rect.x + t.rect.width);
+    pageHeight = std::max(pageHeight, t.rect.y + t.rect.height);
+  }
+
+  std::vector<Candidate> candidates;
+  for (size_t t = 0; t < tiles.size(); t++) {
+    const TileRect &r = tiles[t].rect;
+    const float edge = 2.0f;
+    for (TileLine &line : tiles[t].lines) {
+      if (line.hasBox) translate(line.box, (float)r.x, (float)r.y);
+      for (TileWord &word : line.words) {
+        if (word.hasBox) translateWord(word.box, (float)r.x, (float)r.y);
+      }
+      Candidate c{&line, t, {}, false, false};
+      if (line.hasBox) {
+        c.box = boundsOf(line.box);
+        c.cut = (r.x > 0 && c.box.x0 <= r.x + edge) || (r.y > 0 && c.box.y0 <= r.y + edge) ||
+                (r.x + r.width < pageWidth && c.box.x1 >= r.x + r.width - edge) ||
+                (r.y + r.height < pageHeight && c.box.y1 >= r.y + r.height - edge);
+        for (size_t o = 0; o < tiles.size() && !c.inBand; o++) {
+          const TileRect &other = tiles[o].rect;
+          Box ob{(float)other.x, (float)other.y, (float)(other.x + other.width), (float)(other.y + other.height)};
+          c.inBand = o != t && intersection(c.box, ob) > 0;
+        }
+      }
+      candidates.push_back(c);
+    }
+  }
+
+  // Best copies first; a band line is accepted unless it duplicates an
+  // accepted line of another tile
+  std::vector<size_t> band;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (candidates[i].inBand) band.push_back(i);
+  }
+  std::stable_sort(band.begin(), band.end(), [&](size_t a, size_t b) {
+    if (candidates[a].cut != candidates[b].cut) return !candidates[a].cut;
+    return candidates[a].box.area() > candidates[b].box.area();
+  });
+  std::vector<char> keep(candidates.size(), 1);
+  std::vector<size_t> accepted;
+  for (size_t i : band) {
+    const Candidate &c = candidates[i];
+    bool duplicate = false;
+    for (size_t j : accepted) {
+      const Candidate &a = candidates[j];
+      if (a.tile == c.tile) continue;
+      float smaller = std::min(a.box.area(), c.box.area());
+      if (smaller > 0 && intersection(a.box, c.box) >= 0.5f * smaller) {
+        duplicate = true;
+        break;
+      }
+    }
+    if (duplicate) {
+      keep[i] = 0;
+    } else {
+      accepted.push_back(i);
+    }
+  }
+
+  std::vector<TileLine> merged;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (keep[i]) merged.push_back(std::move(*candidates[i].line));
+  }
+  return merged;
+}
+
+// Runs the region tile.rect of img and copies its raw lines (tile
+// coordinates) out of the engine result, with their words if asked
+inline bool captureTile(OcrBackend &backend, const Img &img, TileResult &tile, const char *spanName = "tile",
+                        bool captureWords = true) {
+  trace::Span span(spanName);
+  const TileRect &r = tile.rect;
+  Img view = img;
+  view.col = r.width;
+  view.row = r.height;
+  view.data_ptr = img.data_ptr + (int64_t)r.y * img.step + (int64_t)r.x * 4;
+  int64_t instance = backend.run(view);
+  if (!instance) return false;
+  int64_t count = backend.lineCount(instance);
+  for (int64_t i = 0; i < count; i++) {
+    int64_t line = backend.line(instance, i);
+    if (!line) continue;
+    TileLine &out = tile.lines.emplace_back();
+    const char *text = backend.lineContent(line);
+    out.text = text ? text : "";
+    if (const float *box = backend.lineBoundingBox(line)) {
+      out.hasBox = true;
+      std::copy(box, box + 8, out.box);
+    }
+    int64_t words = captureWords ? backend.wordCount(line) : 0;
+    for (int64_t j = 0; j < words; j++) {
+      int64_t word = backend.word(line, j);
+      const char *wordText = backend.wordContent(word);
+      if (!wordText) continue;
+      TileWord &w = out.words.emplace_back();
+      w.text = wordText;
+      if (const float *box = backend.wordBoundingBox(word)) {
+        w.hasBox = true;
+        std::copy(box, box + 4, w.box);
+      }
+    }
+  }
+  backend.releaseResult(instance);
+  return true;
+}
+
+// Serves a std::vector<TileLine> (passed as the instance) through the
+// OcrBackend accessors, so extractPage can read assembled results
+class TileLinesReader : public OcrBackend {
+public:
+  int64_t run(const Img &) override { return 0; }
+  void releaseResult(int64_t) override {}
+
+  int64_t lineCount(int64_t instance) override {
+    return (int64_t)reinterpret_cast<std::vector<TileLine> *>(instance)->size();
+  }
+  int64_t line(int64_t instance, int64_t index) override {
+    auto *lines = reinterpret_cast<std::vector<TileLine> *>(instance);
+    if (index < 0 || index >= (int64_t)lines->size()) return 0;
+    return reinterpret_cast<int64_t>(&(*lines)[index]);
+  }
+  const char *lineContent(int64_t line) override { return reinterpret_cast<TileLine *>(line)->text.c_str(); }
+  const float *lineBoundingBox(int64_t line) override {
+    TileLine *ln = reinterpret_cast<TileLine *>(line);
+    return ln->hasBox ? ln->box : nullptr;
+  }
+  int64_t wordCount(int64_t line) override { return (int64_t)reinterpret_cast<TileLine *>(line)->words.size(); }
+  int64_t word(int64_t line, int64_t index) override {
+    TileLine *ln = reinterpret_cast<TileLine *>(line);
+    if (index < 0 || index >= (int64_t)ln->words.size()) return 0;
+    return reinterpret_cast<int64_t>(&ln->words[index]);
+  }
+  const char *wordContent(int64_t word) override {
+    return word ? reinterpret_cast<TileWord *>(word)->text.c_str() : nullptr;
+  }
+  const float *wordBoundingBox(int64_t word) override {
+    TileWord *wd = reinterpret_cast<TileWord *>(word);
+    return wd && wd->hasBox ? wd->box : nullptr;
+  }
+  bool concurrentReads() const override { return true; }
+};
+
+// Runs tiles of large images on all inner pipelines at once. Images that fit
+// in one tile go to the first pipeline whole.
+class TiledBackend : public TileLinesReader {
+public:
+  TiledBackend(std::vector<std::unique_ptr<OcrBackend>> inner, TileOptions options)
+      : inner_(std::move(inner)), options_(options) {}
+
+  int64_t run(const Img &img) override {
+    std::vector<TileRect> rects = planTiles(img.col, img.row, options_);
+    std::vector<TileResult> tiles(rects.size());
+    std::atomic<size_t> nextTile{0};
+    std::atomic<bool> failed{false};
+    auto work = [&](OcrBackend &backend) {
+      for (size_t t; (t = nextTile++) < tiles.size();) {
+        tiles[t].rect = rects[t];
+        if (!captureTile(backend, img, tiles[t], "tile", options_.words)) failed = true;
+      }
+    };
+    size_t threads = std::min(inner_.size(), tiles.size());
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < threads; w++) pool.emplace_back(work, std::ref(*inner_[w]));
+    work(*inner_[0]);
+    for (auto &t : pool) t.join();
+    if (failed) return 0;
+
+    trace::Span span("tile.merge", (int64_t)tiles.size());
+    auto *result = new std::vector<TileLine>(mergeTiles(tiles));
+    return reinterpret_cast<int64_t>(result);
+  }
+  void releaseResult(int64_t instance) override { delete reinterpret_cast<std::vector<TileLine> *>(instance); }
+
+private:
+  std::vector<std::unique_ptr<OcrBackend>> inner_;
+  TileOptions options_;
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+// Scoped timing spans, compiled in always and switched on at runtime
+// (--trace). A disabled span costs one relaxed atomic load. Enabled spans
+// are appended to a per-thread buffer; at the end of the run they are
+// written as a Chrome trace (chrome://tracing, Perfetto) and summarized as
+// p50/p95/p99 per stage.
+//
+// --log turns on the verbose per-line output that used to need a /DLOG build.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "serializer.h"
+
+namespace trace {
+
+inline std::atomic<bool> g_enabled{false};
+inline std::atomic<bool> g_log{false};
+
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+inline bool logging() { return g_log.load(std::memory_order_relaxed); }
+
+// printf that only prints with --log
+inline void log(const char *format, ...) {
+  if (!logging()) return;
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+inline int64_t nowNs() {
+  static const auto origin = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+struct Event {
+  const char *name; // string literal
+  int64_t startNs;
+  int64_t durationNs;
+  int64_t arg; // stage specific count (lines, bytes), -1 if none
+};
+
+// Events of one thread. The registry keeps it alive after the thread exits.
+struct ThreadBuffer {
+  uint32_t tid = 0;
+  std::mutex mutex; // only contended while exporting
+  std::vector<Event> events;
+};
+
+class Registry {
+public:
+  static Registry &instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  ThreadBuffer &local() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = add();
+    return *buffer;
+  }
+
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffers_;
+  }
+
+private:
+  std::shared_ptr<ThreadBuffer> add() {
+    auto buffer = std::make_shared<ThreadBuffer>();
+    buffer->events.reserve(1024);
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer->tid = (uint32_t)buffers_.size() + 1;
+    buffers_.push_back(buffer);
+    return buffer;
+  }
+
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+};
+
+class Span {
+public:
+  explicit Span(const char *name, int64_t arg = -1) : name_(name), arg_(arg) {
+    if (enabled()) start_ = nowNs();
+  }
+  ~Span() {
+    if (start_ < 0) return;
+    Event event{name_, start_, nowNs() - start_, arg_};
+    ThreadBuffer &buffer = Registry::instance().local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(event);
+  }
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+  void setArg(int64_t arg) { arg_ = arg; }
+
+private:
+  const char *name_;
+  int64_t arg_;
+  int64_t start_ = -1;
+};
+
+inline std::vector<std::pair<uint32_t, Event>> collect() {
+  std::vector<std::pair<uint32_t, Event>> all;
+  for (const auto &buffer : Registry::instance().buffers()) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    for (const Event &e : buffer->events) all.push_back({buffer->tid, e});
+  }
+  return all;
+}
+
+// Microseconds with ns precision, as Chrome trace expects
+inline void appendMicros(OutputBuffer &out, int64_t ns) {
+  out.appendInt(ns / 1000);
+  char frac[4] = {'.', char('0' + ns % 1000 / 100), char('0' + ns % 100 / 10), char('0' + ns % 10)};
+  out.append(std::string_view(frac, 4));
+}
+
+inline bool writeChromeTrace(const std::string &path) {
+  OutputBuffer out;
+  out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  for (const auto &[tid, e] : collect()) {
+    if (!first) out.append(",\n");
+    first = false;
+    out.append("{\"name\":\"");
+    out.appendJsonEscaped(e.name);
+    out.append("\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+    out.appendInt(tid);
+    out.append(",\"ts\":");
+    appendMicros(out, e.startNs);
+    out.append(",\"dur\":");
+    appendMicros(out, e.durationNs);
+    if (e.arg >= 0) {
+      out.append(",\"args\":{\"n\":");
+      out.appendInt(e.arg);
+      out.put('}');
+    }
+    out.put('}');
+  }
+  out.append("\n]}\n");
+  return out.writeTo(path, false);
+}
+
+// Count, total and p50/p95/p99 duration per stage
+inline void printSummary() {
+  std::map<std::string, std::vector<int64_t>> byStage;
+  for (const auto &entry : collect()) byStage[entry.second.name].push_back(entry.second.durationNs);
+  if (byStage.empty()) return;
+  printf("%-12s %8s %12s %10s %10s %10s\n", "stage", "count", "total ms", "p50 ms", "p95 ms", "p99 ms");
+  for (auto &[name, durations] : byStage) {
+    std::sort(durations.begin(), durations.end());
+    int64_t total = 0;
+    for (int64_t d : durations) total += d;
+    auto pct = [&](double p) {
+      size_t rank = (size_t)(p * durations.size() + 0.999999);
+      return durations[std::min(durations.size(), std::max<size_t>(rank, 1)) - 1] / 1e6;
+    };
+    printf("%-12s %8zu %12.2f %10.3f %10.3f %10.3f\n", name.c_str(), durations.size(), total / 1e6, pct(0.50),
+           pct(0.95), pct(0.99));
+  }
+}
+
+} // namespace trace
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Per-worker deques of item indices. Indices are dealt round-robin, so the
+// workers move through the items together and finish them roughly in index
+// order; an in-order committer then only buffers about one item per worker.
+// Each worker takes from the front of its own deque and, once that is empty,
+// steals the lowest waiting index from the front of another deque. A few
+// huge items then only delay the worker holding them.
+class WorkStealingQueue {
+public:
+  WorkStealingQueue(size_t count, int workers) : slots_(std::max(workers, 1)) {
+    for (size_t i = 0; i < count; i++) slots_[i % slots_.size()].items.push_back(i);
+  }
+
+  // Next index for worker, or nullopt when all deques are empty.
+  // stolen is set when the index came from another worker.
+  std::optional<size_t> next(int worker, bool *stolen = nullptr) {
+    if (stolen) *stolen = false;
+    {
+      Slot &own = slots_[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.items.empty()) {
+        size_t i = own.items.front();
+        own.items.pop_front();
+        return i;
+      }
+    }
+    for (;;) {
+      size_t victim = slots_.size(), lowest = SIZE_MAX;
+      for (size_t w = 0; w < slots_.size(); w++) {
+        if ((int)w == worker) continue;
+        std::lock_guard<std::mutex> lock(slots_[w].mutex);
+        if (!slots_[w].items.empty() && slots_[w].items.front() < lowest) {
+          lowest = slots_[w].items.front();
+          victim = w;
+        }
+      }
+      if (victim == slots_.size()) return std::nullopt;
+      Slot &slot = slots_[victim];
+      std::lock_guard<std::mutex> lock(slot.mutex);
+      // It may have been drained since we looked; pick again
+      if (slot.items.empty()) continue;
+      size_t i = slot.items.front();
+      slot.items.pop_front();
+      if (stolen) *stolen = true;
+      return i;
+    }
+  }
+
+private:
+  struct Slot {
+    std::mutex mutex;
+    std::deque<size_t> items;
+  };
+  std::vector<Slot> slots_;
+};
+
+struct PoolStats {
+  size_t processed = 0;
+  double wallSeconds = 0;
+  std::vector<size_t> perWorker;
+  std::vector<size_t> stolen;
+};
+
+// Runs process(worker, index) for every index on `workers` threads fed by a
+// WorkStealingQueue, and commit(index, result) on the calling thread in
+// index order. Results finished early wait in a reorder buffer, which stays
+// about `workers` deep since the queue hands out indices in order. With a
+// window, a worker holding an index window or more ahead of the next one to
+// commit waits before processing it, so one slow item can't make the buffer
+// grow without bound. The worker holding the next index never waits: its own
+// indices come out in order and everything before them is committed.
+template <class Result>
+PoolStats runWorkerPool(size_t count, int workers,
+                        const std::function<std::optional<Result>(int, size_t)> &process,
+                        const std::function<void(size_t, Result &)> &commit, size_t window = 0) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  workers = std::max(workers, 1);
+
+  PoolStats stats;
+  stats.perWorker.assign(workers, 0);
+  stats.stolen.assign(workers, 0);
+
+  WorkStealingQueue queue(count, workers);
+  std::mutex mutex;
+  std::condition_variable ready, room;
+  size_t next = 0; // index the calling thread commits next
+  // done[i] is set once item i finished, with or without a result
+  std::vector<char> done(count, 0);
+  std::vector<std::optional<Result>> results(count);
+
+  std::vector<std::thread> threads;
+  for (int w = 0; w < workers; w++) {
+    threads.emplace_back([&, w] {
+      bool stolen = false;
+      while (std::optional<size_t> i = queue.next(w, &stolen)) {
+        if (window) {
+          std::unique_lock<std::mutex> lock(mutex);
+          room.wait(lock, [&] { return *i < next + window; });
+        }
+        std::optional<Result> result = process(w, *i);
+        std::lock_guard<std::mutex> lock(mutex);
+        results[*i] = std::move(result);
+        done[*i] = 1;
+        stats.perWorker[w]++;
+        if (stolen) stats.stolen[w]++;
+        ready.notify_one();
+      }
+    });
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    std::optional<Result> result;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [&] { return done[i] != 0; });
+      result = std::move(results[i]);
+      results[i].reset();
+      next = i + 1;
+    }
+    if (window) room.notify_all();
+    if (result) {
+      stats.processed++;
+      commit(i, *result);
+    }
+  }
+
+  for (auto &t : threads) t.join();
+  stats.wallSeconds = std::chrono::duration<double>(clock::now() - start).count();
+  return stats;
+}